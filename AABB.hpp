@@ -1,11 +1,78 @@
 #pragma once
 #include <Eigen/Dense>
 #include "Ray.hpp"
+#include <limits>
 
 struct AABB
 {
 	Eigen::Vector3f min, max;
 
+	/// <summary>
+	/// Returns an "inverted" AABB that contains nothing. Expanding it by any point
+	/// or box gives a box containing just that point or box.
+	/// </summary>
+	static AABB empty()
+	{
+		AABB aabb;
+		aabb.min = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+		aabb.max = Eigen::Vector3f::Constant(std::numeric_limits<float>::lowest());
+		return aabb;
+	}
+
+	bool isEmpty() const
+	{
+		return min.x() > max.x() || min.y() > max.y() || min.z() > max.z();
+	}
+
+	/// <summary>
+	/// Grow this AABB so that it contains the given point.
+	/// </summary>
+	void expand(const Eigen::Vector3f& point)
+	{
+		min = min.cwiseMin(point);
+		max = max.cwiseMax(point);
+	}
+
+	/// <summary>
+	/// Grow this AABB so that it contains the given AABB.
+	/// </summary>
+	void expand(const AABB& other)
+	{
+		min = min.cwiseMin(other.min);
+		max = max.cwiseMax(other.max);
+	}
+
+	/// <summary>
+	/// The part of this AABB that is also inside the other one (empty if they don't overlap).
+	/// </summary>
+	AABB intersection(const AABB& other) const
+	{
+		AABB aabb;
+		aabb.min = min.cwiseMax(other.min);
+		aabb.max = max.cwiseMin(other.max);
+		return aabb;
+	}
+
+	/// <summary>
+	/// Surface area of the box. Used by the Surface Area Heuristic when building BVHs.
+	/// </summary>
+	float surfaceArea() const
+	{
+		if (isEmpty()) return 0.f;
+		Eigen::Vector3f d = max - min;
+		return 2.f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+	}
+
+	/// <summary>
+	/// Index of the axis (0, 1 or 2 for x, y or z) along which the box is longest.
+	/// </summary>
+	int longestAxis() const
+	{
+		Eigen::Vector3f d = max - min;
+		if (d.x() >= d.y() && d.x() >= d.z()) return 0;
+		return d.y() >= d.z() ? 1 : 2;
+	}
+
 	bool overlaps(const AABB& other) const
 	{
 		return (this->min.x() <= other.max.x() && this->max.x() >= other.min.x()) &&
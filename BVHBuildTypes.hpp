@@ -0,0 +1,93 @@
+#pragma once
+#include "AABB.hpp"
+#include <vector>
+#include <memory>
+#include <functional>
+
+/// <summary>
+/// Algorithms available for building BVHs.
+/// </summary>
+enum class BVHBuildMethod
+{
+	SAH, // Top-down binned Surface Area Heuristic build (see BVHBuilder).
+	SBVH, // SAH build that can also split primitives between children (see BVHBuilder).
+	LBVH // Linear BVH built from Morton codes (see LBVHBuilder).
+};
+
+/// <summary>
+/// Parameters controlling how a BVH is built.
+/// The builder uses the Surface Area Heuristic (SAH), which estimates the cost of
+/// tracing a ray through a node as
+///     traversalCost + intersectionCost * (SA(left) * N(left) + SA(right) * N(right)) / SA(node)
+/// where SA is the surface area of an AABB and N the number of primitives on each side.
+/// A node is turned into a leaf when no split is cheaper than intersecting all of its
+/// primitives directly (intersectionCost * N).
+/// The spatial split BVH (SBVH) also considers splitting nodes with a plane, putting
+/// primitives that cross it into both children. This reduces the overlap between
+/// children for long, thin triangles, at the cost of more primitive references.
+/// Alternatively, a linear BVH (LBVH) can be built by sorting primitives along a Morton
+/// curve. This is much faster to build, but traversal is slower.
+/// </summary>
+struct BVHBuildParams
+{
+	BVHBuildMethod method = BVHBuildMethod::SAH; // Algorithm used to build the tree.
+	int sahBinCount = 16; // Number of bins along each axis used to evaluate candidate splits.
+	float traversalCost = 1.f; // Relative cost of visiting an interior node.
+	float intersectionCost = 1.f; // Relative cost of intersecting a single primitive.
+	int maxLeafSize = 8; // Nodes holding more primitives than this are always split (where possible).
+	int maxDepth = 64; // Safety limit on tree depth, to guard against degenerate input.
+	float spatialSplitAlpha = 1e-5f; // SBVH: only try spatial splits where children overlap by this fraction of the root's area.
+	float maxSpatialSplitDuplication = 1.f; // SBVH: allowed extra primitive references, as a fraction of the primitive count.
+	int mortonBits = 30; // Length of the Morton codes used by the LBVH builder (30 or 63).
+	int branchingFactor = 2; // Children per node of the traversal BVH (2, 4 or 8, see BVHHierarchy).
+	bool compressNodes = false; // Quantise child bounds to 8 bits, halving node size (4 or 8 wide only, see CompressedWideBVHNode).
+	float refitRebuildThreshold = 1.5f; // Rebuild rather than refit once the SAH cost grows by this factor.
+};
+
+/// <summary>
+/// A primitive as seen by the BVH builder. The builder only needs the world-space
+/// bounds and centroid of each primitive; index identifies the primitive in the
+/// caller's own list (e.g. a face index, or an index into a list of Renderables).
+/// </summary>
+struct BVHPrimitive
+{
+	AABB bounds;
+	Eigen::Vector3f centroid;
+	int index;
+};
+
+/// <summary>
+/// Function giving the bounds of the parts of a primitive on either side of a plane
+/// perpendicular to axis at position. Only the part of the primitive inside bounds
+/// (which may already have been clipped by earlier splits) is considered.
+/// The SBVH builder uses this to clip primitives more tightly than their bounding boxes.
+/// </summary>
+typedef std::function<void(int index, const AABB& bounds, int axis, float position, AABB& left, AABB& right)> BVHPrimitiveSplitter;
+
+/// <summary>
+/// A node of the intermediate tree produced by the BVH builder.
+/// Leaf nodes reference the range [primOffset, primOffset + primCount) of the
+/// (reordered) primitive list passed to the builder. Interior nodes always have
+/// two children.
+/// </summary>
+struct BVHBuildNode
+{
+	AABB bounds;
+	int splitAxis = 0;
+	int primOffset = 0, primCount = 0;
+	std::unique_ptr<BVHBuildNode> children[2];
+
+	bool isLeaf() const
+	{
+		return !children[0];
+	}
+
+	/// <summary>
+	/// Number of nodes in the subtree rooted at this node (including this one).
+	/// </summary>
+	int countNodes() const
+	{
+		if (isLeaf()) return 1;
+		return 1 + children[0]->countNodes() + children[1]->countNodes();
+	}
+};
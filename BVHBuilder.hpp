@@ -0,0 +1,847 @@
+#pragma once
+#include "AABB.hpp"
+#include "BVHBuildTypes.hpp"
+#include "LBVHBuilder.hpp"
+#include "GeomUtil.hpp"
+#include "Model.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// <summary>
+/// Builds a binary BVH over a list of primitives. By default this uses the binned Surface
+/// Area Heuristic described below; setting BVHBuildParams::method to LBVH hands the build
+/// to LBVHBuilder instead, which is much faster but gives a lower quality tree.
+/// The primitive list is reordered in place so that each leaf refers to a contiguous range.
+/// The build runs in parallel using OpenMP tasks: separate subtrees are built by separate
+/// tasks, and the binning and partitioning of large nodes near the root is split into
+/// chunks so the top levels of the tree don't become a serial bottleneck.
+/// </summary>
+class BVHBuilder
+{
+public:
+	static constexpr int PARALLEL_SUBTREE_THRESHOLD = 4096; // Build subtrees with more primitives than this as separate tasks.
+	static constexpr int PARALLEL_NODE_THRESHOLD = 65536; // Split the work within nodes with more primitives than this.
+	static constexpr int MAX_SAH_BINS = 64;
+
+private:
+	BVHBuildParams params_;
+	mutable double lastBuildSeconds_;
+
+	struct Bin
+	{
+		AABB bounds;
+		int count;
+	};
+
+	/// <summary>
+	/// The cheapest split found for a node: primitives whose centroids fall in a bin
+	/// before splitBin (out of nBins along splitAxis) go to the first child.
+	/// </summary>
+	struct SAHSplit
+	{
+		int axis = -1, bin = -1, nBins = 0;
+		float cost = std::numeric_limits<float>::max();
+		AABB leftBounds, rightBounds;
+	};
+
+	int binIndex(const BVHPrimitive& prim, int axis, const AABB& centroidBounds, int nBins) const
+	{
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		int b = static_cast<int>(nBins * (prim.centroid[axis] - centroidBounds.min[axis]) / extent);
+		return std::min(std::max(b, 0), nBins - 1);
+	}
+
+	/// <summary>
+	/// Number of pieces to split the work within a node into.
+	/// </summary>
+	int chunkCount(int count) const
+	{
+#ifdef _OPENMP
+		if (count >= PARALLEL_NODE_THRESHOLD)
+			return std::min(4 * omp_get_num_threads(), count / (PARALLEL_NODE_THRESHOLD / 16));
+#endif
+		return 1;
+	}
+
+	/// <summary>
+	/// Calls f(chunk, chunkBegin, chunkEnd) for each of nChunks equal pieces of [begin, end),
+	/// running the pieces as parallel tasks when there is more than one.
+	/// </summary>
+	template <typename F>
+	void forEachChunk(int begin, int end, int nChunks, const F& f) const
+	{
+		if (nChunks <= 1) {
+			f(0, begin, end);
+			return;
+		}
+		for (int c = 0; c < nChunks; ++c) {
+			int chunkBegin = begin + static_cast<int>(static_cast<long long>(end - begin) * c / nChunks);
+			int chunkEnd = begin + static_cast<int>(static_cast<long long>(end - begin) * (c + 1) / nChunks);
+			#pragma omp task firstprivate(c, chunkBegin, chunkEnd) shared(f)
+			f(c, chunkBegin, chunkEnd);
+		}
+		#pragma omp taskwait
+	}
+
+	std::unique_ptr<BVHBuildNode> makeLeaf(const AABB& bounds, int begin, int end) const
+	{
+		auto node = std::make_unique<BVHBuildNode>();
+		node->bounds = bounds;
+		node->primOffset = begin;
+		node->primCount = end - begin;
+		return node;
+	}
+
+	/// <summary>
+	/// Moves the primitives in [begin, end) for which goesLeft is true to the start of the
+	/// range, and returns the index of the first primitive that goes right.
+	/// Large ranges are partitioned in parallel using the scratch buffer.
+	/// </summary>
+	template <typename Predicate>
+	int partition(std::vector<BVHPrimitive>& prims, std::vector<BVHPrimitive>& scratch,
+		int begin, int end, const Predicate& goesLeft) const
+	{
+		int nChunks = chunkCount(end - begin);
+		if (nChunks <= 1) {
+			return static_cast<int>(std::partition(prims.begin() + begin, prims.begin() + end, goesLeft) - prims.begin());
+		}
+
+		// Count how many primitives in each chunk go left, then work out where each chunk's
+		// primitives end up, scatter them into the scratch buffer and copy them back.
+		std::vector<int> leftCounts(nChunks), leftStarts(nChunks), rightStarts(nChunks);
+		forEachChunk(begin, end, nChunks, [&](int c, int chunkBegin, int chunkEnd) {
+			leftCounts[c] = static_cast<int>(std::count_if(prims.begin() + chunkBegin, prims.begin() + chunkEnd, goesLeft));
+		});
+		int mid = begin;
+		for (int c = 0; c < nChunks; ++c) mid += leftCounts[c];
+		int leftPos = begin, rightPos = mid;
+		for (int c = 0; c < nChunks; ++c) {
+			int chunkSize = static_cast<int>(static_cast<long long>(end - begin) * (c + 1) / nChunks)
+				- static_cast<int>(static_cast<long long>(end - begin) * c / nChunks);
+			leftStarts[c] = leftPos;
+			rightStarts[c] = rightPos;
+			leftPos += leftCounts[c];
+			rightPos += chunkSize - leftCounts[c];
+		}
+		forEachChunk(begin, end, nChunks, [&](int c, int chunkBegin, int chunkEnd) {
+			int l = leftStarts[c], r = rightStarts[c];
+			for (int i = chunkBegin; i < chunkEnd; ++i) {
+				if (goesLeft(prims[i])) scratch[l++] = prims[i];
+				else scratch[r++] = prims[i];
+			}
+		});
+		forEachChunk(begin, end, nChunks, [&](int, int chunkBegin, int chunkEnd) {
+			std::copy(scratch.begin() + chunkBegin, scratch.begin() + chunkEnd, prims.begin() + chunkBegin);
+		});
+		return mid;
+	}
+
+	/// <summary>
+	/// Evaluates the SAH at each bin boundary along each axis, and returns the cheapest split.
+	/// </summary>
+	SAHSplit findSAHSplit(const std::vector<BVHPrimitive>& prims, int begin, int end,
+		const AABB& bounds, const AABB& centroidBounds) const
+	{
+		int count = end - begin;
+		int nChunks = chunkCount(count);
+		SAHSplit best;
+
+		// Small nodes don't need more bins than they have primitives.
+		int nBins = std::min(params_.sahBinCount, std::max(count, 2));
+
+		// Each chunk of the node's primitives is binned separately, with the results merged
+		// afterwards. Nodes handled in a single chunk use bins on the stack.
+		Bin localBins[3 * MAX_SAH_BINS];
+		std::vector<Bin> chunkBins;
+		Bin* allBins = localBins;
+		if (nChunks > 1) {
+			chunkBins.resize(nChunks * 3 * nBins);
+			allBins = chunkBins.data();
+		}
+		for (int b = 0; b < nChunks * 3 * nBins; ++b) {
+			allBins[b].bounds = AABB::empty();
+			allBins[b].count = 0;
+		}
+
+		forEachChunk(begin, end, nChunks, [&](int c, int chunkBegin, int chunkEnd) {
+			for (int axis = 0; axis < 3; ++axis) {
+				if (centroidBounds.max[axis] <= centroidBounds.min[axis]) continue;
+				Bin* bins = &allBins[(c * 3 + axis) * nBins];
+				for (int i = chunkBegin; i < chunkEnd; ++i) {
+					Bin& bin = bins[binIndex(prims[i], axis, centroidBounds, nBins)];
+					bin.bounds.expand(prims[i].bounds);
+					++bin.count;
+				}
+			}
+		});
+
+		float nodeArea = bounds.surfaceArea();
+		AABB rightBounds[MAX_SAH_BINS];
+		int rightCount[MAX_SAH_BINS];
+
+		for (int axis = 0; axis < 3; ++axis) {
+			if (centroidBounds.max[axis] <= centroidBounds.min[axis]) continue;
+
+			// Merge the bins found by each chunk into those of the first.
+			Bin* bins = &allBins[axis * nBins];
+			for (int c = 1; c < nChunks; ++c) {
+				const Bin* other = &allBins[(c * 3 + axis) * nBins];
+				for (int b = 0; b < nBins; ++b) {
+					bins[b].bounds.expand(other[b].bounds);
+					bins[b].count += other[b].count;
+				}
+			}
+
+			// Sweep from the right to find the area and count to the right of each boundary...
+			AABB accum = AABB::empty();
+			int accumCount = 0;
+			for (int b = nBins - 1; b > 0; --b) {
+				accum.expand(bins[b].bounds);
+				accumCount += bins[b].count;
+				rightBounds[b] = accum;
+				rightCount[b] = accumCount;
+			}
+
+			// ...then sweep from the left, evaluating the cost of splitting after bin b-1.
+			accum = AABB::empty();
+			accumCount = 0;
+			for (int b = 1; b < nBins; ++b) {
+				accum.expand(bins[b - 1].bounds);
+				accumCount += bins[b - 1].count;
+				if (accumCount == 0 || rightCount[b] == 0) continue;
+				float cost = params_.traversalCost + params_.intersectionCost *
+					(accum.surfaceArea() * accumCount + rightBounds[b].surfaceArea() * rightCount[b]) / nodeArea;
+				if (cost < best.cost) {
+					best.cost = cost;
+					best.axis = axis;
+					best.bin = b;
+					best.nBins = nBins;
+					best.leftBounds = accum;
+					best.rightBounds = rightBounds[b];
+				}
+			}
+		}
+
+		return best;
+	}
+
+	std::unique_ptr<BVHBuildNode> buildRecursive(std::vector<BVHPrimitive>& prims, std::vector<BVHPrimitive>& scratch,
+		int begin, int end, int depth) const
+	{
+		int count = end - begin;
+		int nChunks = chunkCount(count);
+
+		AABB bounds = AABB::empty(), centroidBounds = AABB::empty();
+		if (nChunks <= 1) {
+			for (int i = begin; i < end; ++i) {
+				bounds.expand(prims[i].bounds);
+				centroidBounds.expand(prims[i].centroid);
+			}
+		}
+		else {
+			std::vector<AABB> chunkBounds(nChunks, AABB::empty()), chunkCentroidBounds(nChunks, AABB::empty());
+			forEachChunk(begin, end, nChunks, [&](int c, int chunkBegin, int chunkEnd) {
+				for (int i = chunkBegin; i < chunkEnd; ++i) {
+					chunkBounds[c].expand(prims[i].bounds);
+					chunkCentroidBounds[c].expand(prims[i].centroid);
+				}
+			});
+			for (int c = 0; c < nChunks; ++c) {
+				bounds.expand(chunkBounds[c]);
+				centroidBounds.expand(chunkCentroidBounds[c]);
+			}
+		}
+
+		if (count <= 1 || depth >= params_.maxDepth) {
+			return makeLeaf(bounds, begin, end);
+		}
+
+		SAHSplit split = findSAHSplit(prims, begin, end, bounds, centroidBounds);
+
+		float leafCost = params_.intersectionCost * count;
+		if (count <= params_.maxLeafSize && !(split.cost < leafCost)) {
+			return makeLeaf(bounds, begin, end);
+		}
+
+		int mid, splitAxis;
+		if (split.axis >= 0) {
+			splitAxis = split.axis;
+			mid = partition(prims, scratch, begin, end,
+				[&](const BVHPrimitive& p) { return binIndex(p, split.axis, centroidBounds, split.nBins) < split.bin; });
+		}
+		else {
+			// All centroids coincide (or the node is degenerate), so the SAH can't separate
+			// the primitives. Split the list in half so the leaf size limit is still respected.
+			splitAxis = centroidBounds.longestAxis();
+			mid = (begin + end) / 2;
+			std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+				[&](const BVHPrimitive& a, const BVHPrimitive& b) { return a.centroid[splitAxis] < b.centroid[splitAxis]; });
+		}
+
+		auto node = std::make_unique<BVHBuildNode>();
+		node->bounds = bounds;
+		node->splitAxis = splitAxis;
+
+		// Subtrees cover disjoint ranges of the primitive list, so can be built concurrently.
+		BVHBuildNode* nodePtr = node.get();
+		if (count >= PARALLEL_SUBTREE_THRESHOLD) {
+			#pragma omp task shared(prims, scratch) firstprivate(nodePtr, begin, mid, depth)
+			nodePtr->children[0] = buildRecursive(prims, scratch, begin, mid, depth + 1);
+			nodePtr->children[1] = buildRecursive(prims, scratch, mid, end, depth + 1);
+			#pragma omp taskwait
+		}
+		else {
+			nodePtr->children[0] = buildRecursive(prims, scratch, begin, mid, depth + 1);
+			nodePtr->children[1] = buildRecursive(prims, scratch, mid, end, depth + 1);
+		}
+		return node;
+	}
+
+	/// <summary>
+	/// The cheapest spatial split found for a node: a plane at position along axis, with
+	/// the bounds and number of the primitive references that end up on each side.
+	/// </summary>
+	struct SpatialSplit
+	{
+		int axis = -1;
+		float position = 0.f;
+		float cost = std::numeric_limits<float>::max();
+		AABB leftBounds, rightBounds;
+		int leftCount = 0, rightCount = 0;
+	};
+
+	struct SpatialBin
+	{
+		AABB bounds;
+		int entries, exits; // Number of references starting and ending in this bin.
+	};
+
+	/// <summary>
+	/// State shared by all the nodes of an SBVH build. While building, the primOffset of
+	/// each leaf indexes leafRefs; the references are gathered into one list at the end.
+	/// </summary>
+	struct SpatialBuildState
+	{
+		const BVHPrimitiveSplitter* splitter;
+		float rootArea;
+		std::vector<std::vector<BVHPrimitive>> leafRefs;
+	};
+
+	/// <summary>
+	/// Splits a primitive's bounding box with the plane. Used when no better splitter is
+	/// available for the primitives (e.g. for Renderables).
+	/// </summary>
+	static void splitBounds(int, const AABB& bounds, int axis, float position, AABB& left, AABB& right)
+	{
+		left = right = bounds;
+		left.max[axis] = std::min(position, bounds.max[axis]);
+		right.min[axis] = std::max(position, bounds.min[axis]);
+	}
+
+	/// <summary>
+	/// Bins the node's bounds into equal slabs along each axis, clipping each reference
+	/// into every slab it crosses, and evaluates the SAH at each slab boundary.
+	/// </summary>
+	SpatialSplit findSpatialSplit(const std::vector<BVHPrimitive>& refs, const AABB& bounds,
+		const BVHPrimitiveSplitter& splitter) const
+	{
+		SpatialSplit best;
+		int nBins = params_.sahBinCount;
+		float nodeArea = bounds.surfaceArea();
+		SpatialBin bins[MAX_SAH_BINS];
+		AABB rightBounds[MAX_SAH_BINS];
+		int rightCount[MAX_SAH_BINS];
+
+		for (int axis = 0; axis < 3; ++axis) {
+			float origin = bounds.min[axis];
+			float binWidth = (bounds.max[axis] - origin) / nBins;
+			if (!(binWidth > 0.f)) continue;
+
+			for (int b = 0; b < nBins; ++b) {
+				bins[b].bounds = AABB::empty();
+				bins[b].entries = bins[b].exits = 0;
+			}
+
+			for (const BVHPrimitive& ref : refs) {
+				int first = std::min(std::max(static_cast<int>((ref.bounds.min[axis] - origin) / binWidth), 0), nBins - 1);
+				int last = std::min(std::max(static_cast<int>((ref.bounds.max[axis] - origin) / binWidth), first), nBins - 1);
+				AABB rest = ref.bounds;
+				for (int b = first; b < last; ++b) {
+					AABB left, right;
+					splitter(ref.index, rest, axis, origin + (b + 1) * binWidth, left, right);
+					bins[b].bounds.expand(left);
+					rest = right;
+				}
+				bins[last].bounds.expand(rest);
+				++bins[first].entries;
+				++bins[last].exits;
+			}
+
+			AABB accum = AABB::empty();
+			int accumCount = 0;
+			for (int b = nBins - 1; b > 0; --b) {
+				accum.expand(bins[b].bounds);
+				accumCount += bins[b].exits;
+				rightBounds[b] = accum;
+				rightCount[b] = accumCount;
+			}
+
+			accum = AABB::empty();
+			accumCount = 0;
+			for (int b = 1; b < nBins; ++b) {
+				accum.expand(bins[b - 1].bounds);
+				accumCount += bins[b - 1].entries;
+				if (accumCount == 0 || rightCount[b] == 0) continue;
+				float cost = params_.traversalCost + params_.intersectionCost *
+					(accum.surfaceArea() * accumCount + rightBounds[b].surfaceArea() * rightCount[b]) / nodeArea;
+				if (cost < best.cost) {
+					best.cost = cost;
+					best.axis = axis;
+					best.position = origin + b * binWidth;
+					best.leftBounds = accum;
+					best.rightBounds = rightBounds[b];
+					best.leftCount = accumCount;
+					best.rightCount = rightCount[b];
+				}
+			}
+		}
+
+		return best;
+	}
+
+	/// <summary>
+	/// Divides the references between the two sides of a spatial split. References crossing
+	/// the plane are split in two, unless moving them entirely to one side is cheaper
+	/// ("reference unsplitting").
+	/// </summary>
+	void partitionSpatial(const std::vector<BVHPrimitive>& refs, SpatialSplit split, const BVHPrimitiveSplitter& splitter,
+		std::vector<BVHPrimitive>& leftRefs, std::vector<BVHPrimitive>& rightRefs) const
+	{
+		int axis = split.axis;
+		for (const BVHPrimitive& ref : refs) {
+			if (ref.bounds.max[axis] <= split.position) {
+				leftRefs.push_back(ref);
+				continue;
+			}
+			if (ref.bounds.min[axis] >= split.position) {
+				rightRefs.push_back(ref);
+				continue;
+			}
+
+			AABB leftUnsplit = split.leftBounds, rightUnsplit = split.rightBounds;
+			leftUnsplit.expand(ref.bounds);
+			rightUnsplit.expand(ref.bounds);
+			float leftArea = split.leftBounds.surfaceArea(), rightArea = split.rightBounds.surfaceArea();
+			float splitCost = leftArea * split.leftCount + rightArea * split.rightCount;
+			float leftOnlyCost = leftUnsplit.surfaceArea() * split.leftCount + rightArea * (split.rightCount - 1);
+			float rightOnlyCost = leftArea * (split.leftCount - 1) + rightUnsplit.surfaceArea() * split.rightCount;
+
+			if (leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost) {
+				leftRefs.push_back(ref);
+				split.leftBounds = leftUnsplit;
+				--split.rightCount;
+			}
+			else if (rightOnlyCost < splitCost) {
+				rightRefs.push_back(ref);
+				split.rightBounds = rightUnsplit;
+				--split.leftCount;
+			}
+			else {
+				BVHPrimitive left = ref, right = ref;
+				splitter(ref.index, ref.bounds, axis, split.position, left.bounds, right.bounds);
+				left.bounds = left.bounds.intersection(ref.bounds);
+				right.bounds = right.bounds.intersection(ref.bounds);
+				left.centroid = left.bounds.centre();
+				right.centroid = right.bounds.centre();
+				if (!left.bounds.isEmpty()) leftRefs.push_back(left);
+				if (!right.bounds.isEmpty()) rightRefs.push_back(right);
+			}
+		}
+	}
+
+	std::unique_ptr<BVHBuildNode> makeSpatialLeaf(SpatialBuildState& state, const AABB& bounds, std::vector<BVHPrimitive>& refs) const
+	{
+		int refCount = static_cast<int>(refs.size());
+		int leafIndex;
+		#pragma omp critical(sbvh_leaves)
+		{
+			leafIndex = static_cast<int>(state.leafRefs.size());
+			state.leafRefs.emplace_back(std::move(refs));
+		}
+		return makeLeaf(bounds, leafIndex, leafIndex + refCount);
+	}
+
+	/// <summary>
+	/// Builds a node of an SBVH. Each node holds its own list of primitive references, as
+	/// references can be duplicated into both children by spatial splits.
+	/// duplicationBudget is the number of extra references the subtree may add. It is shared
+	/// between the children in proportion to their size, so the result doesn't depend on
+	/// the order nodes are built in.
+	/// </summary>
+	std::unique_ptr<BVHBuildNode> buildSpatialRecursive(SpatialBuildState& state, std::vector<BVHPrimitive> refs,
+		int duplicationBudget, int depth) const
+	{
+		int count = static_cast<int>(refs.size());
+		AABB bounds = AABB::empty(), centroidBounds = AABB::empty();
+		for (const BVHPrimitive& ref : refs) {
+			bounds.expand(ref.bounds);
+			centroidBounds.expand(ref.centroid);
+		}
+
+		if (count <= 1 || depth >= params_.maxDepth) {
+			return makeSpatialLeaf(state, bounds, refs);
+		}
+
+		SAHSplit objectSplit = findSAHSplit(refs, 0, count, bounds, centroidBounds);
+
+		// Spatial splits are only worth trying where the children of the best object split
+		// overlap significantly, and while the reference budget isn't used up.
+		SpatialSplit spatialSplit;
+		float overlap = objectSplit.axis >= 0 ? objectSplit.leftBounds.intersection(objectSplit.rightBounds).surfaceArea() : bounds.surfaceArea();
+		if (overlap > params_.spatialSplitAlpha * state.rootArea && duplicationBudget > 0) {
+			spatialSplit = findSpatialSplit(refs, bounds, *state.splitter);
+		}
+
+		float leafCost = params_.intersectionCost * count;
+		float splitCost = std::min(objectSplit.cost, spatialSplit.cost);
+		if (count <= params_.maxLeafSize && !(splitCost < leafCost)) {
+			return makeSpatialLeaf(state, bounds, refs);
+		}
+
+		std::vector<BVHPrimitive> leftRefs, rightRefs;
+		int splitAxis = spatialSplit.axis;
+		if (spatialSplit.cost < objectSplit.cost) {
+			leftRefs.reserve(spatialSplit.leftCount);
+			rightRefs.reserve(spatialSplit.rightCount);
+			partitionSpatial(refs, spatialSplit, *state.splitter, leftRefs, rightRefs);
+			// Clipping can leave nothing on one side, and splitting may go over budget. In
+			// either case, use the object split instead.
+			int added = static_cast<int>(leftRefs.size() + rightRefs.size()) - count;
+			if (leftRefs.empty() || rightRefs.empty() || added > duplicationBudget) {
+				leftRefs.clear();
+				rightRefs.clear();
+				if (count <= params_.maxLeafSize && !(objectSplit.cost < leafCost)) {
+					return makeSpatialLeaf(state, bounds, refs);
+				}
+			}
+			else {
+				duplicationBudget -= added;
+			}
+		}
+		if (leftRefs.empty()) {
+			int mid;
+			if (objectSplit.axis >= 0) {
+				splitAxis = objectSplit.axis;
+				mid = static_cast<int>(std::partition(refs.begin(), refs.end(), [&](const BVHPrimitive& p) {
+					return binIndex(p, objectSplit.axis, centroidBounds, objectSplit.nBins) < objectSplit.bin; }) - refs.begin());
+			}
+			else {
+				splitAxis = centroidBounds.longestAxis();
+				mid = count / 2;
+				std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+					[&](const BVHPrimitive& a, const BVHPrimitive& b) { return a.centroid[splitAxis] < b.centroid[splitAxis]; });
+			}
+			leftRefs.assign(refs.begin(), refs.begin() + mid);
+			rightRefs.assign(refs.begin() + mid, refs.end());
+		}
+		std::vector<BVHPrimitive>().swap(refs);
+
+		auto node = std::make_unique<BVHBuildNode>();
+		node->bounds = bounds;
+		node->splitAxis = splitAxis;
+
+		int leftBudget = static_cast<int>(static_cast<long long>(duplicationBudget) * leftRefs.size() / (leftRefs.size() + rightRefs.size()));
+		int rightBudget = duplicationBudget - leftBudget;
+		BVHBuildNode* nodePtr = node.get();
+		if (count >= PARALLEL_SUBTREE_THRESHOLD) {
+			#pragma omp task shared(state, leftRefs) firstprivate(nodePtr, leftBudget, depth)
+			nodePtr->children[0] = buildSpatialRecursive(state, std::move(leftRefs), leftBudget, depth + 1);
+			nodePtr->children[1] = buildSpatialRecursive(state, std::move(rightRefs), rightBudget, depth + 1);
+			#pragma omp taskwait
+		}
+		else {
+			nodePtr->children[0] = buildSpatialRecursive(state, std::move(leftRefs), leftBudget, depth + 1);
+			nodePtr->children[1] = buildSpatialRecursive(state, std::move(rightRefs), rightBudget, depth + 1);
+		}
+		return node;
+	}
+
+	/// <summary>
+	/// Copies the references of each SBVH leaf into one list, in depth-first order, and
+	/// points the leaves at their range of it.
+	/// </summary>
+	void gatherSpatialLeaves(BVHBuildNode& node, SpatialBuildState& state, std::vector<BVHPrimitive>& prims) const
+	{
+		if (node.isLeaf()) {
+			std::vector<BVHPrimitive>& refs = state.leafRefs[node.primOffset];
+			node.primOffset = static_cast<int>(prims.size());
+			prims.insert(prims.end(), refs.begin(), refs.end());
+			std::vector<BVHPrimitive>().swap(refs);
+			return;
+		}
+		gatherSpatialLeaves(*node.children[0], state, prims);
+		gatherSpatialLeaves(*node.children[1], state, prims);
+	}
+
+public:
+	BVHBuilder(const BVHBuildParams& params = BVHBuildParams())
+		:params_(params), lastBuildSeconds_(0.0)
+	{
+		params_.sahBinCount = std::min(std::max(params_.sahBinCount, 2), MAX_SAH_BINS);
+		params_.maxLeafSize = std::max(params_.maxLeafSize, 1);
+	}
+
+	/// <summary>
+	/// Build a BVH over the supplied primitives, using the method chosen in the build
+	/// parameters. The list is reordered so each leaf of the returned tree refers to a
+	/// contiguous range of it. SBVH builds can put a primitive in more than one leaf, so
+	/// the list may also grow; splitter is used to clip primitives for these builds.
+	/// The build time and size of the tree are reported on std::clog.
+	/// </summary>
+	std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitive>& prims, const BVHPrimitiveSplitter& splitter) const
+	{
+		auto startTime = std::chrono::steady_clock::now();
+
+		std::unique_ptr<BVHBuildNode> root;
+		size_t primCount = prims.size();
+		if (params_.method == BVHBuildMethod::LBVH) {
+			root = LBVHBuilder(params_).build(prims);
+		}
+		else if (params_.method == BVHBuildMethod::SBVH) {
+			SpatialBuildState state;
+			state.splitter = &splitter;
+			AABB rootBounds = AABB::empty();
+			for (const BVHPrimitive& prim : prims) rootBounds.expand(prim.bounds);
+			state.rootArea = rootBounds.surfaceArea();
+			int duplicationBudget = static_cast<int>(prims.size() * std::max(params_.maxSpatialSplitDuplication, 0.f));
+			#pragma omp parallel if(prims.size() >= PARALLEL_SUBTREE_THRESHOLD)
+			{
+				#pragma omp single
+				root = buildSpatialRecursive(state, std::move(prims), duplicationBudget, 0);
+			}
+			prims.clear();
+			gatherSpatialLeaves(*root, state, prims);
+		}
+		else {
+			std::vector<BVHPrimitive> scratch(prims.size() >= PARALLEL_NODE_THRESHOLD ? prims.size() : 0);
+			#pragma omp parallel if(prims.size() >= PARALLEL_SUBTREE_THRESHOLD)
+			{
+				#pragma omp single
+				root = buildRecursive(prims, scratch, 0, static_cast<int>(prims.size()), 0);
+			}
+		}
+
+		int threads = 1;
+#ifdef _OPENMP
+		threads = omp_get_max_threads();
+#endif
+		lastBuildSeconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		const char* methodNames[] = { "SAH", "SBVH", "LBVH" };
+		std::clog << "BVH build (" << methodNames[static_cast<int>(params_.method)] << "): "
+			<< primCount << " primitives";
+		if (prims.size() != primCount) std::clog << " (" << prims.size() << " references)";
+		std::clog << ", " << root->countNodes() << " nodes, "
+			<< lastBuildSeconds_ * 1e3 << " ms on up to " << threads << " thread(s)." << std::endl;
+		return root;
+	}
+
+	/// <summary>
+	/// As build(prims, splitter), but SBVH builds split primitives by their bounding boxes.
+	/// </summary>
+	std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitive>& prims) const
+	{
+		return build(prims, splitBounds);
+	}
+
+	/// <summary>
+	/// Duration of the most recent call to build(), in seconds.
+	/// </summary>
+	double lastBuildSeconds() const
+	{
+		return lastBuildSeconds_;
+	}
+};
+
+/// <summary>
+/// Makes one BVHPrimitive per triangle of the model, with bounds in world space
+/// (i.e. after applying modelToWorld). Each primitive's index is its face index.
+/// </summary>
+std::vector<BVHPrimitive> makeMeshBuildPrimitives(const Model& model, const Eigen::Matrix4f& modelToWorld)
+{
+	std::vector<BVHPrimitive> prims(model.nfaces());
+	#pragma omp parallel for
+	for (int f = 0; f < model.nfaces(); ++f) {
+		const VertexIndices* face = model.face(f);
+		BVHPrimitive& prim = prims[f];
+		prim.bounds = AABB::empty();
+		for (int v = 0; v < 3; ++v) {
+			prim.bounds.expand(transformPosition(modelToWorld, model.vert(face[v].vert)));
+		}
+		prim.centroid = prim.bounds.centre();
+		prim.index = f;
+	}
+	return prims;
+}
+
+/// <summary>
+/// Makes a splitter for SBVH builds over the primitives from makeMeshBuildPrimitives,
+/// which clips the triangles themselves rather than their bounding boxes.
+/// </summary>
+BVHPrimitiveSplitter makeMeshPrimitiveSplitter(const Model& model, const Eigen::Matrix4f& modelToWorld)
+{
+	auto worldVerts = std::make_shared<std::vector<Eigen::Vector3f>>(3 * model.nfaces());
+	#pragma omp parallel for
+	for (int f = 0; f < model.nfaces(); ++f) {
+		const VertexIndices* face = model.face(f);
+		for (int v = 0; v < 3; ++v) {
+			(*worldVerts)[3 * f + v] = transformPosition(modelToWorld, model.vert(face[v].vert));
+		}
+	}
+
+	return [worldVerts](int index, const AABB& bounds, int axis, float position, AABB& left, AABB& right) {
+		left = right = AABB::empty();
+		const Eigen::Vector3f* tri = &(*worldVerts)[3 * index];
+		for (int e = 0; e < 3; ++e) {
+			const Eigen::Vector3f& v0 = tri[e];
+			const Eigen::Vector3f& v1 = tri[(e + 1) % 3];
+			float p0 = v0[axis], p1 = v1[axis];
+			if (p0 <= position) left.expand(v0);
+			if (p0 >= position) right.expand(v0);
+			// Add the point where the edge crosses the plane to both sides.
+			if ((p0 < position && p1 > position) || (p0 > position && p1 < position)) {
+				Eigen::Vector3f crossing = v0 + (position - p0) / (p1 - p0) * (v1 - v0);
+				crossing[axis] = position;
+				left.expand(crossing);
+				right.expand(crossing);
+			}
+		}
+		left = left.intersection(bounds);
+		right = right.intersection(bounds);
+	};
+}
+
+void flattenBuildNode(const BVHBuildNode& node, std::vector<MeshFileBVHNode>& nodes)
+{
+	int index = (int)nodes.size();
+	nodes.emplace_back();
+	MeshFileBVHNode& flat = nodes[index];
+	for (int axis = 0; axis < 3; ++axis) {
+		flat.boundsMin[axis] = node.bounds.min[axis];
+		flat.boundsMax[axis] = node.bounds.max[axis];
+	}
+	flat.splitAxis = node.splitAxis;
+	flat.primOffset = node.primOffset;
+	flat.primCount = node.primCount;
+	flat.secondChild = -1;
+	if (node.isLeaf()) return;
+	flattenBuildNode(*node.children[0], nodes);
+	int secondChild = (int)nodes.size();
+	nodes[index].secondChild = secondChild;
+	flattenBuildNode(*node.children[1], nodes);
+}
+
+/// <summary>
+/// Flattens a BVH built over the primitives from makeMeshBuildPrimitives, so it can be
+/// stored with the model (see Model::save). prims is the primitive list as reordered by the
+/// build, and is stored as the list of face indices the leaves refer to.
+/// </summary>
+void flattenBuildTree(const BVHBuildNode& root, const std::vector<BVHPrimitive>& prims,
+	std::vector<MeshFileBVHNode>& nodes, std::vector<int32_t>& primitives)
+{
+	nodes.clear();
+	nodes.reserve(root.countNodes());
+	flattenBuildNode(root, nodes);
+	primitives.resize(prims.size());
+	for (size_t p = 0; p < prims.size(); ++p) primitives[p] = prims[p].index;
+}
+
+std::unique_ptr<BVHBuildNode> loadBuildNode(const MeshFileBVHNode* nodes, int nNodes, int nPrims, int index, int depth)
+{
+	const MeshFileBVHNode& flat = nodes[index];
+	auto node = std::make_unique<BVHBuildNode>();
+	node->bounds.min = Eigen::Vector3f(flat.boundsMin[0], flat.boundsMin[1], flat.boundsMin[2]);
+	node->bounds.max = Eigen::Vector3f(flat.boundsMax[0], flat.boundsMax[1], flat.boundsMax[2]);
+	node->splitAxis = flat.splitAxis;
+	if (flat.secondChild < 0) {
+		if (flat.primOffset < 0 || flat.primCount < 0 || flat.primOffset > nPrims - flat.primCount) {
+			throw std::runtime_error("Mesh file BVH refers to primitives that don't exist!");
+		}
+		node->primOffset = flat.primOffset;
+		node->primCount = flat.primCount;
+		return node;
+	}
+	// Children always follow their parent, which also rules out cycles.
+	if (flat.secondChild <= index + 1 || flat.secondChild >= nNodes || depth >= 256) {
+		throw std::runtime_error("Mesh file BVH is corrupt!");
+	}
+	node->children[0] = loadBuildNode(nodes, nNodes, nPrims, index + 1, depth + 1);
+	node->children[1] = loadBuildNode(nodes, nNodes, nPrims, flat.secondChild, depth + 1);
+	return node;
+}
+
+/// <summary>
+/// Recomputes the bounds of the nodes of a build tree from the bounds of the primitives
+/// their leaves refer to.
+/// </summary>
+void refitBuildTree(BVHBuildNode& node, const std::vector<BVHPrimitive>& prims)
+{
+	node.bounds = AABB::empty();
+	if (node.isLeaf()) {
+		for (int i = node.primOffset; i < node.primOffset + node.primCount; ++i) node.bounds.expand(prims[i].bounds);
+		return;
+	}
+	for (int c = 0; c < 2; ++c) {
+		refitBuildTree(*node.children[c], prims);
+		node.bounds.expand(node.children[c]->bounds);
+	}
+}
+
+/// <summary>
+/// Loads the BVH stored with a model (see Model::hasBVH) as a build tree. Only the
+/// structure of the stored tree is used: prims is set to the primitives its leaves refer
+/// to, with world space bounds as from makeMeshBuildPrimitives, and the bounds of the nodes
+/// are recomputed from these.
+/// </summary>
+std::unique_ptr<BVHBuildNode> loadModelBuildTree(const Model& model, const Eigen::Matrix4f& modelToWorld,
+	std::vector<BVHPrimitive>& prims)
+{
+	if (!model.hasBVH()) throw std::runtime_error("Model has no stored BVH!");
+	const int32_t* indices = model.bvhPrimitives();
+	int nPrims = model.nbvhPrimitives();
+	for (int p = 0; p < nPrims; ++p) {
+		if (indices[p] < 0 || indices[p] >= model.nfaces()) throw std::runtime_error("Mesh file BVH refers to faces that don't exist!");
+	}
+	std::unique_ptr<BVHBuildNode> root = loadBuildNode(model.bvhNodes(), model.nbvhNodes(), nPrims, 0, 0);
+
+	std::vector<BVHPrimitive> meshPrims = makeMeshBuildPrimitives(model, modelToWorld);
+	prims.resize(nPrims);
+	#pragma omp parallel for
+	for (int p = 0; p < nPrims; ++p) {
+		prims[p] = meshPrims[indices[p]];
+	}
+	refitBuildTree(*root, prims);
+	return root;
+}
+
+/// <summary>
+/// Makes one BVHPrimitive per Renderable, using its (world space) AABB.
+/// Each primitive's index is its position in the renderables list.
+/// Note unbounded Renderables (e.g. Plane) can't be added to a BVH.
+/// </summary>
+std::vector<BVHPrimitive> makeRenderableBuildPrimitives(const std::vector<std::shared_ptr<Renderable>>& renderables)
+{
+	std::vector<BVHPrimitive> prims(renderables.size());
+	for (int r = 0; r < static_cast<int>(renderables.size()); ++r) {
+		prims[r].bounds = renderables[r]->getAABB();
+		prims[r].centroid = prims[r].bounds.centre();
+		prims[r].index = r;
+	}
+	return prims;
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include "LinearBVH.hpp"
+#include "WideBVH.hpp"
+#include <stdexcept>
+#include <string>
+
+/// <summary>
+/// The hierarchy used to traverse a flat BVH: either a binary LinearBVH, or a 4- or
+/// 8-wide WideBVH, chosen by BVHBuildParams::branchingFactor. Wide BVHs can also use
+/// compressed nodes (BVHBuildParams::compressNodes). All of these are made from the same
+/// build tree and leave the primitive ranges of the leaves unchanged, so users of the
+/// class (LinearMeshBVH, LinearRenderableBVH etc.) don't need to know which one is used.
+/// </summary>
+class BVHHierarchy
+{
+private:
+	enum class Layout
+	{
+		Binary,
+		Wide4,
+		Wide8,
+		Compressed4,
+		Compressed8
+	};
+
+	Layout layout_;
+	LinearBVH binary_;
+	WideBVH<4> wide4_;
+	WideBVH<8> wide8_;
+	WideBVH<4, true> compressed4_;
+	WideBVH<8, true> compressed8_;
+
+public:
+	BVHHierarchy()
+		:layout_(Layout::Binary)
+	{}
+
+	BVHHierarchy(const BVHBuildNode& root, int branchingFactor, bool compressNodes = false)
+	{
+		if (compressNodes && branchingFactor == 2) {
+			throw std::runtime_error("Compressed BVH nodes need a branching factor of 4 or 8.");
+		}
+		switch (branchingFactor) {
+		case 2:
+			layout_ = Layout::Binary;
+			binary_ = LinearBVH(root);
+			break;
+		case 4:
+			layout_ = compressNodes ? Layout::Compressed4 : Layout::Wide4;
+			if (compressNodes) compressed4_ = WideBVH<4, true>(root);
+			else wide4_ = WideBVH<4>(root);
+			break;
+		case 8:
+			layout_ = compressNodes ? Layout::Compressed8 : Layout::Wide8;
+			if (compressNodes) compressed8_ = WideBVH<8, true>(root);
+			else wide8_ = WideBVH<8>(root);
+			break;
+		default:
+			throw std::runtime_error("BVH branching factor must be 2, 4 or 8.");
+		}
+	}
+
+	/// <summary>
+	/// Makes the hierarchy chosen by params (branching factor and node compression).
+	/// </summary>
+	BVHHierarchy(const BVHBuildNode& root, const BVHBuildParams& params)
+		:BVHHierarchy(root, params.branchingFactor, params.compressNodes)
+	{}
+
+	int branchingFactor() const
+	{
+		switch (layout_) {
+		case Layout::Wide4: case Layout::Compressed4: return 4;
+		case Layout::Wide8: case Layout::Compressed8: return 8;
+		default: return 2;
+		}
+	}
+
+	bool compressed() const
+	{
+		return layout_ == Layout::Compressed4 || layout_ == Layout::Compressed8;
+	}
+
+	size_t nodeCount() const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.nodes().size();
+		case Layout::Wide8: return wide8_.nodes().size();
+		case Layout::Compressed4: return compressed4_.nodes().size();
+		case Layout::Compressed8: return compressed8_.nodes().size();
+		default: return binary_.nodes().size();
+		}
+	}
+
+	/// <summary>
+	/// Memory used by the nodes, in bytes.
+	/// </summary>
+	size_t nodeBytes() const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.nodes().size() * sizeof(WideBVH<4>::Node);
+		case Layout::Wide8: return wide8_.nodes().size() * sizeof(WideBVH<8>::Node);
+		case Layout::Compressed4: return compressed4_.nodes().size() * sizeof(WideBVH<4, true>::Node);
+		case Layout::Compressed8: return compressed8_.nodes().size() * sizeof(WideBVH<8, true>::Node);
+		default: return binary_.nodes().size() * sizeof(LinearBVHNode);
+		}
+	}
+
+	AABB getAABB() const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.getAABB();
+		case Layout::Wide8: return wide8_.getAABB();
+		case Layout::Compressed4: return compressed4_.getAABB();
+		case Layout::Compressed8: return compressed8_.getAABB();
+		default: return binary_.getAABB();
+		}
+	}
+
+	/// <summary>
+	/// Recomputes the bounds of all nodes after the primitives have moved. See LinearBVH::refit.
+	/// </summary>
+	template <typename LeafBounds>
+	void refit(LeafBounds&& leafBounds)
+	{
+		switch (layout_) {
+		case Layout::Wide4: wide4_.refit(leafBounds); break;
+		case Layout::Wide8: wide8_.refit(leafBounds); break;
+		case Layout::Compressed4: compressed4_.refit(leafBounds); break;
+		case Layout::Compressed8: compressed8_.refit(leafBounds); break;
+		default: binary_.refit(leafBounds); break;
+		}
+	}
+
+	/// <summary>
+	/// Estimated cost of tracing a ray through the hierarchy with the Surface Area Heuristic.
+	/// </summary>
+	float sahCost(const BVHBuildParams& params) const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.sahCost(params.traversalCost, params.intersectionCost);
+		case Layout::Wide8: return wide8_.sahCost(params.traversalCost, params.intersectionCost);
+		case Layout::Compressed4: return compressed4_.sahCost(params.traversalCost, params.intersectionCost);
+		case Layout::Compressed8: return compressed8_.sahCost(params.traversalCost, params.intersectionCost);
+		default: return binary_.sahCost(params.traversalCost, params.intersectionCost);
+		}
+	}
+
+	/// <summary>
+	/// Finds the closest hit along the ray. See LinearBVH::intersect for a description
+	/// of intersectLeaf.
+	/// </summary>
+	template <typename LeafIntersector>
+	bool intersect(const Ray& ray, float minT, float maxT, LeafIntersector&& intersectLeaf) const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.intersect(ray, minT, maxT, intersectLeaf);
+		case Layout::Wide8: return wide8_.intersect(ray, minT, maxT, intersectLeaf);
+		case Layout::Compressed4: return compressed4_.intersect(ray, minT, maxT, intersectLeaf);
+		case Layout::Compressed8: return compressed8_.intersect(ray, minT, maxT, intersectLeaf);
+		default: return binary_.intersect(ray, minT, maxT, intersectLeaf);
+		}
+	}
+
+	/// <summary>
+	/// Checks whether anything blocks the ray. See LinearBVH::occluded.
+	/// </summary>
+	template <typename LeafOccluder>
+	bool occluded(const Ray& ray, float minT, float maxT, LeafOccluder&& occludedLeaf) const
+	{
+		switch (layout_) {
+		case Layout::Wide4: return wide4_.occluded(ray, minT, maxT, occludedLeaf);
+		case Layout::Wide8: return wide8_.occluded(ray, minT, maxT, occludedLeaf);
+		case Layout::Compressed4: return compressed4_.occluded(ray, minT, maxT, occludedLeaf);
+		case Layout::Compressed8: return compressed8_.occluded(ray, minT, maxT, occludedLeaf);
+		default: return binary_.occluded(ray, minT, maxT, occludedLeaf);
+		}
+	}
+};
@@ -21,11 +21,9 @@ public:
 		return aabb_;
 	}
 
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
 	{
-		Ray tRay;
-		tRay.origin = transformPosition(worldToModel(), ray.origin);
-		tRay.direction = transformDirection(worldToModel(), ray.direction);
+		Ray tRay = rayToModel(ray);
 
 		// If we don't hit the AABB associated with this node at all, exit early!
 		if (!aabb_.intersect(tRay, minT, maxT)) return false;
@@ -33,22 +31,31 @@ public:
 		// We did hit the AABB, so now we test the children.
 		bool hitSomething = false; // Keep track of whether a hit occurred.
 
-		// Try intersecting all renderables.
-		float t = std::numeric_limits<float>::max();
+		// Try intersecting all renderables. After each hit, only closer hits are of
+		// interest, so maxT is reduced to the hit distance.
 		for (const auto& object : renderables_) {
-			HitInfo currInfo;
-			if (object->intersect(tRay, minT, maxT, currInfo, mask)) {
-				if (currInfo.hitT < t) {
-					info = currInfo;
-					t = currInfo.hitT;
-					hitSomething = true;
-				}
+			if (object->closestHit(tRay, minT, maxT, info, mask)) {
+				maxT = info.hitT;
+				hitSomething = true;
 			}
 		}
 
+		if (hitSomething) hitToWorld(ray, tRay, info);
 		return hitSomething;
 	}
 
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		Ray tRay = rayToModel(ray);
+
+		if (!aabb_.intersect(tRay, minT, maxT)) return false;
+
+		for (const auto& object : renderables_) {
+			if (object->occluded(tRay, minT, maxT, mask)) return true;
+		}
+		return false;
+	}
+
 	virtual std::string print() const override
 	{
 		std::stringstream ss;
@@ -3,202 +3,180 @@
 #include "GeomUtil.hpp"
 #include "Mesh.hpp"
 #include "BVHLeafNode.hpp"
+#include "BVHBuilder.hpp"
 #include <vector>
+#include <functional>
 
 
 /// <summary>
 /// This is a single node of a Bounding Volume Hierarchy.
-/// In this library BVHs are binary trees (each can have at most 2 children.
+/// In this library BVHs are binary trees (each can have at most 2 children).
 /// They can be constructed from either a list of renderables or a mesh
 /// (provided as a Model instance).
-/// Each node splits along a single axis (x, y or z).
+/// Each node splits along a single axis (x, y or z). Rays visit the child nearer to
+/// them along that axis first, so a hit there can rule out the other child.
 /// </summary>
 class BVHNode : public Renderable
 {
 private:
 	AABB aabb_;
 	int nodeDepth_;
+	int splitAxis_; // child0_ is on the low side of this axis, child1_ on the high side.
 	std::shared_ptr<Renderable> child0_, child1_;
 public:
 
+	/// <summary>
+	/// Function making the Renderable stored at a leaf of the BVH, given the leaf node
+	/// of the build tree.
+	/// </summary>
+	typedef std::function<std::shared_ptr<Renderable>(const BVHBuildNode&)> LeafFactory;
+
 	/// <summary>
 	/// Constructs a BVH from a list of Renderable instances.
+	/// The tree is built with the binned Surface Area Heuristic (see BVHBuilder), and
+	/// each leaf is a BVHLeafNode holding the renderables that fall in it.
 	/// </summary>
 	/// <param name="renderables">The instances to add to the BVH.</param>
-	/// <param name="maxDepth">The maximum depth of the binary tree.</param>
-	BVHNode(const std::vector<std::shared_ptr<Renderable>>& renderables, int maxDepth)
-		:Renderable(nullptr), nodeDepth_(maxDepth)
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size).</param>
+	BVHNode(const std::vector<std::shared_ptr<Renderable>>& renderables, const BVHBuildParams& params)
+		:Renderable(nullptr), nodeDepth_(0), splitAxis_(0)
 	{
-		// *** YOUR CODE HERE ***
-
-		// 1. Find an AABB surrounding all the renderables, and update the aabb_ member.
-		//    Implement this in the getRenderablesAABB() function, at the end of GeomUtil.hpp.
-		// 2. Choose an axis to split your AABB along (x, y or z).
-		// 3. Make lists of the renderables that fall on either side of the split.
-		// 4. For child0_ and child1_, check if we should terminate:
-		//     a. If we reach the max depth (i.e. maxDepth == 0)
-		//     b. If there are two or fewer Renderables left in the list for this child.
-		// 5. If we should terminate, make a new BVHLeafNode and supply the renderables
-		//    in this list.
-		// 6. If we should not terminate, make a new BVHNode and call this constructor again
-		//    recursively. Don't forget to subtract one from maxDepth!
+		std::vector<BVHPrimitive> prims = makeRenderableBuildPrimitives(renderables);
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params).build(prims);
+
+		initFromBuildNode(*root, [&](const BVHBuildNode& leaf) {
+			std::vector<std::shared_ptr<Renderable>> leafRenderables;
+			leafRenderables.reserve(leaf.primCount);
+			for (int i = leaf.primOffset; i < leaf.primOffset + leaf.primCount; ++i) {
+				leafRenderables.push_back(renderables[prims[i].index]);
+			}
+			return std::make_shared<BVHLeafNode>(leafRenderables);
+		});
 	}
 
 	/// <summary>
 	/// This constructor forms a BVH tree from a provided triangle mesh.
-	/// At the leaf nodes this uses PartialMesh instances to store the triangle indices
+	/// The tree is built with the binned Surface Area Heuristic (see BVHBuilder), which
+	/// also decides automatically when to stop splitting.
+	/// At the leaf nodes this uses Mesh instances to store the triangle indices
 	/// at each node.
 	/// Note for BVH accelerated meshes, the modelToWorld transform must be set in this 
 	/// constructor.
 	/// Internally the BVH is constructed in world space. Vertices are transformed
 	/// using the modelToWorld before being used to find AABBs etc.
+	/// If the model has a stored BVH (see Model::hasBVH), its tree is used instead of
+	/// building a new one.
 	/// </summary>
 	/// <param name="model">The loaded model instance to construct the mesh BVH from.</param>
 	/// <param name="shader">The shader to use when intersecting the mesh.</param>
-	/// <param name="maxDepth">Maximum depth of the BVH binary tree.</param>
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size).</param>
 	/// <param name="modelToWorld">Transform taking the mesh to world space.</param>
-	/// <param name="faceIndices">Indices of faces of the mesh. If none are supplied (i.e. this is 
-	/// set to nullptr), all faces in the model instance will be used.</param>
 	/// <param name="culling">Turn on/off backface culling (same parameter as in the Mesh class).</param>
-	BVHNode(const Model& model, const Shader* shader, int maxDepth, const Eigen::Matrix4f &modelToWorld,
-		const std::vector<std::vector<VertexIndices>>* faceIndices = nullptr, bool culling=true)
-		:Renderable(nullptr)
+	BVHNode(const Model& model, const Shader* shader, const BVHBuildParams& params, const Eigen::Matrix4f &modelToWorld,
+		bool culling=true)
+		:Renderable(nullptr), nodeDepth_(0), splitAxis_(0)
 	{
-		std::vector<std::vector<VertexIndices>> myFaceIndices;
-		if(faceIndices) 
-			getModelAABB(model, *faceIndices, modelToWorld);
-		else {
-			for (int f = 0; f < model.nfaces(); ++f) {
-				std::vector<VertexIndices> face;
-				for (int v = 0; v < 3; ++v) {
-					face.push_back(model.face(f)[v]);
-				}
-				myFaceIndices.push_back(face);
-			}
-			getModelAABB(model, myFaceIndices, modelToWorld);
-			faceIndices = &myFaceIndices;
-		}
-
-		int splittingAxis = findBestSplittingAxis();
-		float splittingLoc = aabb_.centre()[splittingAxis];
-
-		std::vector<std::vector<VertexIndices>> faces0, faces1;
-
-		for (int f = 0; f < faceIndices->size(); ++f) {
-			Eigen::Vector3f
-				v0 = model.vert((*faceIndices)[f][0].vert),
-				v1 = model.vert((*faceIndices)[f][1].vert),
-				v2 = model.vert((*faceIndices)[f][2].vert);
-			Eigen::Vector3f pos = transformPosition(modelToWorld, (v0 + v1 + v2) / 3.f);
-			if (pos[splittingAxis] < splittingLoc) {
-				faces0.push_back((*faceIndices)[f]);
-			}
-			else {
-				faces1.push_back((*faceIndices)[f]);
-			}
-		}
-
-		if (faces0.size() <= 1 || maxDepth <= 0) {
-			if (faces0.size() > 0) {
-				child0_ = std::make_shared<Mesh>(shader, &model, &faces0, culling);
-				child0_->modelToWorld(modelToWorld);
-			}
+		std::vector<BVHPrimitive> prims;
+		std::unique_ptr<BVHBuildNode> root;
+		if (model.hasBVH()) {
+			root = loadModelBuildTree(model, modelToWorld, prims);
 		}
 		else {
-			child0_ = std::make_shared<BVHNode>(model, shader, maxDepth-1, modelToWorld, &faces0, culling);
+			prims = makeMeshBuildPrimitives(model, modelToWorld);
+			root = BVHBuilder(params).build(prims, makeMeshPrimitiveSplitter(model, modelToWorld));
 		}
-		if (faces1.size() <= 1 || maxDepth <= 0) {
-			if (faces1.size() > 0) {
-				child1_ = std::make_shared<Mesh>(shader, &model, &faces1, culling);
-				child1_->modelToWorld(modelToWorld);
+
+		initFromBuildNode(*root, [&](const BVHBuildNode& leaf) {
+			std::vector<VertexIndices> triangles;
+			triangles.reserve(3 * leaf.primCount);
+			for (int i = leaf.primOffset; i < leaf.primOffset + leaf.primCount; ++i) {
+				const VertexIndices* face = model.face(prims[i].index);
+				triangles.insert(triangles.end(), face, face + 3);
 			}
-		}
-		else {
-			child1_ = std::make_shared<BVHNode>(model, shader, maxDepth-1, modelToWorld, &faces1, culling);
-		}
+			std::shared_ptr<Renderable> mesh = std::make_shared<Mesh>(shader, &model, &triangles, culling);
+			mesh->modelToWorld(modelToWorld);
+			return mesh;
+		});
 	}
 
-
-	/// <summary>
-	/// Finds the best axis to split the BVH along.
-	/// This implementation selects the longest axis of the AABB.
-	/// </summary>
-	int findBestSplittingAxis() const
+private:
+	BVHNode(const BVHBuildNode& node, const LeafFactory& makeLeaf, int depth)
+		:Renderable(nullptr), nodeDepth_(depth), splitAxis_(0)
 	{
-		int maxExtentAxis = 0;
-		float maxExtent = 0.0f;
-		for (int axis = 0; axis < 3; ++axis) {
-			float extent = aabb_.max[axis] - aabb_.min[axis];
-			if (extent > maxExtent) {
-				maxExtent = extent;
-				maxExtentAxis = axis;
-			}
-		}
-
-		return maxExtentAxis;
+		initFromBuildNode(node, makeLeaf);
 	}
 
 	/// <summary>
-	/// Gets an AABB for a triangle mesh, after applying the given modelToWorld transform
-	/// That is, the AABB will be in world space.
+	/// Sets up this node (and recursively its children) to match a node of the tree
+	/// produced by BVHBuilder. Leaves of the build tree are turned into Renderables
+	/// by the supplied makeLeaf function.
 	/// </summary>
-	void getModelAABB(
-		const Model& model, const std::vector<std::vector<VertexIndices>>& faceIndices, 
-		const Eigen::Matrix4f& modelToWorld)
+	void initFromBuildNode(const BVHBuildNode& node, const LeafFactory& makeLeaf)
 	{
-		for (int i = 0; i < 3; ++i) {
-			aabb_.min[i] = std::numeric_limits<float>::max();
-			aabb_.max[i] = std::numeric_limits<float>::min();
+		aabb_ = node.bounds;
+		splitAxis_ = node.splitAxis;
+
+		if (node.isLeaf()) {
+			// Everything fits in a single leaf.
+			child0_ = makeLeaf(node);
+			return;
 		}
-		for (int f = 0; f < faceIndices.size(); ++f) {
-			for (int v = 0; v < 3; ++v) {
-				Eigen::Vector3f v0 = model.vert(faceIndices[f][v].vert);
-				v0 = transformPosition(modelToWorld, v0);
-				for (int i = 0; i < 3; ++i) {
-					if (v0[i] < aabb_.min[i]) aabb_.min[i] = v0[i];
-					if (v0[i] > aabb_.max[i]) aabb_.max[i] = v0[i];
-				}
-			}
+
+		for (int c = 0; c < 2; ++c) {
+			const BVHBuildNode& child = *node.children[c];
+			std::shared_ptr<Renderable> renderable;
+			if (child.isLeaf())
+				renderable = makeLeaf(child);
+			else
+				renderable = std::shared_ptr<BVHNode>(new BVHNode(child, makeLeaf, nodeDepth_ + 1));
+			(c == 0 ? child0_ : child1_) = renderable;
 		}
 	}
 
+public:
 	virtual AABB getAABB() const override
 	{
 		return aabb_;
 	}
 
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
 	{
-		Ray tRay;
-		tRay.origin = transformPosition(worldToModel(), ray.origin);
-		tRay.direction = transformDirection(worldToModel(), ray.direction);
+		Ray tRay = rayToModel(ray);
 
 		// If we don't hit the AABB associated with this node at all, exit early!
 		if (!aabb_.intersect(tRay, minT, maxT)) return false;
 
-		// We did hit the AABB, so now we test the children.
+		// We did hit the AABB, so now we test the children, nearest first. Once something
+		// is hit, only closer hits are of interest, so maxT is reduced to the hit distance.
 		bool hitSomething = false; // Keep track of whether a hit occurred.
 
-		float t = std::numeric_limits<float>::max();
-		HitInfo currInfo;
-		if (child0_ && child0_->intersect(tRay, minT, maxT, currInfo, mask)) {
-			if (currInfo.hitT < t) {
-				info = currInfo;
-				t = currInfo.hitT;
-				hitSomething = true;
-			}
+		const Renderable* near = child0_.get();
+		const Renderable* far = child1_.get();
+		if (tRay.direction[splitAxis_] < 0) std::swap(near, far);
+
+		if (near && near->closestHit(tRay, minT, maxT, info, mask)) {
+			maxT = info.hitT;
+			hitSomething = true;
 		}
-		if (child1_ && child1_->intersect(tRay, minT, maxT, currInfo, mask)) {
-			if (currInfo.hitT < t) {
-				info = currInfo;
-				t = currInfo.hitT;
-				hitSomething = true;
-			}
+		if (far && far->closestHit(tRay, minT, maxT, info, mask)) {
+			hitSomething = true;
 		}
 
+		if (hitSomething) hitToWorld(ray, tRay, info);
 		return hitSomething;
 	}
 
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		Ray tRay = rayToModel(ray);
+
+		if (!aabb_.intersect(tRay, minT, maxT)) return false;
+
+		// Any hit will do, so there's no need to order the children.
+		return (child0_ && child0_->occluded(tRay, minT, maxT, mask)) ||
+			(child1_ && child1_->occluded(tRay, minT, maxT, mask));
+	}
+
 	/// <summary>
 	/// Prints a summary of the entries in this BVH and its children.
 	/// The list is indented to reflect the depth of each node in the tree.
@@ -206,16 +184,16 @@ public:
 	virtual std::string print() const override
 	{
 		std::stringstream indentStr;
-		for (int i = 0; i < 10 - nodeDepth_; ++i) {
+		for (int i = 0; i < nodeDepth_; ++i) {
 			indentStr << " ";
 		}
 		std::string indent = indentStr.str();
 		std::stringstream ss;
 		ss << indent << "BVH Node depth " << nodeDepth_ << " from\n" << aabb_.min << "to\n" << aabb_.max << "\n"
 			<< indent << "Children0:\n";
-		ss << indent << child0_->print() << "\n";
+		if (child0_) ss << indent << child0_->print() << "\n";
 		ss << indent << "Children1:\n";
-		ss << indent << child1_->print() << "\n";
+		if (child1_) ss << indent << child1_->print() << "\n";
 		return ss.str();
 	}
 
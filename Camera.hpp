@@ -10,6 +10,7 @@ class Camera
 {
 private:
 	Eigen::Vector3f location_, bottomLeftPix_, right1pix_, up1pix_;
+	float pixelAngle_; // Angle covered by one pixel, near the centre of the image.
 
 public:
 	Camera(
@@ -33,6 +34,7 @@ public:
 
 		right1pix_ = rightVec * halfWidth * 2.f / static_cast<float>(pixWidth);
 		up1pix_ = upVec * halfHeight * 2.f / static_cast<float>(pixHeight);
+		pixelAngle_ = up1pix_.norm(); // The image plane is one unit in front of the camera
 	}
 
 	Ray getRay(int pixX, int pixY)
@@ -44,6 +46,8 @@ public:
 			static_cast<float>(pixY) * up1pix_;
 
 		ray.direction = (pixelPos - location_).normalized();
+		ray.coneWidth = 0.f;
+		ray.coneSpread = pixelAngle_;
 		return ray;
 	}
 };
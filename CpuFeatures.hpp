@@ -0,0 +1,63 @@
+#pragma once
+
+// SIMD code paths are only compiled on x86-64, where SSE and SSE2 are always available, so
+// the 4-wide paths can be used without checking the CPU first. Elsewhere (including 32-bit
+// x86, which doesn't guarantee SSE) the scalar fallbacks are used.
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAS_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Functions using instructions beyond the baseline the compiler targets must be marked
+// with these, so they can be compiled into the same binary and chosen at runtime.
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET_AVX __attribute__((target("avx")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SIMD_TARGET_AVX
+#define SIMD_TARGET_AVX2
+#endif
+
+/// <summary>
+/// Instruction set extensions supported by the CPU we're running on, detected once at
+/// startup. SIMD code uses this to pick the widest code path available at runtime, so
+/// the same binary runs (more slowly) on machines without e.g. AVX.
+/// </summary>
+struct CpuFeatures
+{
+	bool sse41 = false, avx = false, avx2 = false;
+
+	static const CpuFeatures& get()
+	{
+		static const CpuFeatures features = detect();
+		return features;
+	}
+
+private:
+	static CpuFeatures detect()
+	{
+		CpuFeatures features;
+#if defined(HAS_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_cpu_init();
+		features.sse41 = __builtin_cpu_supports("sse4.1");
+		features.avx = __builtin_cpu_supports("avx");
+		features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(HAS_X86_SIMD) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool osSavesAVX = (info[2] & (1 << 27)) && ((_xgetbv(0) & 0x6) == 0x6);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		features.sse41 = (info[2] & (1 << 19)) != 0;
+		features.avx = osSavesAVX && (info[2] & (1 << 28));
+		__cpuid(info, 0);
+		if (info[0] >= 7) {
+			__cpuidex(info, 7, 0);
+			features.avx2 = features.avx && fma && (info[1] & (1 << 5));
+		}
+#endif
+		return features;
+	}
+};
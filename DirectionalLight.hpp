@@ -16,8 +16,7 @@ public:
 		Ray shadowRay;
 		shadowRay.origin = location;
 		shadowRay.direction = -direction_;
-		HitInfo info;
-		return !renderable->intersect(shadowRay, 1e-4f, 1e4f, info, SHADOW_BITMASK);
+		return !renderable->occluded(shadowRay, 1e-4f, 1e4f, SHADOW_BITMASK);
 	}
 
 	virtual Eigen::Vector3f getIntensity(const Eigen::Vector3f& location) const override
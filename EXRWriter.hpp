@@ -0,0 +1,122 @@
+#pragma once
+#include "ImageWriter.hpp"
+#include <string>
+
+/// <summary>
+/// Writes images as uncompressed OpenEXR files with 32-bit float R, G and B channels.
+/// Values are stored without any clamping. Rows are stored from the top down.
+/// </summary>
+class EXRWriter : public ImageWriter
+{
+private:
+	std::vector<unsigned char> band_;
+	std::vector<float> planar_;
+
+	size_t blockBytes() const
+	{
+		return 8 + 12 * size_t(width_);
+	}
+
+	static void appendAttribute(std::vector<unsigned char>& header, const char* name, const char* type,
+		const std::vector<unsigned char>& value)
+	{
+		append(header, name);
+		header.push_back(0);
+		append(header, type);
+		header.push_back(0);
+		appendLE<int32_t>(header, (int32_t)value.size());
+		header.insert(header.end(), value.begin(), value.end());
+	}
+
+	/// <summary>
+	/// Builds the header of the file, up to the line offset table.
+	/// </summary>
+	static std::vector<unsigned char> makeHeader(int width, int height)
+	{
+		std::vector<unsigned char> header, value;
+		appendLE<uint32_t>(header, 20000630); // Magic number
+		appendLE<uint32_t>(header, 2); // Version 2, single part scanline image
+
+		for (const char* channel : { "B", "G", "R" }) { // Channels must be in alphabetical order
+			append(value, channel);
+			value.push_back(0);
+			appendLE<int32_t>(value, 2); // FLOAT
+			value.insert(value.end(), 4, 0); // Not perceptually linear, reserved bytes
+			appendLE<int32_t>(value, 1); // x sampling
+			appendLE<int32_t>(value, 1); // y sampling
+		}
+		value.push_back(0);
+		appendAttribute(header, "channels", "chlist", value);
+
+		appendAttribute(header, "compression", "compression", { 0 }); // NO_COMPRESSION
+
+		value.clear();
+		appendLE<int32_t>(value, 0);
+		appendLE<int32_t>(value, 0);
+		appendLE<int32_t>(value, width - 1);
+		appendLE<int32_t>(value, height - 1);
+		appendAttribute(header, "dataWindow", "box2i", value);
+		appendAttribute(header, "displayWindow", "box2i", value);
+
+		appendAttribute(header, "lineOrder", "lineOrder", { 0 }); // INCREASING_Y
+
+		value.clear();
+		appendLE(value, 1.f);
+		appendAttribute(header, "pixelAspectRatio", "float", value);
+		appendAttribute(header, "screenWindowWidth", "float", value);
+
+		value.clear();
+		appendLE(value, 0.f);
+		appendLE(value, 0.f);
+		appendAttribute(header, "screenWindowCenter", "v2f", value);
+
+		header.push_back(0); // End of header
+		return header;
+	}
+
+public:
+	virtual bool topDown() const override
+	{
+		return true;
+	}
+
+protected:
+	virtual void writeHeader() override
+	{
+		std::vector<unsigned char> header = makeHeader(width_, height_);
+		writeBuffer(header);
+
+		// Without compression, every row is stored in its own block of the same size, so
+		// the offset table can be written before any of them.
+		std::vector<unsigned char> offsets;
+		uint64_t offset = header.size() + 8 * size_t(height_);
+		for (int y = 0; y < height_; ++y, offset += blockBytes()) appendLE<uint64_t>(offsets, offset);
+		writeBuffer(offsets);
+
+		band_.resize(ROWS_PER_BAND * blockBytes());
+		planar_.resize(ROWS_PER_BAND * 3 * size_t(width_));
+	}
+
+	virtual void writeBand(const Framebuffer& rows, int fileRow, int count) override
+	{
+		size_t dataBytes = 12 * size_t(width_);
+		#pragma omp parallel for
+		for (int r = 0; r < count; ++r) {
+			int y = fileRow + r; // EXR row, counting from the top
+			const float* in = rows.row(imageRow(y));
+			float* channels = &planar_[r * 3 * size_t(width_)];
+			for (int x = 0; x < width_; ++x) {
+				channels[x] = in[3 * x + 2];
+				channels[width_ + x] = in[3 * x + 1];
+				channels[2 * width_ + x] = in[3 * x];
+			}
+			unsigned char* block = &band_[r * blockBytes()];
+			for (int b = 0; b < 4; ++b) { // Row number and size of the data, as little-endian int32
+				block[b] = static_cast<unsigned char>(uint32_t(y) >> (8 * b));
+				block[4 + b] = static_cast<unsigned char>(uint32_t(dataBytes) >> (8 * b));
+			}
+			copyFloatsLE(channels, 3 * width_, block + 8);
+		}
+		writeBuffer(band_, count * blockBytes());
+	}
+};
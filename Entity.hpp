@@ -1,36 +1,120 @@
 #pragma once
 #include <Eigen/Dense>
+#include "Ray.hpp"
 
 /// <summary>
 /// An Entity is any object in the world with a 6DoF transform
 /// encoded as a 4x4 modelToWorld matrix.
+/// The inverse and normal matrices are cached, and only recomputed when the transform
+/// is set, so the transform functions below are cheap enough to use per ray.
 /// </summary>
 class Entity
 {
 private:
-	Eigen::Matrix4f modelToWorld_;
+	Eigen::Matrix4f modelToWorld_, worldToModel_;
+	Eigen::Matrix3f normalMatrix_;
+	bool isIdentity_, isAffine_;
 
 public:
 	Entity()
-		:modelToWorld_(Eigen::Matrix4f::Identity())
+		:modelToWorld_(Eigen::Matrix4f::Identity()), worldToModel_(Eigen::Matrix4f::Identity()),
+		normalMatrix_(Eigen::Matrix3f::Identity()), isIdentity_(true), isAffine_(true)
 	{}
 
 	virtual ~Entity() noexcept
 	{}
 
-	Eigen::Matrix4f modelToWorld() const
+	const Eigen::Matrix4f& modelToWorld() const
 	{
 		return modelToWorld_;
 	}
 
-	Eigen::Matrix4f worldToModel() const
+	const Eigen::Matrix4f& worldToModel() const
 	{
-		return modelToWorld_.inverse();
+		return worldToModel_;
+	}
+
+	/// <summary>
+	/// Inverse transpose of the upper left 3x3 of modelToWorld, used to transform normals.
+	/// </summary>
+	const Eigen::Matrix3f& normalMatrix() const
+	{
+		return normalMatrix_;
+	}
+
+	bool isIdentity() const
+	{
+		return isIdentity_;
+	}
+
+	/// <summary>
+	/// True if the bottom row of modelToWorld is (0, 0, 0, 1), so positions don't need
+	/// dividing by w after transforming.
+	/// </summary>
+	bool isAffine() const
+	{
+		return isAffine_;
 	}
 
 	virtual void modelToWorld(const Eigen::Matrix4f& m)
 	{
 		modelToWorld_ = m;
+		worldToModel_ = m.inverse();
+		normalMatrix_ = m.block<3, 3>(0, 0).inverse().transpose();
+		isIdentity_ = m.isIdentity(0.f);
+		isAffine_ = m.row(3) == Eigen::RowVector4f(0.f, 0.f, 0.f, 1.f);
+	}
+
+	Eigen::Vector3f positionToWorld(const Eigen::Vector3f& position) const
+	{
+		return applyToPosition(modelToWorld_, position);
+	}
+
+	Eigen::Vector3f positionToModel(const Eigen::Vector3f& position) const
+	{
+		return applyToPosition(worldToModel_, position);
 	}
-};
 
+	Eigen::Vector3f directionToWorld(const Eigen::Vector3f& direction) const
+	{
+		if (isIdentity_) return direction;
+		return modelToWorld_.block<3, 3>(0, 0) * direction;
+	}
+
+	Eigen::Vector3f directionToModel(const Eigen::Vector3f& direction) const
+	{
+		if (isIdentity_) return direction;
+		return worldToModel_.block<3, 3>(0, 0) * direction;
+	}
+
+	/// <summary>
+	/// Transform a model space normal to world space. The result is not normalised.
+	/// </summary>
+	Eigen::Vector3f normalToWorld(const Eigen::Vector3f& normal) const
+	{
+		if (isIdentity_) return normal;
+		return normalMatrix_ * normal;
+	}
+
+	/// <summary>
+	/// Transform a world space ray into model space. Note the direction is not renormalised.
+	/// </summary>
+	Ray rayToModel(const Ray& ray) const
+	{
+		if (isIdentity_) return ray;
+		Ray tRay;
+		tRay.origin = positionToModel(ray.origin);
+		tRay.direction = directionToModel(ray.direction);
+		return tRay;
+	}
+
+private:
+	Eigen::Vector3f applyToPosition(const Eigen::Matrix4f& m, const Eigen::Vector3f& position) const
+	{
+		if (isIdentity_) return position;
+		Eigen::Vector3f transformed = m.block<3, 3>(0, 0) * position + m.block<3, 1>(0, 3);
+		if (isAffine_) return transformed;
+		float w = m.row(3).head<3>().dot(position) + m(3, 3);
+		return transformed / w;
+	}
+};
@@ -0,0 +1,125 @@
+#pragma once
+#include <Eigen/Dense>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "CpuFeatures.hpp"
+
+/// <summary>
+/// A floating point RGB image that the renderer draws into, without clamping. It is saved
+/// with an ImageWriter, which converts it to the output format.
+/// Row 0 is the bottom of the image, matching the camera (whose y axis points up), so
+/// formats that store rows bottom-up can be written without flipping the image.
+/// For very large images, a Framebuffer can hold just a band of rows of the image at a
+/// time (see setRows). Rows are always addressed by their position in the whole image.
+/// </summary>
+class Framebuffer
+{
+private:
+	int width_, height_; // Size of the whole image
+	int firstRow_, rows_, maxRows_; // Rows currently held
+	std::vector<float> pixels_; // RGB, one row after another from the bottom.
+
+public:
+	/// <summary>
+	/// Holds the whole image.
+	/// </summary>
+	Framebuffer(int width, int height)
+		:Framebuffer(width, height, height)
+	{}
+
+	/// <summary>
+	/// Holds up to maxRows rows of the image at once, starting with the bottom rows.
+	/// </summary>
+	Framebuffer(int width, int height, int maxRows)
+		:width_(width), height_(height), firstRow_(0), rows_(std::min(maxRows, height)), maxRows_(rows_),
+		pixels_(3 * size_t(width) * rows_, 0.f)
+	{}
+
+	int width() const
+	{
+		return width_;
+	}
+
+	int height() const
+	{
+		return height_;
+	}
+
+	int firstRow() const
+	{
+		return firstRow_;
+	}
+
+	int rows() const
+	{
+		return rows_;
+	}
+
+	int maxRows() const
+	{
+		return maxRows_;
+	}
+
+	/// <summary>
+	/// Holds rows [firstRow, firstRow + rows) of the image instead, reusing the same
+	/// memory. The pixels are not cleared.
+	/// </summary>
+	void setRows(int firstRow, int rows)
+	{
+		if (rows > maxRows_ || firstRow < 0 || firstRow + rows > height_) throw std::runtime_error("Framebuffer rows out of range!");
+		firstRow_ = firstRow;
+		rows_ = rows;
+	}
+
+	void set(int x, int y, const Eigen::Vector3f& color)
+	{
+		float* pixel = &pixels_[3 * (size_t(y - firstRow_) * width_ + x)];
+		pixel[0] = color.x();
+		pixel[1] = color.y();
+		pixel[2] = color.z();
+	}
+
+	Eigen::Vector3f get(int x, int y) const
+	{
+		const float* pixel = &pixels_[3 * (size_t(y - firstRow_) * width_ + x)];
+		return Eigen::Vector3f(pixel[0], pixel[1], pixel[2]);
+	}
+
+	/// <summary>
+	/// The 3 * width() floats of row y, which must be one of the rows held.
+	/// </summary>
+	const float* row(int y) const
+	{
+		return &pixels_[3 * size_t(y - firstRow_) * width_];
+	}
+
+	/// <summary>
+	/// Converts row y to 8 bits per channel (RGB), clamping to [0, 1] and scaling by 255.
+	/// Values are truncated rather than rounded, so a colour given as bytes / 255 converts
+	/// back to the same bytes. out must have space for 3 * width() bytes.
+	/// </summary>
+	void quantiseRow(int y, unsigned char* out) const
+	{
+		const float* in = row(y);
+		int n = 3 * width_, i = 0;
+#ifdef HAS_X86_SIMD
+		// 16 values at a time, packing the (already clamped) integers down to bytes.
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), scale = _mm_set1_ps(255.f);
+		auto convert = [&](const float* p) {
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p), zero), one);
+			return _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+		};
+		for (; i + 16 <= n; i += 16) {
+			__m128i lo = _mm_packs_epi32(convert(in + i), convert(in + i + 4));
+			__m128i hi = _mm_packs_epi32(convert(in + i + 8), convert(in + i + 12));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; i < n; ++i) {
+			// Written so NaN gives 0, as with the SSE max above.
+			float v = in[i] > 0.f ? std::min(in[i], 1.f) : 0.f;
+			out[i] = static_cast<unsigned char>(v * 255.f);
+		}
+	}
+};
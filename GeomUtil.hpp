@@ -100,10 +100,27 @@ Eigen::Vector3f transformDirection(const Eigen::Matrix4f& transform, const Eigen
 /// </summary>
 Eigen::Vector3f transformNormal(const Eigen::Matrix4f& transform, const Eigen::Vector3f& normal)
 {
-	Eigen::Matrix3f normMat = transform.block<3, 3>(0, 0).inverse();
+	Eigen::Matrix3f normMat = transform.block<3, 3>(0, 0).inverse().transpose();
 	return normMat * normal;
 }
 
+/// <summary>
+/// Find an AABB enclosing a transformed AABB, by transforming all eight of its corners.
+/// </summary>
+AABB transformAABB(const Eigen::Matrix4f& transform, const AABB& aabb)
+{
+	AABB transformed = AABB::empty();
+	if (aabb.isEmpty()) return transformed;
+	for (int corner = 0; corner < 8; ++corner) {
+		Eigen::Vector3f point(
+			(corner & 1) ? aabb.max.x() : aabb.min.x(),
+			(corner & 2) ? aabb.max.y() : aabb.min.y(),
+			(corner & 4) ? aabb.max.z() : aabb.min.z());
+		transformed.expand(transformPosition(transform, point));
+	}
+	return transformed;
+}
+
 /// <summary>
 /// Reflect a vector in a specified normal vector. BOTH VECTORS MUST BE NORMALISED.
 /// </summary>
@@ -148,15 +165,130 @@ Eigen::Vector3f coefftWiseMul(const Eigen::Vector3f& left, const Eigen::Vector3f
 	return (left.array() * right.array()).matrix();
 }
 
+/// <summary>
+/// Intersect a ray with a single triangle, given its first vertex and the edges from it to the
+/// other two vertices (v1 - v0 and v2 - v0), in the same space as the ray.
+/// If culling is enabled, back-facing triangles are ignored.
+/// On a hit, t is set to the distance along the ray and u, v to the barycentric
+/// coordinates of the hit relative to v1 and v2 respectively.
+/// </summary>
+bool intersectTriangleEdges(const Ray& ray,
+	const Eigen::Vector3f& v0, const Eigen::Vector3f& v0v1, const Eigen::Vector3f& v0v2,
+	bool culling, float& t, float& u, float& v)
+{
+	// Intersection code from
+	// https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection.html
+	Eigen::Vector3f pvec = ray.direction.cross(v0v2);
+	float det = v0v1.dot(pvec);
+
+	if (culling) {
+		// if the determinant is negative, the triangle is 'back facing'
+		// if the determinant is close to 0, the ray misses the triangle
+		if (det < 1e-6) return false;
+	}
+	else {
+		// ray and triangle are parallel if det is close to 0
+		if (fabs(det) < 1e-6) return false;
+	}
+
+	float invDet = 1 / det;
+
+	Eigen::Vector3f tvec = ray.origin - v0;
+	u = tvec.dot(pvec) * invDet;
+	if (u < 0 || u > 1) return false;
+
+	Eigen::Vector3f qvec = tvec.cross(v0v1);
+	v = ray.direction.dot(qvec) * invDet;
+	if (v < 0 || u + v > 1) return false;
+
+	t = v0v2.dot(qvec) * invDet;
+	return true;
+}
+
+/// <summary>
+/// Intersect a ray with a single triangle, given its vertices in the same space as the ray.
+/// See intersectTriangleEdges.
+/// </summary>
+bool intersectTriangle(const Ray& ray,
+	const Eigen::Vector3f& v0, const Eigen::Vector3f& v1, const Eigen::Vector3f& v2,
+	bool culling, float& t, float& u, float& v)
+{
+	return intersectTriangleEdges(ray, v0, v1 - v0, v2 - v0, culling, t, u, v);
+}
+
+/// <summary>
+/// Intersect a ray with a sphere, in the same space as the ray. The ray direction should
+/// be normalised. On a hit, t is set to the distance along the ray to the nearest
+/// intersection in [minT, maxT]. Returns false if there isn't one.
+/// </summary>
+bool intersectSphere(const Ray& ray, const Eigen::Vector3f& centre, float radius, float minT, float maxT, float& t)
+{
+	Eigen::Vector3f centreToOrigin = ray.origin - centre;
+
+	// Quadratic equation coefficients
+	float a = 1.0f;
+	float b = 2 * centreToOrigin.dot(ray.direction);
+	float c = centreToOrigin.dot(centreToOrigin) - radius * radius;
+
+	double discriminant = b * b - 4 * a * c;
+
+	// No intersection at all. Note we don't worry about the tangent case here!
+	if (discriminant < 1e-6f) return false;
+
+	// Two intersections.
+	discriminant = sqrtf(discriminant); // This is safe now we know discriminant > 0.f
+	float t0 = (-b - discriminant) / (2.f * a);
+	float t1 = (-b + discriminant) / (2.f * a);
+
+	if (t0 > t1) std::swap(t0, t1);
+
+	if (t0 > maxT || t1 < minT) return false;
+	else if (t0 < minT) {
+		if (t1 < maxT) t = t1;
+		else return false;
+	}
+	else t = t0;
+	return true;
+}
+
+/// <summary>
+/// Intersect a ray with an infinite plane through point with the given normal, in the same
+/// space as the ray. On a hit, t is set to the distance along the ray.
+/// Returns false if the ray doesn't hit the plane within [minT, maxT].
+/// </summary>
+bool intersectPlane(const Ray& ray, const Eigen::Vector3f& point, const Eigen::Vector3f& normal, float minT, float maxT, float& t)
+{
+	float rayDotNorm = ray.direction.dot(normal);
+	if (abs(rayDotNorm) < 1e-6f) return false; // ray parallel to plane.
+
+	t = (point - ray.origin).dot(normal) / rayDotNorm;
+	return t >= minT && t <= maxT; // intersection in range?
+}
+
+/// <summary>
+/// Estimates how quickly texture coordinates change across a triangle, per unit distance,
+/// given two of its edges (v1 - v0 and v2 - v0) and the texture coordinates of its vertices.
+/// This is the square root of the ratio of its area in texture space to its area in 3D.
+/// Returns 0 for degenerate triangles.
+/// </summary>
+float triangleTexCoordScale(const Eigen::Vector3f& v0v1, const Eigen::Vector3f& v0v2,
+	const Eigen::Vector2f& t0, const Eigen::Vector2f& t1, const Eigen::Vector2f& t2)
+{
+	float area = v0v1.cross(v0v2).norm();
+	Eigen::Vector2f t0t1 = t1 - t0, t0t2 = t2 - t0;
+	float texArea = std::abs(t0t1.x() * t0t2.y() - t0t1.y() * t0t2.x());
+	return area > 0.f ? sqrtf(texArea / area) : 0.f;
+}
+
 /// <summary>
 /// Given a list of renderables, finds an AABB surrounding them all.
 /// </summary>
 AABB getRenderablesAABB(const std::vector<std::shared_ptr<Renderable>>& renderables)
 {
-	AABB aabb;
-	// **** YOUR CODE HERE ****
-	// Iterate through the list of renderables, and find an AABB that surrounds all of them.
-	// Make use of the getAABB() method that all Renderable instances have.
+	AABB aabb = AABB::empty();
+	for (const auto& renderable : renderables) {
+		aabb.expand(renderable->getAABB());
+	}
 	return aabb;
 }
 
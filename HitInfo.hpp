@@ -2,9 +2,12 @@
 #include <Eigen/Dense>
 
 class Shader;
+class Renderable;
 
 /// <summary>
 /// Structure encoding information from an intersection test.
+/// While searching for the closest hit, only hitT and the last three fields are filled in.
+/// The other attributes are worked out once the closest hit is known (see Renderable::intersect).
 /// </summary>
 struct HitInfo
 {
@@ -14,5 +17,11 @@ struct HitInfo
 		location, // World-space location of hit point.
 		inDirection; // Incoming ray direction.
 	Eigen::Vector2f texCoords; // Texture coordinates at the hit location.
+	float texCoordScale; // Change in texture coordinates per unit distance across the surface, or 0 if unknown.
+	float coneWidth, coneSpread; // Width of the ray's cone at the hit location, and how fast it spreads (see Ray).
 	const Shader* shader; // Shader associated with the hit object.
+
+	const Renderable* object; // Object that will fill in the attributes above, or nullptr if they already are.
+	int primitive; // Part of the object that was hit, e.g. the index of a triangle in a mesh.
+	Eigen::Vector2f barycentrics; // Where on the primitive the hit was, if it's a triangle.
 };
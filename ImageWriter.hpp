@@ -0,0 +1,174 @@
+#pragma once
+#include "Framebuffer.hpp"
+#include <string>
+#include <fstream>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+/// <summary>
+/// Saves a Framebuffer to a file in a particular image format.
+/// The image can be written all at once with write(), or streamed out in bands of rows as
+/// they are rendered: call open(), then writeRows() with a Framebuffer holding each band in
+/// turn (see Framebuffer::setRows), then close(). Only the band being written is held in
+/// memory, so the size of the image is limited only by the output format. The bands must
+/// be given in the order the format stores rows in, which is given by topDown().
+/// Writers convert a few rows at a time, in parallel, so only a small part of the image is
+/// ever held in the output format either.
+/// </summary>
+class ImageWriter
+{
+public:
+	virtual ~ImageWriter() {}
+
+	/// <summary>
+	/// True if rows must be written from the top of the image down, false if from the
+	/// bottom up.
+	/// </summary>
+	virtual bool topDown() const = 0;
+
+	/// <summary>
+	/// Starts writing an image of the given size to the named file.
+	/// Throws std::runtime_error if the file can't be written, here and below.
+	/// </summary>
+	void open(const std::string& filename, int width, int height)
+	{
+		out_.open(filename, std::ofstream::binary);
+		if (out_.fail()) throw std::runtime_error("Couldn't open output image file " + filename + "!");
+		filename_ = filename;
+		width_ = width;
+		height_ = height;
+		rowsWritten_ = 0;
+		writeHeader();
+	}
+
+	/// <summary>
+	/// Writes all the rows held by the framebuffer, which must be the next rows of the
+	/// image in the order given by topDown().
+	/// </summary>
+	void writeRows(const Framebuffer& rows)
+	{
+		int next = imageRow(rowsWritten_);
+		bool inOrder = topDown() ? rows.firstRow() + rows.rows() - 1 == next : rows.firstRow() == next;
+		if (!out_.is_open() || rows.width() != width_ || rows.height() != height_ || !inOrder) {
+			throw std::runtime_error("Rows written to " + filename_ + " out of order!");
+		}
+		for (int done = 0; done < rows.rows(); done += ROWS_PER_BAND) {
+			writeBand(rows, rowsWritten_ + done, std::min(ROWS_PER_BAND, rows.rows() - done));
+		}
+		rowsWritten_ += rows.rows();
+		if (out_.fail()) throw std::runtime_error("Couldn't write output image file " + filename_ + "!");
+	}
+
+	/// <summary>
+	/// Finishes the file, once all the rows have been written.
+	/// </summary>
+	void close()
+	{
+		if (rowsWritten_ != height_) throw std::runtime_error("Not all rows were written to " + filename_ + "!");
+		writeFooter();
+		out_.close();
+		if (out_.fail()) throw std::runtime_error("Couldn't write output image file " + filename_ + "!");
+	}
+
+	/// <summary>
+	/// Writes a whole image, held in one framebuffer, to the named file.
+	/// </summary>
+	void write(const Framebuffer& image, const std::string& filename)
+	{
+		open(filename, image.width(), image.height());
+		writeRows(image);
+		close();
+	}
+
+protected:
+	static constexpr int ROWS_PER_BAND = 64;
+
+	std::ofstream out_;
+	std::string filename_;
+	int width_ = 0, height_ = 0;
+	int rowsWritten_ = 0;
+
+	virtual void writeHeader() = 0;
+
+	/// <summary>
+	/// Converts and writes count rows, starting from row fileRow of the file (counting in
+	/// the order given by topDown()), taking them from the framebuffer. count is at most
+	/// ROWS_PER_BAND.
+	/// </summary>
+	virtual void writeBand(const Framebuffer& rows, int fileRow, int count) = 0;
+
+	virtual void writeFooter() {}
+
+	/// <summary>
+	/// The row of the image stored as row fileRow of the file.
+	/// </summary>
+	int imageRow(int fileRow) const
+	{
+		return topDown() ? height_ - 1 - fileRow : fileRow;
+	}
+
+	/// <summary>
+	/// Appends an integer to a buffer in little-endian byte order, whatever the byte
+	/// order of this machine.
+	/// </summary>
+	template<typename T>
+	static void appendLE(std::vector<unsigned char>& buffer, T value)
+	{
+		uint64_t bits = static_cast<uint64_t>(value);
+		for (size_t b = 0; b < sizeof(T); ++b) buffer.push_back(static_cast<unsigned char>(bits >> (8 * b)));
+	}
+
+	static void appendLE(std::vector<unsigned char>& buffer, float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		appendLE(buffer, bits);
+	}
+
+	static void appendBE(std::vector<unsigned char>& buffer, uint32_t value)
+	{
+		for (int b = 3; b >= 0; --b) buffer.push_back(static_cast<unsigned char>(value >> (8 * b)));
+	}
+
+	static void append(std::vector<unsigned char>& buffer, const char* text)
+	{
+		buffer.insert(buffer.end(), text, text + strlen(text));
+	}
+
+	void writeBuffer(const std::vector<unsigned char>& buffer, size_t size)
+	{
+		out_.write(reinterpret_cast<const char*>(buffer.data()), size);
+	}
+
+	void writeBuffer(const std::vector<unsigned char>& buffer)
+	{
+		writeBuffer(buffer, buffer.size());
+	}
+
+	static bool littleEndian()
+	{
+		const uint32_t one = 1;
+		unsigned char first;
+		memcpy(&first, &one, 1);
+		return first == 1;
+	}
+
+	/// <summary>
+	/// Copies floats to a buffer in little-endian byte order. out must have space for
+	/// 4 * count bytes.
+	/// </summary>
+	static void copyFloatsLE(const float* in, int count, unsigned char* out)
+	{
+		if (littleEndian()) {
+			memcpy(out, in, 4 * size_t(count));
+			return;
+		}
+		for (int i = 0; i < count; ++i) {
+			uint32_t bits;
+			memcpy(&bits, &in[i], sizeof(bits));
+			for (int b = 0; b < 4; ++b) out[4 * i + b] = static_cast<unsigned char>(bits >> (8 * b));
+		}
+	}
+};
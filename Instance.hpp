@@ -0,0 +1,86 @@
+#pragma once
+#include "Renderable.hpp"
+#include "GeomUtil.hpp"
+#include <memory>
+
+/// <summary>
+/// An Instance places a shared Renderable in the world with its own modelToWorld transform.
+/// This is intended for two-level BVHs: build a bottom-level BVH once in model space (e.g.
+/// a LinearMeshBVH with no transform), make an Instance of it for each placement, and put
+/// the instances in a top-level LinearRenderableBVH (or BVHNode). Memory use and build time
+/// then depend on the amount of unique geometry, not on the number of instances.
+/// Rays are transformed into model space once, on entry to the instance. After moving
+/// instances, call update() on the top-level BVH to refit it.
+/// If the instance has a shader, it replaces the shader of the shared object.
+/// </summary>
+class Instance : public Renderable
+{
+private:
+	std::shared_ptr<const Renderable> object_;
+
+public:
+	/// <param name="object">The shared object to instance. Its own transform is applied before the instance's.</param>
+	/// <param name="modelToWorld">Transform taking the object to world space.</param>
+	/// <param name="shader">Shader overriding the object's shader, or nullptr to keep the object's own.</param>
+	/// <param name="mask">Intersection mask for the instance.</param>
+	Instance(std::shared_ptr<const Renderable> object, const Eigen::Matrix4f& modelToWorld = Eigen::Matrix4f::Identity(),
+		const Shader* shader = nullptr, IntersectMask mask = DEFAULT_BITMASK)
+		:Renderable(shader, mask), object_(std::move(object))
+	{
+		Entity::modelToWorld(modelToWorld);
+	}
+
+	/// <summary>
+	/// The shared object this is an instance of.
+	/// </summary>
+	const std::shared_ptr<const Renderable>& object() const
+	{
+		return object_;
+	}
+
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		// Renderables expect normalised directions, so distances along the model-space ray
+		// are scaled by the length of the transformed direction.
+		Ray modelRay = rayToModel(ray);
+		float scale = modelRay.direction.norm();
+		modelRay.direction /= scale;
+
+		// The model space ray is only known here, so the hit attributes are filled in now
+		// rather than deferred.
+		HitInfo modelInfo;
+		if (!object_->intersect(modelRay, minT * scale, maxT * scale, modelInfo, mask)) return false;
+
+		info = modelInfo;
+		info.hitT = modelInfo.hitT / scale;
+		info.location = ray.origin + info.hitT * ray.direction;
+		info.normal = normalToWorld(modelInfo.normal).normalized();
+		info.inDirection = ray.direction;
+		info.texCoordScale = texCoordScaleToWorld(modelInfo.texCoordScale);
+		if (shader()) info.shader = shader();
+		return true;
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		Ray modelRay = rayToModel(ray);
+		float scale = modelRay.direction.norm();
+		modelRay.direction /= scale;
+
+		return object_->occluded(modelRay, minT * scale, maxT * scale, mask);
+	}
+
+	virtual AABB getAABB() const override
+	{
+		return transformAABB(modelToWorld(), object_->getAABB());
+	}
+
+	virtual std::string print() const override
+	{
+		return "Instance of " + object_->print();
+	}
+};
@@ -0,0 +1,320 @@
+#pragma once
+#include "AABB.hpp"
+#include "BVHBuildTypes.hpp"
+#include <vector>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// <summary>
+/// Builds a linear BVH (LBVH), following Karras, "Maximizing Parallelism in the
+/// Construction of BVHs, Octrees, and k-d Trees" (2012).
+/// Primitive centroids are quantised onto a grid and given Morton codes (30 or 63 bits),
+/// which are sorted with a parallel radix sort. Along the resulting Z-order curve every
+/// subtree covers a contiguous range of primitives, and the split point of each interior
+/// node is where the highest differing bit of the codes changes. All the interior nodes
+/// can therefore be worked out independently (and in parallel) from the sorted codes.
+/// Finally, small subtrees are collapsed into leaves using the same SAH leaf cost model
+/// as BVHBuilder.
+/// The tree is lower quality than a full SAH build, but takes a fraction of the time to
+/// make, which suits scenes that must be rebuilt every frame.
+/// </summary>
+class LBVHBuilder
+{
+public:
+	static constexpr int PARALLEL_THRESHOLD = 4096; // Use multiple threads for more primitives than this.
+
+private:
+	BVHBuildParams params_;
+
+	struct MortonPrimitive
+	{
+		uint64_t code;
+		int prim;
+	};
+
+	/// <summary>
+	/// Spreads the low 10 bits of x out so there are two zero bits between each.
+	/// </summary>
+	static uint64_t expandBits10(uint64_t x)
+	{
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x30000ff;
+		x = (x | (x << 8)) & 0x300f00f;
+		x = (x | (x << 4)) & 0x30c30c3;
+		x = (x | (x << 2)) & 0x9249249;
+		return x;
+	}
+
+	/// <summary>
+	/// Spreads the low 21 bits of x out so there are two zero bits between each.
+	/// </summary>
+	static uint64_t expandBits21(uint64_t x)
+	{
+		x &= 0x1fffff;
+		x = (x | (x << 32)) & 0x1f00000000ffffULL;
+		x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+		x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+		x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+		x = (x | (x << 2)) & 0x1249249249249249ULL;
+		return x;
+	}
+
+	/// <summary>
+	/// Morton code of a point, given as coordinates in [0, 1]^3 within the centroid bounds.
+	/// Bits are interleaved as ...xyzxyz, so the highest bit of each triple is x.
+	/// </summary>
+	uint64_t mortonCode(const Eigen::Vector3f& p) const
+	{
+		int bitsPerAxis = params_.mortonBits / 3;
+		float scale = static_cast<float>((1u << bitsPerAxis) - 1);
+		uint64_t q[3];
+		for (int a = 0; a < 3; ++a) {
+			q[a] = static_cast<uint64_t>(std::min(std::max(p[a] * scale, 0.f), scale));
+		}
+		if (bitsPerAxis == 10)
+			return (expandBits10(q[0]) << 2) | (expandBits10(q[1]) << 1) | expandBits10(q[2]);
+		return (expandBits21(q[0]) << 2) | (expandBits21(q[1]) << 1) | expandBits21(q[2]);
+	}
+
+	static int countLeadingZeros(uint64_t x)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return x ? __builtin_clzll(x) : 64;
+#else
+		int n = 0;
+		for (uint64_t bit = 1ULL << 63; bit && !(x & bit); bit >>= 1) ++n;
+		return n;
+#endif
+	}
+
+	/// <summary>
+	/// Sorts by Morton code with a parallel least-significant-digit radix sort, 8 bits
+	/// per pass. Each thread histograms its own chunk of the list, and the histograms are
+	/// combined into per-thread output offsets so the scatter can also run in parallel
+	/// while keeping the sort stable.
+	/// </summary>
+	void radixSort(std::vector<MortonPrimitive>& items) const
+	{
+		int n = static_cast<int>(items.size());
+		std::vector<MortonPrimitive> sorted(n);
+		std::vector<std::array<int, 256>> histograms;
+
+		for (int shift = 0; shift < params_.mortonBits; shift += 8) {
+			#pragma omp parallel if(n >= PARALLEL_THRESHOLD)
+			{
+				int thread = 0, nThreads = 1;
+#ifdef _OPENMP
+				thread = omp_get_thread_num();
+				nThreads = omp_get_num_threads();
+#endif
+				#pragma omp single
+				histograms.assign(nThreads, std::array<int, 256>());
+
+				int begin = static_cast<int>(static_cast<long long>(n) * thread / nThreads);
+				int end = static_cast<int>(static_cast<long long>(n) * (thread + 1) / nThreads);
+				std::array<int, 256>& histogram = histograms[thread];
+				histogram.fill(0);
+				for (int i = begin; i < end; ++i) {
+					++histogram[(items[i].code >> shift) & 0xff];
+				}
+
+				#pragma omp barrier
+				#pragma omp single
+				{
+					// Turn the counts into the position each thread writes its first item
+					// with each digit to.
+					int offset = 0;
+					for (int digit = 0; digit < 256; ++digit) {
+						for (int t = 0; t < nThreads; ++t) {
+							int count = histograms[t][digit];
+							histograms[t][digit] = offset;
+							offset += count;
+						}
+					}
+				}
+
+				for (int i = begin; i < end; ++i) {
+					sorted[histogram[(items[i].code >> shift) & 0xff]++] = items[i];
+				}
+			}
+			std::swap(items, sorted);
+		}
+	}
+
+	/// <summary>
+	/// Length of the longest common prefix of the keys of sorted items i and j, or -1 if j
+	/// is out of range. Equal codes are told apart by their position in the list.
+	/// </summary>
+	static int commonPrefix(const std::vector<MortonPrimitive>& items, int i, int j)
+	{
+		if (j < 0 || j >= static_cast<int>(items.size())) return -1;
+		uint64_t a = items[i].code, b = items[j].code;
+		if (a == b)
+			return 64 + countLeadingZeros(static_cast<uint64_t>(i ^ j) << 32);
+		return countLeadingZeros(a ^ b);
+	}
+
+	/// <summary>
+	/// Works out the range of sorted items [first, last] covered by interior node i, and
+	/// the split position: the left child covers [first, split] and the right child
+	/// [split + 1, last].
+	/// </summary>
+	static void findRangeAndSplit(const std::vector<MortonPrimitive>& items, int i, int& first, int& last, int& split)
+	{
+		// Direction of the range from i, and an upper bound on its length.
+		int d = (commonPrefix(items, i, i + 1) - commonPrefix(items, i, i - 1)) >= 0 ? 1 : -1;
+		int minPrefix = commonPrefix(items, i, i - d);
+		int maxLength = 2;
+		while (commonPrefix(items, i, i + maxLength * d) > minPrefix) maxLength *= 2;
+
+		// Binary search for the other end of the range.
+		int length = 0;
+		for (int t = maxLength / 2; t >= 1; t /= 2) {
+			if (commonPrefix(items, i, i + (length + t) * d) > minPrefix) length += t;
+		}
+		int j = i + length * d;
+
+		// Binary search for the split position.
+		int nodePrefix = commonPrefix(items, i, j);
+		int s = 0;
+		for (int divisor = 2; ; divisor *= 2) {
+			int t = (length + divisor - 1) / divisor;
+			if (commonPrefix(items, i, i + (s + t) * d) > nodePrefix) s += t;
+			if (t == 1) break;
+		}
+		split = i + s * d + std::min(d, 0);
+		first = std::min(i, j);
+		last = std::max(i, j);
+	}
+
+	/// <summary>
+	/// Axis whose bit is the highest one differing between the codes of items first and last.
+	/// </summary>
+	int splitAxis(const std::vector<MortonPrimitive>& items, int first, int last, const AABB& bounds) const
+	{
+		uint64_t diff = items[first].code ^ items[last].code;
+		if (diff == 0) return bounds.longestAxis();
+		int highestBit = 63 - countLeadingZeros(diff);
+		return 2 - highestBit % 3;
+	}
+
+	/// <summary>
+	/// Makes the build node for sorted items [first, last] (interior node index if
+	/// first != last), computing bounds bottom-up. Subtrees which are cheaper to intersect
+	/// directly than to split, according to the SAH cost model, become leaves.
+	/// </summary>
+	std::unique_ptr<BVHBuildNode> emitNode(const std::vector<MortonPrimitive>& items,
+		const std::vector<BVHPrimitive>& prims, const std::vector<int>& splits,
+		int first, int last, int index) const
+	{
+		auto node = std::make_unique<BVHBuildNode>();
+		if (first == last) {
+			node->bounds = prims[first].bounds;
+			node->primOffset = first;
+			node->primCount = 1;
+			return node;
+		}
+
+		int split = splits[index];
+		int leftIndex = split, rightIndex = split + 1;
+		BVHBuildNode* nodePtr = node.get();
+		if (last - first >= PARALLEL_THRESHOLD) {
+			#pragma omp task shared(items, prims, splits) firstprivate(nodePtr, first, split, leftIndex)
+			nodePtr->children[0] = emitNode(items, prims, splits, first, split, leftIndex);
+			nodePtr->children[1] = emitNode(items, prims, splits, split + 1, last, rightIndex);
+			#pragma omp taskwait
+		}
+		else {
+			nodePtr->children[0] = emitNode(items, prims, splits, first, split, leftIndex);
+			nodePtr->children[1] = emitNode(items, prims, splits, split + 1, last, rightIndex);
+		}
+
+		const BVHBuildNode& left = *node->children[0];
+		const BVHBuildNode& right = *node->children[1];
+		node->bounds = left.bounds;
+		node->bounds.expand(right.bounds);
+		node->splitAxis = splitAxis(items, first, last, node->bounds);
+
+		int count = last - first + 1;
+		if (count <= params_.maxLeafSize) {
+			float leftCount = static_cast<float>(split - first + 1), rightCount = static_cast<float>(last - split);
+			float splitCost = params_.traversalCost + params_.intersectionCost *
+				(left.bounds.surfaceArea() * leftCount + right.bounds.surfaceArea() * rightCount) / node->bounds.surfaceArea();
+			if (!(splitCost < params_.intersectionCost * count)) {
+				node->children[0].reset();
+				node->children[1].reset();
+				node->primOffset = first;
+				node->primCount = count;
+			}
+		}
+		return node;
+	}
+
+public:
+	LBVHBuilder(const BVHBuildParams& params = BVHBuildParams())
+		:params_(params)
+	{
+		params_.mortonBits = params_.mortonBits > 30 ? 63 : 30;
+		params_.maxLeafSize = std::max(params_.maxLeafSize, 1);
+	}
+
+	/// <summary>
+	/// Build an LBVH over the supplied primitives. The list is reordered (into Morton
+	/// order) so each leaf of the returned tree refers to a contiguous range of it.
+	/// </summary>
+	std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitive>& prims) const
+	{
+		int n = static_cast<int>(prims.size());
+		if (n == 0) {
+			auto root = std::make_unique<BVHBuildNode>();
+			root->bounds = AABB::empty();
+			return root;
+		}
+
+		AABB centroidBounds = AABB::empty();
+		for (const BVHPrimitive& prim : prims) {
+			centroidBounds.expand(prim.centroid);
+		}
+		Eigen::Vector3f extent = (centroidBounds.max - centroidBounds.min).cwiseMax(Eigen::Vector3f::Constant(1e-20f));
+
+		std::vector<MortonPrimitive> items(n);
+		#pragma omp parallel for if(n >= PARALLEL_THRESHOLD)
+		for (int i = 0; i < n; ++i) {
+			items[i].code = mortonCode((prims[i].centroid - centroidBounds.min).cwiseQuotient(extent));
+			items[i].prim = i;
+		}
+
+		radixSort(items);
+
+		// Put the primitives into Morton order, so every subtree covers a contiguous range.
+		std::vector<BVHPrimitive> sortedPrims(n);
+		#pragma omp parallel for if(n >= PARALLEL_THRESHOLD)
+		for (int i = 0; i < n; ++i) {
+			sortedPrims[i] = prims[items[i].prim];
+		}
+		prims.swap(sortedPrims);
+
+		// Interior node i (of n - 1) is found independently of all the others. The root is
+		// interior node 0; the children of the node split at s are interior nodes s and s + 1
+		// (unless they cover a single primitive, in which case they are leaves).
+		std::vector<int> splits(std::max(n - 1, 0));
+		#pragma omp parallel for if(n >= PARALLEL_THRESHOLD)
+		for (int i = 0; i < n - 1; ++i) {
+			int first, last;
+			findRangeAndSplit(items, i, first, last, splits[i]);
+		}
+
+		std::unique_ptr<BVHBuildNode> root;
+		#pragma omp parallel if(n >= PARALLEL_THRESHOLD)
+		{
+			#pragma omp single
+			root = emitNode(items, prims, splits, 0, n - 1, 0);
+		}
+		return root;
+	}
+};
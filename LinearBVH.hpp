@@ -0,0 +1,245 @@
+#pragma once
+#include "AABB.hpp"
+#include "Ray.hpp"
+#include "BVHBuilder.hpp"
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+/// <summary>
+/// A single node of a LinearBVH, packed into 32 bytes so two nodes share a cache line.
+/// Nodes are stored in depth-first order, so the first child of an interior node
+/// is always the next node in the array and only the second child's index is stored.
+/// Leaves reference a contiguous range of primitives instead.
+/// </summary>
+struct LinearBVHNode
+{
+	float boundsMin[3], boundsMax[3];
+	uint32_t offset; // Leaf: index of first primitive. Interior: index of second child.
+	uint16_t primCount; // Number of primitives in a leaf, 0 for interior nodes.
+	uint8_t splitAxis; // Axis the node was split along (interior nodes only).
+	uint8_t leaf; // 1 for leaves. A leaf can be empty (the root of a tree with no primitives).
+
+	bool isLeaf() const
+	{
+		return leaf != 0;
+	}
+
+	AABB bounds() const
+	{
+		AABB aabb;
+		aabb.min = Eigen::Vector3f(boundsMin[0], boundsMin[1], boundsMin[2]);
+		aabb.max = Eigen::Vector3f(boundsMax[0], boundsMax[1], boundsMax[2]);
+		return aabb;
+	}
+
+	void setBounds(const AABB& aabb)
+	{
+		for (int a = 0; a < 3; ++a) {
+			boundsMin[a] = aabb.min[a];
+			boundsMax[a] = aabb.max[a];
+		}
+	}
+
+	/// <summary>
+	/// Slab test against the node bounds. invDir is the reciprocal of the ray direction,
+	/// computed once per ray.
+	/// </summary>
+	bool intersect(const Eigen::Vector3f& origin, const Eigen::Vector3f& invDir, float minT, float maxT) const
+	{
+		for (int a = 0; a < 3; ++a) {
+			float t0 = (boundsMin[a] - origin[a]) * invDir[a];
+			float t1 = (boundsMax[a] - origin[a]) * invDir[a];
+			if (invDir[a] < 0) std::swap(t0, t1);
+			if (t0 > minT) minT = t0;
+			if (t1 < maxT) maxT = t1;
+			if (maxT < minT) return false;
+		}
+		return true;
+	}
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be packed into 32 bytes.");
+
+/// <summary>
+/// A BVH stored as a flat array of nodes, with children referenced by index rather than
+/// by pointer. This is produced by flattening the tree made by BVHBuilder.
+/// The LinearBVH only stores the hierarchy: primitives are owned by the user of the class
+/// (e.g. LinearMeshBVH), who must store them in the order given by the build, so each
+/// leaf refers to a contiguous range [offset, offset + primCount).
+/// Traversal is iterative, using a small fixed-size stack.
+/// </summary>
+class LinearBVH
+{
+public:
+	static constexpr int MAX_STACK_DEPTH = 128;
+
+private:
+	std::vector<LinearBVHNode> nodes_;
+
+	int flattenRecursive(const BVHBuildNode& node, int depth)
+	{
+		if (depth >= MAX_STACK_DEPTH) {
+			throw std::runtime_error("BVH is too deep to be flattened into a LinearBVH!");
+		}
+		int index = static_cast<int>(nodes_.size());
+		nodes_.emplace_back();
+		LinearBVHNode linearNode;
+		linearNode.setBounds(node.bounds);
+		linearNode.splitAxis = static_cast<uint8_t>(node.splitAxis);
+		linearNode.leaf = node.isLeaf() ? 1 : 0;
+		if (node.isLeaf()) {
+			if (node.primCount > UINT16_MAX) {
+				throw std::runtime_error("Too many primitives in a BVH leaf! Try increasing maxDepth.");
+			}
+			linearNode.offset = static_cast<uint32_t>(node.primOffset);
+			linearNode.primCount = static_cast<uint16_t>(node.primCount);
+		}
+		else {
+			linearNode.primCount = 0;
+			flattenRecursive(*node.children[0], depth + 1);
+			linearNode.offset = static_cast<uint32_t>(flattenRecursive(*node.children[1], depth + 1));
+		}
+		nodes_[index] = linearNode;
+		return index;
+	}
+
+public:
+	LinearBVH()
+	{}
+
+	/// <summary>
+	/// Flattens a tree made by BVHBuilder. The primitive ranges of the leaves are kept
+	/// unchanged, so they refer to the primitive list that was passed to the builder.
+	/// </summary>
+	explicit LinearBVH(const BVHBuildNode& root)
+	{
+		flattenRecursive(root, 0);
+	}
+
+	const std::vector<LinearBVHNode>& nodes() const
+	{
+		return nodes_;
+	}
+
+	AABB getAABB() const
+	{
+		return nodes_.empty() ? AABB::empty() : nodes_[0].bounds();
+	}
+
+	/// <summary>
+	/// Recomputes the bounds of all nodes after the primitives have moved, keeping the
+	/// structure of the tree unchanged. leafBounds(firstPrim, primCount) should return
+	/// the current bounds of the primitives in a leaf.
+	/// </summary>
+	template <typename LeafBounds>
+	void refit(LeafBounds&& leafBounds)
+	{
+		int nNodes = static_cast<int>(nodes_.size());
+
+		#pragma omp parallel for schedule(dynamic, 256)
+		for (int i = 0; i < nNodes; ++i) {
+			LinearBVHNode& node = nodes_[i];
+			if (node.isLeaf())
+				node.setBounds(leafBounds(static_cast<int>(node.offset), static_cast<int>(node.primCount)));
+		}
+
+		// Children are always stored after their parent, so working backwards through
+		// the array updates both children before the node itself.
+		for (int i = nNodes - 1; i >= 0; --i) {
+			LinearBVHNode& node = nodes_[i];
+			if (node.isLeaf()) continue;
+			AABB aabb = nodes_[i + 1].bounds();
+			aabb.expand(nodes_[node.offset].bounds());
+			node.setBounds(aabb);
+		}
+	}
+
+	/// <summary>
+	/// Estimated cost of tracing a ray through the tree with the Surface Area Heuristic
+	/// (see BVHBuildParams). This is used to judge how much the tree has degraded after
+	/// being refitted.
+	/// </summary>
+	float sahCost(float traversalCost, float intersectionCost) const
+	{
+		if (nodes_.empty()) return 0.f;
+		float rootArea = nodes_[0].bounds().surfaceArea();
+		if (rootArea <= 0.f) return 0.f;
+		double cost = 0.0;
+		for (const LinearBVHNode& node : nodes_) {
+			float nodeCost = node.isLeaf() ? intersectionCost * node.primCount : traversalCost;
+			cost += nodeCost * node.bounds().surfaceArea();
+		}
+		return static_cast<float>(cost / rootArea);
+	}
+
+	/// <summary>
+	/// Finds the closest hit along the ray. For each leaf whose bounds the ray hits,
+	/// intersectLeaf(firstPrim, primCount, maxT) is called. It should return true if
+	/// it found a hit closer than maxT, and in that case reduce maxT to the hit distance.
+	/// Nodes further away than the closest hit so far are skipped, and the nearer
+	/// child of each node (judged from the ray direction) is visited first.
+	/// </summary>
+	template <typename LeafIntersector>
+	bool intersect(const Ray& ray, float minT, float maxT, LeafIntersector&& intersectLeaf) const
+	{
+		return traverse<false>(ray, minT, maxT, intersectLeaf);
+	}
+
+	/// <summary>
+	/// Checks whether anything blocks the ray between minT and maxT. occludedLeaf(firstPrim,
+	/// primCount) is called for each leaf the ray reaches, and should return true if any of
+	/// its primitives are hit. The search stops at the first leaf that returns true.
+	/// </summary>
+	template <typename LeafOccluder>
+	bool occluded(const Ray& ray, float minT, float maxT, LeafOccluder&& occludedLeaf) const
+	{
+		return traverse<true>(ray, minT, maxT, [&](int first, int count, float&) { return occludedLeaf(first, count); });
+	}
+
+private:
+	/// <summary>
+	/// Traversal shared by intersect and occluded. If AnyHit is set, it stops at the
+	/// first leaf that reports a hit.
+	/// </summary>
+	template <bool AnyHit, typename LeafIntersector>
+	bool traverse(const Ray& ray, float minT, float maxT, LeafIntersector&& intersectLeaf) const
+	{
+		if (nodes_.empty()) return false;
+
+		Eigen::Vector3f invDir = ray.direction.cwiseInverse();
+		bool dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+		int stack[MAX_STACK_DEPTH];
+		int stackSize = 0;
+		int current = 0;
+		bool hitSomething = false;
+
+		while (true) {
+			const LinearBVHNode& node = nodes_[current];
+			if (node.intersect(ray.origin, invDir, minT, maxT)) {
+				if (node.isLeaf()) {
+					if (intersectLeaf(static_cast<int>(node.offset), static_cast<int>(node.primCount), maxT)) {
+						hitSomething = true;
+						if (AnyHit) return true;
+					}
+				}
+				else {
+					// Visit the nearer child first, and come back for the other one later.
+					if (dirIsNeg[node.splitAxis]) {
+						stack[stackSize++] = current + 1;
+						current = static_cast<int>(node.offset);
+					}
+					else {
+						stack[stackSize++] = static_cast<int>(node.offset);
+						current = current + 1;
+					}
+					continue;
+				}
+			}
+			if (stackSize == 0) break;
+			current = stack[--stackSize];
+		}
+
+		return hitSomething;
+	}
+};
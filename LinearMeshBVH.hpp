@@ -0,0 +1,190 @@
+#pragma once
+#include "Renderable.hpp"
+#include "GeomUtil.hpp"
+#include "Model.hpp"
+#include "BVHHierarchy.hpp"
+#include "WorldTriangles.hpp"
+#include <vector>
+
+/// <summary>
+/// A triangle mesh accelerated by a flat BVH (binary or wide, see BVHHierarchy). This is
+/// equivalent to the mesh version of BVHNode, but the whole hierarchy is stored in one
+/// flat array of nodes and the triangle indices in one contiguous array (ordered so each
+/// leaf refers to a range of it), instead of a tree of separately allocated BVHNode and
+/// Mesh instances.
+/// The BVH is built in world space. Changing modelToWorld (or the vertices of the model,
+/// followed by a call to update()) refits the BVH to the new positions. To place the
+/// same mesh several times, build it once in model space and use Instance.
+/// If the model was loaded from a binary mesh file with a stored BVH, that BVH is used
+/// instead of building one (its method and leaf sizes are those chosen when the file was
+/// written; the branching factor and node compression still come from params).
+/// </summary>
+class LinearMeshBVH : public Renderable
+{
+private:
+	const Model* model_;
+	bool culling_;
+	BVHBuildParams params_;
+	BVHHierarchy bvh_;
+	float builtCost_; // SAH cost of the BVH when it was last built, to compare with after refitting.
+	std::vector<VertexIndices> triangles_; // Three entries per triangle, in BVH leaf order.
+	WorldTriangles worldTriangles_; // Same order as triangles_.
+
+	Eigen::Vector3f worldVert(int tri, int v) const
+	{
+		return positionToWorld(model_->vert(triangles_[3 * tri + v].vert));
+	}
+
+	/// <summary>
+	/// Builds the BVH, or uses the one stored with the model if there is one and
+	/// usePrebuilt is set.
+	/// </summary>
+	void build(bool usePrebuilt)
+	{
+		std::vector<BVHPrimitive> prims;
+		std::unique_ptr<BVHBuildNode> root;
+		if (usePrebuilt && model_->hasBVH()) {
+			root = loadModelBuildTree(*model_, Entity::modelToWorld(), prims);
+		}
+		else {
+			prims = makeMeshBuildPrimitives(*model_, Entity::modelToWorld());
+			root = BVHBuilder(params_).build(prims, makeMeshPrimitiveSplitter(*model_, Entity::modelToWorld()));
+		}
+		bvh_ = BVHHierarchy(*root, params_);
+
+		triangles_.clear();
+		triangles_.reserve(3 * prims.size());
+		for (const BVHPrimitive& prim : prims) {
+			const VertexIndices* face = model_->face(prim.index);
+			triangles_.insert(triangles_.end(), face, face + 3);
+		}
+		worldTriangles_.bake(*model_, triangles_, *this);
+		builtCost_ = bvh_.sahCost(params_);
+	}
+
+	void refit()
+	{
+		bvh_.refit([&](int first, int count) {
+			AABB aabb = AABB::empty();
+			for (int tri = first; tri < first + count; ++tri) {
+				for (int v = 0; v < 3; ++v) aabb.expand(worldVert(tri, v));
+			}
+			return aabb;
+		});
+	}
+
+public:
+	/// <param name="model">The loaded model instance to construct the mesh BVH from.</param>
+	/// <param name="shader">The shader to use when intersecting the mesh.</param>
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size, branching factor, node compression).</param>
+	/// <param name="modelToWorld">Transform taking the mesh to world space.</param>
+	/// <param name="culling">Turn on/off backface culling (same parameter as in the Mesh class).</param>
+	/// <param name="mask">Intersection mask for the mesh.</param>
+	LinearMeshBVH(const Model& model, const Shader* shader, const BVHBuildParams& params,
+		const Eigen::Matrix4f& modelToWorld, bool culling = true, IntersectMask mask = DEFAULT_BITMASK)
+		:Renderable(shader, mask), model_(&model), culling_(culling), params_(params)
+	{
+		Entity::modelToWorld(modelToWorld);
+		build(true);
+	}
+
+	/// <summary>
+	/// Builds the BVH in model space, e.g. to be shared by several Instances of the mesh.
+	/// </summary>
+	LinearMeshBVH(const Model& model, const Shader* shader, const BVHBuildParams& params,
+		bool culling = true, IntersectMask mask = DEFAULT_BITMASK)
+		:LinearMeshBVH(model, shader, params, Eigen::Matrix4f::Identity(), culling, mask)
+	{}
+
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		int closestTri = -1;
+		float closestT = maxT, closestU = 0.f, closestV = 0.f;
+
+		bool hit = bvh_.intersect(ray, minT, maxT, [&](int first, int count, float& tMax) {
+			float u, v;
+			int tri = worldTriangles_.intersectRange(ray, first, count, culling_, minT, tMax, u, v);
+			if (tri == -1) return false;
+			closestT = tMax;
+			closestTri = tri;
+			closestU = u;
+			closestV = v;
+			return true;
+		});
+
+		if (!hit) return false;
+
+		info.hitT = closestT;
+		info.object = this;
+		info.primitive = closestTri;
+		info.barycentrics = Eigen::Vector2f(closestU, closestV);
+		return true;
+	}
+
+	virtual void computeSurface(const Ray& ray, HitInfo& info) const override
+	{
+		const VertexIndices* face = &triangles_[3 * info.primitive];
+		float u = info.barycentrics.x(), v = info.barycentrics.y(), w = 1.f - (u + v);
+		info.inDirection = ray.direction;
+		info.location = ray.origin + info.hitT * ray.direction;
+		info.shader = shader();
+
+		info.normal = worldTriangles_.normal(info.primitive, u, v);
+
+		const Eigen::Vector2f& vt0 = model_->texCoord(face[0].tex);
+		const Eigen::Vector2f& vt1 = model_->texCoord(face[1].tex);
+		const Eigen::Vector2f& vt2 = model_->texCoord(face[2].tex);
+		info.texCoords = w * vt0 + u * vt1 + v * vt2;
+		info.texCoordScale = worldTriangles_.texCoordScale(info.primitive, vt0, vt1, vt2);
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		return bvh_.occluded(ray, minT, maxT, [&](int first, int count) {
+			return worldTriangles_.occludedRange(ray, first, count, culling_, minT, maxT);
+		});
+	}
+
+	virtual AABB getAABB() const override
+	{
+		return bvh_.getAABB();
+	}
+
+	virtual std::string print() const override
+	{
+		std::stringstream ss;
+		ss << "LinearMeshBVH (" << bvh_.nodeCount() << " nodes, " << triangles_.size() / 3 << " triangles)";
+		return ss.str();
+	}
+
+	/// <summary>
+	/// Updates the BVH after the vertices of the model have been changed. The bounds of the
+	/// nodes are refitted to the new vertex positions without changing the tree. If this
+	/// makes the tree too much worse than when it was built (see
+	/// BVHBuildParams::refitRebuildThreshold), it is rebuilt from scratch instead.
+	/// Returns true if the BVH was rebuilt.
+	/// </summary>
+	bool update()
+	{
+		worldTriangles_.bake(*model_, triangles_, *this);
+		refit();
+		if (bvh_.sahCost(params_) <= params_.refitRebuildThreshold * builtCost_) return false;
+		build(false);
+		return true;
+	}
+
+	using Entity::modelToWorld;
+
+	/// <summary>
+	/// Moves the mesh, updating the BVH (see update()).
+	/// </summary>
+	virtual void modelToWorld(const Eigen::Matrix4f& m) override
+	{
+		Entity::modelToWorld(m);
+		update();
+	}
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include "Renderable.hpp"
+#include "GeomUtil.hpp"
+#include "BVHHierarchy.hpp"
+#include <vector>
+
+/// <summary>
+/// A list of Renderable instances accelerated by a flat BVH (binary or wide, see
+/// BVHHierarchy). This is equivalent to the renderables version of BVHNode, but the
+/// hierarchy is a single flat array of nodes and the renderables are held in one array,
+/// ordered so each leaf refers to a range of it.
+/// As with BVHNode, the BVH is built in world space and can't be transformed afterwards,
+/// but if the renderables in it move, call update() to refit the BVH.
+/// </summary>
+class LinearRenderableBVH : public Renderable
+{
+private:
+	BVHBuildParams params_;
+	BVHHierarchy bvh_;
+	float builtCost_; // SAH cost of the BVH when it was last built, to compare with after refitting.
+	std::vector<std::shared_ptr<Renderable>> renderables_; // In BVH leaf order.
+
+	void build(const std::vector<std::shared_ptr<Renderable>>& renderables)
+	{
+		std::vector<BVHPrimitive> prims = makeRenderableBuildPrimitives(renderables);
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params_).build(prims);
+		bvh_ = BVHHierarchy(*root, params_);
+		builtCost_ = bvh_.sahCost(params_);
+
+		std::vector<std::shared_ptr<Renderable>> ordered;
+		ordered.reserve(prims.size());
+		for (const BVHPrimitive& prim : prims) {
+			ordered.push_back(renderables[prim.index]);
+		}
+		renderables_.swap(ordered);
+	}
+
+public:
+	/// <param name="renderables">The instances to add to the BVH.</param>
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size, branching factor, node compression).</param>
+	LinearRenderableBVH(const std::vector<std::shared_ptr<Renderable>>& renderables, const BVHBuildParams& params)
+		:Renderable(nullptr), params_(params)
+	{
+		build(renderables);
+	}
+
+	/// <summary>
+	/// Updates the BVH after some of the renderables have moved (e.g. their modelToWorld
+	/// was changed). The bounds of the nodes are refitted without changing the tree,
+	/// unless this makes the tree too much worse than when it was built (see
+	/// BVHBuildParams::refitRebuildThreshold), in which case it is rebuilt from scratch.
+	/// Returns true if the BVH was rebuilt.
+	/// </summary>
+	bool update()
+	{
+		bvh_.refit([&](int first, int count) {
+			AABB aabb = AABB::empty();
+			for (int r = first; r < first + count; ++r) {
+				aabb.expand(renderables_[r]->getAABB());
+			}
+			return aabb;
+		});
+		if (bvh_.sahCost(params_) <= params_.refitRebuildThreshold * builtCost_) return false;
+		build(renderables_);
+		return true;
+	}
+
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		return bvh_.intersect(ray, minT, maxT, [&](int first, int count, float& tMax) {
+			bool leafHit = false;
+			for (int r = first; r < first + count; ++r) {
+				if (renderables_[r]->closestHit(ray, minT, tMax, info, mask)) {
+					tMax = info.hitT;
+					leafHit = true;
+				}
+			}
+			return leafHit;
+		});
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		return bvh_.occluded(ray, minT, maxT, [&](int first, int count) {
+			for (int r = first; r < first + count; ++r) {
+				if (renderables_[r]->occluded(ray, minT, maxT, mask)) return true;
+			}
+			return false;
+		});
+	}
+
+	virtual AABB getAABB() const override
+	{
+		return bvh_.getAABB();
+	}
+
+	virtual std::string print() const override
+	{
+		std::stringstream ss;
+		ss << "LinearRenderableBVH (" << bvh_.nodeCount() << " nodes, " << renderables_.size() << " renderables)";
+		return ss.str();
+	}
+
+	virtual void modelToWorld(const Eigen::Matrix4f&) override
+	{
+		throw(std::runtime_error("Can't transform a BVH node."));
+	}
+};
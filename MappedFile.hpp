@@ -0,0 +1,99 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// A whole file mapped into memory. Pages are only read from disk when they are first
+/// touched, so opening even a very large file is quick. The mapping is copy-on-write:
+/// the contents can be modified in memory, but changes are never written back to the file.
+/// </summary>
+class MappedFile
+{
+private:
+	void* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE, mapping_ = nullptr;
+#endif
+
+public:
+	explicit MappedFile(const std::string& filename)
+	{
+#ifdef _WIN32
+		file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE) throw std::runtime_error("Couldn't open file " + filename + "!");
+		LARGE_INTEGER size;
+		GetFileSizeEx(file_, &size);
+		size_ = static_cast<size_t>(size.QuadPart);
+		if (size_ > 0) {
+			mapping_ = CreateFileMappingA(file_, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			if (mapping_) data_ = MapViewOfFile(mapping_, FILE_MAP_COPY, 0, 0, 0);
+			if (!data_) {
+				close();
+				throw std::runtime_error("Couldn't map file " + filename + " into memory!");
+			}
+		}
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("Couldn't open file " + filename + "!");
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			throw std::runtime_error("Couldn't read the size of file " + filename + "!");
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		if (size_ > 0) {
+			data_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (data_ == MAP_FAILED) data_ = nullptr;
+		}
+		// The mapping stays valid after the file is closed.
+		::close(fd);
+		if (size_ > 0 && !data_) throw std::runtime_error("Couldn't map file " + filename + " into memory!");
+#endif
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	void* data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+	void close()
+	{
+#ifdef _WIN32
+		if (data_) UnmapViewOfFile(data_);
+		if (mapping_) CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+		mapping_ = nullptr;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_) munmap(data_, size_);
+#endif
+		data_ = nullptr;
+	}
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+/// <summary>
+/// Layout of the binary mesh files written by Model::save (e.g. with the meshconvert tool).
+/// The file starts with a MeshFileHeader. Each array follows in its own section, laid out
+/// exactly as Model uses it in memory, so Model can map the file and use the data in place
+/// instead of parsing it. Sections start at multiples of MESH_FILE_ALIGNMENT bytes.
+/// Numbers are stored in the byte order of the machine that wrote the file, and files with
+/// a different byte order are rejected.
+/// </summary>
+const char MESH_FILE_MAGIC[8] = { 'R', 'T', 'M', 'E', 'S', 'H', '\r', '\n' };
+const uint32_t MESH_FILE_VERSION = 1;
+const uint32_t MESH_FILE_BYTE_ORDER = 0x01020304;
+const uint64_t MESH_FILE_ALIGNMENT = 64;
+
+/// <summary>
+/// Position of an array in the file, and its number of elements.
+/// </summary>
+struct MeshFileSection
+{
+	uint64_t offset, count;
+};
+
+struct MeshFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	MeshFileSection verts; // Eigen::Vector3f
+	MeshFileSection normals; // Eigen::Vector3f
+	MeshFileSection texCoords; // Eigen::Vector2f
+	MeshFileSection indices; // VertexIndices, three per triangle
+	MeshFileSection bvhNodes; // MeshFileBVHNode (optional)
+	MeshFileSection bvhPrimitives; // int32_t triangle indices in BVH leaf order (optional)
+};
+
+/// <summary>
+/// A node of a BVH built over the model's triangles, stored so it doesn't have to be built
+/// again when the model is loaded. These are the nodes of the binary tree from BVHBuilder,
+/// in depth-first order, so the first child of an interior node is the next node. Leaves
+/// refer to ranges of the bvhPrimitives section. Only the structure of the tree is used
+/// when loading it (see loadModelBuildTree): the bounds are recomputed for the transform
+/// the mesh is placed with, so the tree may have been built for any transform.
+/// </summary>
+struct MeshFileBVHNode
+{
+	float boundsMin[3], boundsMax[3];
+	int32_t splitAxis;
+	int32_t primOffset, primCount; // Leaves only.
+	int32_t secondChild; // Index of the second child, or -1 for a leaf.
+};
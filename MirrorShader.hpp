@@ -21,6 +21,9 @@ public:
 		Ray reflectionRay;
 		reflectionRay.direction = reflect(hitInfo.inDirection, hitInfo.normal);
 		reflectionRay.origin = hitInfo.location + 1e-4f * hitInfo.normal;
+		// A flat mirror reflects the cone without changing how quickly it spreads.
+		reflectionRay.coneWidth = hitInfo.coneWidth;
+		reflectionRay.coneSpread = hitInfo.coneSpread;
 
 		Eigen::Vector3f color = Eigen::Vector3f::Zero();
 
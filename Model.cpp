@@ -1,85 +1,368 @@
 #include <iostream>
 #include <string>
 #include <fstream>
-#include <sstream>
 #include <vector>
+#include <cstring>
+#include <charconv>
+#include <string_view>
+#include <algorithm>
 #include "Model.hpp"
 
-Model::Model(const char *filename) : verts_(), faces_(), vts_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) throw std::runtime_error("Couldn't open input model file!");
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {       // read 2 characters and check the line starts with "v"
-            iss >> trash;
+static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float), "Mesh file vertices must be tightly packed");
+static_assert(sizeof(Eigen::Vector2f) == 2 * sizeof(float), "Mesh file texture coordinates must be tightly packed");
+static_assert(sizeof(VertexIndices) == 3 * sizeof(int32_t), "Mesh file indices must be tightly packed");
+
+Model::Model(const char *filename) {
+    char magic[sizeof(MESH_FILE_MAGIC)] = {};
+    {
+        std::ifstream in(filename, std::ifstream::binary);
+        if (in.fail()) throw std::runtime_error("Couldn't open input model file!");
+        in.read(magic, sizeof(magic));
+    }
+    if (memcmp(magic, MESH_FILE_MAGIC, sizeof(magic)) == 0) loadMeshFile(filename);
+    else loadObj(filename);
+    std::cerr << "# v# " << nverts() << " f# "  << nfaces() << std::endl;
+}
+
+// Obj files are parsed in parallel, in chunks of whole lines. Each chunk is parsed into its
+// own arrays, which are then copied into the model's storage in order.
+static const size_t OBJ_CHUNK_BYTES = 1 << 20;
+
+struct ObjChunk {
+    const char *begin, *end;
+    std::vector<Eigen::Vector3f> verts, vns;
+    std::vector<Eigen::Vector2f> vts;
+    std::vector<VertexIndices> faces;
+    // Components of faces (as 3 * entry + 0 for vert, 1 for tex, 2 for norm) holding
+    // negative indices, which count back from the last element defined. These are stored
+    // relative to the start of the chunk, until the number of elements in earlier chunks is
+    // known. Also the components that weren't given at all.
+    std::vector<int> relative, missing;
+    bool failed = false;
+};
+
+// One corner of a face as written in the file.
+struct ObjCorner {
+    int index[3]; // vert, tex, norm
+    bool relative[3], missing[3];
+};
+
+static const char *skipSpaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    return p;
+}
+
+static const char *parseFloat(const char *p, const char *end, float& value) {
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+') ++p; // from_chars doesn't accept a leading '+'
+    std::from_chars_result result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Parses an index, converting it to start at zero. count is the number of elements defined
+// so far in this chunk, which negative indices count back from.
+static const char *parseIndex(const char *p, const char *end, int count, int& index, bool& relative) {
+    if (p < end && *p == '+') ++p;
+    std::from_chars_result result = std::from_chars(p, end, index);
+    if (result.ec != std::errc() || index == 0) return nullptr;
+    relative = index < 0;
+    index += relative ? count : -1;
+    return result.ptr;
+}
+
+// Parses the corners of "f v1 v2 v3 ...", where each corner is v, v/vt, v//vn or v/vt/vn,
+// and splits the polygon into a fan of triangles.
+static bool parseFace(const char *p, const char *end, ObjChunk& chunk, std::vector<ObjCorner>& polygon) {
+    const int counts[3] = { (int)chunk.verts.size(), (int)chunk.vts.size(), (int)chunk.vns.size() };
+    polygon.clear();
+    while ((p = skipSpaces(p, end)) < end) {
+        ObjCorner corner = {};
+        for (int c = 0; c < 3; ++c) {
+            if (c > 0) {
+                if (p == end || *p != '/') {
+                    corner.missing[c] = true;
+                    continue;
+                }
+                ++p;
+                if (c == 1 && p < end && *p == '/') { // v//vn
+                    corner.missing[c] = true;
+                    continue;
+                }
+            }
+            if (!(p = parseIndex(p, end, counts[c], corner.index[c], corner.relative[c]))) return false;
+        }
+        if (p < end && *p != ' ' && *p != '\t' && *p != '\r') return false;
+        polygon.push_back(corner);
+    }
+    if (polygon.size() < 3) return false;
+
+    for (size_t i = 2; i < polygon.size(); ++i) { // split polygons into a fan of triangles
+        for (const ObjCorner* corner : { &polygon[0], &polygon[i - 1], &polygon[i] }) {
+            int entry = (int)chunk.faces.size();
+            chunk.faces.push_back({ corner->index[0], corner->index[1], corner->index[2] });
+            for (int c = 0; c < 3; ++c) {
+                if (corner->relative[c]) chunk.relative.push_back(3 * entry + c);
+                if (corner->missing[c]) chunk.missing.push_back(3 * entry + c);
+            }
+        }
+    }
+    return true;
+}
+
+static void parseObjChunk(ObjChunk& chunk) {
+    std::vector<ObjCorner> polygon;
+    const char *line = chunk.begin;
+    while (line < chunk.end && !chunk.failed) {
+        const char *end = static_cast<const char*>(memchr(line, '\n', chunk.end - line));
+        if (!end) end = chunk.end;
+        const char *p = skipSpaces(line, end);
+        line = end + 1;
+        if (p == end || *p == '#') continue;
+
+        const char *keyword = p;
+        while (p < end && *p != ' ' && *p != '\t') ++p;
+        std::string_view key(keyword, p - keyword);
+        if (key == "v") {
             Eigen::Vector3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
+            for (int i = 0; i < 3 && p; ++i) p = parseFloat(p, end, v[i]);
+            if (p) chunk.verts.push_back(v);
+            else chunk.failed = true;
         }
-        else if (!line.compare(0, 3, "vt ")) { // read 3 characters and check the line starts with "vt "
-            iss >> trash;
-            iss >> trash;
-            Eigen::Vector2f vt;
-            for (int i=0; i<2; i++) iss >> vt[i]; 
-            vts_.push_back(vt);
+        else if (key == "vt") {
+            Eigen::Vector2f vt(0.f, 0.f); // v is optional
+            p = parseFloat(p, end, vt[0]);
+            if (p && skipSpaces(p, end) < end) p = parseFloat(p, end, vt[1]);
+            if (p) chunk.vts.push_back(vt);
+            else chunk.failed = true;
         }
-        if (!line.compare(0, 3, "vn ")) {       // read 2 characters and check the line starts with "v"
-            iss >> trash;
-            iss >> trash;
+        else if (key == "vn") {
             Eigen::Vector3f vn;
-            for (int i=0;i<3;i++) iss >> vn[i];
-            vns_.push_back(vn);
+            for (int i = 0; i < 3 && p; ++i) p = parseFloat(p, end, vn[i]);
+            if (p) chunk.vns.push_back(vn);
+            else chunk.failed = true;
         }
-        else if (!line.compare(0, 2, "f ")) { // f v1/vt1/vn1 v2/vt2/vn2 v3/vt3/vn3 ... making assumption v1==vt1 etc.
-            std::vector<VertexIndices> f;
-            VertexIndices idx;
-            int itrash;
-            iss >> trash;
-            while (iss >> idx.vert >> trash >> idx.tex >> trash >> idx.norm) { // read in v_i to idx and discard /vt_i/vn_i
-                idx.vert--; // in wavefront obj all indices start at 1, not zero, we need them to start at zero
-                idx.tex--;
-                idx.norm--;
-
-                f.push_back(idx);
-            }
-            faces_.push_back(f);
+        else if (key == "f") {
+            if (!parseFace(p, end, chunk, polygon)) chunk.failed = true;
+        }
+        // Anything else (groups, materials, lines, ...) is ignored.
+    }
+}
+
+void Model::loadObj(const char *filename) {
+    MappedFile file(filename);
+    const char *data = static_cast<const char*>(file.data()), *dataEnd = data + file.size();
+
+    // Split the file into chunks, ending each just after a newline.
+    std::vector<ObjChunk> chunks;
+    for (const char *begin = data; begin < dataEnd; ) {
+        const char *end = begin + std::min<size_t>(OBJ_CHUNK_BYTES, dataEnd - begin);
+        const char *newline = static_cast<const char*>(memchr(end, '\n', dataEnd - end));
+        end = newline ? newline + 1 : dataEnd;
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+
+    int nChunks = (int)chunks.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < nChunks; ++c) {
+        parseObjChunk(chunks[c]);
+    }
+
+    // Work out where each chunk goes in the merged arrays.
+    std::vector<size_t> vertBase(nChunks + 1, 0), vtBase(nChunks + 1, 0), vnBase(nChunks + 1, 0), faceBase(nChunks + 1, 0);
+    bool missingTex = false, missingNorm = false;
+    for (int c = 0; c < nChunks; ++c) {
+        const ObjChunk& chunk = chunks[c];
+        if (chunk.failed) throw std::runtime_error("Couldn't parse obj file " + std::string(filename) + "!");
+        vertBase[c + 1] = vertBase[c] + chunk.verts.size();
+        vtBase[c + 1] = vtBase[c] + chunk.vts.size();
+        vnBase[c + 1] = vnBase[c] + chunk.vns.size();
+        faceBase[c + 1] = faceBase[c] + chunk.faces.size();
+        for (int component : chunk.missing) {
+            missingTex |= component % 3 == 1;
+            missingNorm |= component % 3 == 2;
+        }
+    }
+    if (vertBase[nChunks] > INT32_MAX || faceBase[nChunks] > INT32_MAX) {
+        throw std::runtime_error("Obj file " + std::string(filename) + " is too large!");
+    }
+    // Corners without texture coordinates get a texture coordinate of (0, 0), added at the
+    // end. If any corner is missing a normal, the normals aren't used at all.
+    int defaultTex = (int)vtBase[nChunks];
+    vertStorage_.resize(vertBase[nChunks]);
+    vtStorage_.resize(vtBase[nChunks] + (missingTex ? 1 : 0), Eigen::Vector2f::Zero());
+    vnStorage_.resize(missingNorm ? 0 : vnBase[nChunks]);
+    faceStorage_.resize(faceBase[nChunks]);
+    const int counts[3] = { (int)vertStorage_.size(), (int)vtStorage_.size(), (int)vnStorage_.size() };
+
+    bool badIndex = false;
+    #pragma omp parallel for schedule(dynamic) reduction(||:badIndex)
+    for (int c = 0; c < nChunks; ++c) {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.verts.begin(), chunk.verts.end(), vertStorage_.begin() + vertBase[c]);
+        std::copy(chunk.vts.begin(), chunk.vts.end(), vtStorage_.begin() + vtBase[c]);
+        if (!missingNorm) std::copy(chunk.vns.begin(), chunk.vns.end(), vnStorage_.begin() + vnBase[c]);
+
+        int* indices = chunk.faces.empty() ? nullptr : &chunk.faces[0].vert;
+        const int base[3] = { (int)vertBase[c], (int)vtBase[c], (int)vnBase[c] };
+        for (int component : chunk.relative) indices[component] += base[component % 3];
+        for (int component : chunk.missing) indices[component] = component % 3 == 1 ? defaultTex : -1;
+        for (size_t i = 0; i < chunk.faces.size(); ++i) {
+            const VertexIndices& idx = chunk.faces[i];
+            badIndex = badIndex || idx.vert < 0 || idx.vert >= counts[0] || idx.tex < 0 || idx.tex >= counts[1] ||
+                (!missingNorm && (idx.norm < 0 || idx.norm >= counts[2]));
+        }
+        std::copy(chunk.faces.begin(), chunk.faces.end(), faceStorage_.begin() + faceBase[c]);
+    }
+    if (badIndex) throw std::runtime_error("Obj file " + std::string(filename) + " refers to vertices that don't exist!");
+
+    verts_ = vertStorage_.data();
+    vns_ = vnStorage_.data();
+    vts_ = vtStorage_.data();
+    faces_ = faceStorage_.data();
+    nverts_ = (int)vertStorage_.size();
+    nvns_ = (int)vnStorage_.size();
+    nvts_ = (int)vtStorage_.size();
+    nindices_ = (int)faceStorage_.size();
+}
+
+void Model::loadMeshFile(const char *filename) {
+    file_ = std::make_unique<MappedFile>(filename);
+    char* data = static_cast<char*>(file_->data());
+    if (file_->size() < sizeof(MeshFileHeader)) throw std::runtime_error("Mesh file is truncated!");
+    const MeshFileHeader& header = *reinterpret_cast<const MeshFileHeader*>(data);
+    if (header.byteOrder != MESH_FILE_BYTE_ORDER) throw std::runtime_error("Mesh file was written with a different byte order!");
+    if (header.version != MESH_FILE_VERSION) throw std::runtime_error("Unsupported mesh file version!");
+
+    // Sections are checked against the file size, and the face indices against the number of
+    // vertices, texture coordinates and normals. The rest of the contents are used as they are,
+    // so loading doesn't have to read the whole file.
+    auto section = [&](const MeshFileSection& s, size_t elementSize, int& count) {
+        if (s.offset % MESH_FILE_ALIGNMENT != 0 || s.offset > file_->size() ||
+            s.count > (file_->size() - s.offset) / elementSize || s.count > INT32_MAX) {
+            throw std::runtime_error("Mesh file is truncated or corrupt!");
         }
+        count = (int)s.count;
+        return data + s.offset;
+    };
+    verts_ = reinterpret_cast<Eigen::Vector3f*>(section(header.verts, sizeof(Eigen::Vector3f), nverts_));
+    vns_ = reinterpret_cast<const Eigen::Vector3f*>(section(header.normals, sizeof(Eigen::Vector3f), nvns_));
+    vts_ = reinterpret_cast<const Eigen::Vector2f*>(section(header.texCoords, sizeof(Eigen::Vector2f), nvts_));
+    faces_ = reinterpret_cast<const VertexIndices*>(section(header.indices, sizeof(VertexIndices), nindices_));
+    bvhNodes_ = reinterpret_cast<const MeshFileBVHNode*>(section(header.bvhNodes, sizeof(MeshFileBVHNode), nbvhNodes_));
+    bvhPrims_ = reinterpret_cast<const int32_t*>(section(header.bvhPrimitives, sizeof(int32_t), nbvhPrims_));
+    if (nindices_ % 3 != 0) throw std::runtime_error("Mesh file is truncated or corrupt!");
+
+    // As for obj files, normal indices are only used if the model has normals.
+    bool badIndex = false;
+    #pragma omp parallel for reduction(||:badIndex)
+    for (int i = 0; i < nindices_; ++i) {
+        const VertexIndices& idx = faces_[i];
+        badIndex = badIndex || idx.vert < 0 || idx.vert >= nverts_ || idx.tex < 0 || idx.tex >= nvts_ ||
+            (nvns_ > 0 && (idx.norm < 0 || idx.norm >= nvns_));
+    }
+    if (badIndex) throw std::runtime_error("Mesh file " + std::string(filename) + " refers to vertices that don't exist!");
+}
+
+void Model::save(const char *filename,
+    const std::vector<MeshFileBVHNode>& bvhNodes, const std::vector<int32_t>& bvhPrimitives) const {
+    MeshFileHeader header = {};
+    memcpy(header.magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC));
+    header.version = MESH_FILE_VERSION;
+    header.byteOrder = MESH_FILE_BYTE_ORDER;
+
+    struct Section { MeshFileSection* entry; const void* data; size_t bytes; };
+    const Section sections[] = {
+        { &header.verts, verts_, nverts_ * sizeof(Eigen::Vector3f) },
+        { &header.normals, vns_, nvns_ * sizeof(Eigen::Vector3f) },
+        { &header.texCoords, vts_, nvts_ * sizeof(Eigen::Vector2f) },
+        { &header.indices, faces_, nindices_ * sizeof(VertexIndices) },
+        { &header.bvhNodes, bvhNodes.data(), bvhNodes.size() * sizeof(MeshFileBVHNode) },
+        { &header.bvhPrimitives, bvhPrimitives.data(), bvhPrimitives.size() * sizeof(int32_t) },
+    };
+    header.verts.count = nverts_;
+    header.normals.count = nvns_;
+    header.texCoords.count = nvts_;
+    header.indices.count = nindices_;
+    header.bvhNodes.count = bvhNodes.size();
+    header.bvhPrimitives.count = bvhPrimitives.size();
+
+    auto align = [](uint64_t offset) {
+        return (offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT * MESH_FILE_ALIGNMENT;
+    };
+    uint64_t offset = align(sizeof(MeshFileHeader));
+    for (const Section& s : sections) {
+        s.entry->offset = offset;
+        offset = align(offset + s.bytes);
+    }
+
+    std::ofstream out(filename, std::ofstream::binary);
+    if (out.fail()) throw std::runtime_error("Couldn't open output mesh file!");
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const char padding[MESH_FILE_ALIGNMENT] = {};
+    uint64_t written = sizeof(header);
+    for (const Section& s : sections) {
+        out.write(padding, s.entry->offset - written);
+        out.write(static_cast<const char*>(s.data), s.bytes);
+        written = s.entry->offset + s.bytes;
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << std::endl;
+    if (out.fail()) throw std::runtime_error("Couldn't write output mesh file!");
 }
 
 Model::~Model() {
 }
 
 int Model::nverts() const {
-    return (int)verts_.size();
+    return nverts_;
 }
 
 int Model::nfaces() const {
-    return (int)faces_.size();
+    return nindices_ / 3;
 }
 
 bool Model::hasNormals() const {
-    return vns_.size() > 0;
+    return nvns_ > 0;
+}
+
+bool Model::hasBVH() const {
+    return nbvhNodes_ > 0;
+}
+
+const MeshFileBVHNode* Model::bvhNodes() const {
+    return bvhNodes_;
 }
 
-std::vector<VertexIndices> Model::face(int idx) const {
-    return faces_[idx];
+int Model::nbvhNodes() const {
+    return nbvhNodes_;
 }
 
-Eigen::Vector3f Model::vert(int i) const {
+const int32_t* Model::bvhPrimitives() const {
+    return bvhPrims_;
+}
+
+int Model::nbvhPrimitives() const {
+    return nbvhPrims_;
+}
+
+const VertexIndices* Model::face(int idx) const {
+    return &faces_[3 * idx];
+}
+
+const Eigen::Vector3f& Model::vert(int i) const {
     return verts_[i];
 }
 
-Eigen::Vector2f Model::texCoord(int i) const {
+void Model::setVert(int i, const Eigen::Vector3f& v) {
+    verts_[i] = v;
+}
+
+const Eigen::Vector2f& Model::texCoord(int i) const {
     return vts_[i];
 }
 
-Eigen::Vector3f Model::normal(int i) const {
+const Eigen::Vector3f& Model::normal(int i) const {
     return vns_[i];
 }
 
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <Eigen/Dense>
+#include "MappedFile.hpp"
+#include "MeshFile.hpp"
 
 struct VertexIndices
 {
@@ -10,22 +13,60 @@ struct VertexIndices
 
 
 /// <summary>
-/// A Model stores mesh data and can load this data from an obj file.
+/// A Model stores mesh data and can load this data from an obj file, or from a binary mesh
+/// file written by save() (see MeshFile.hpp), which is detected from its first few bytes.
+/// A binary mesh file is mapped into memory and used in place rather than being parsed,
+/// and may also hold a prebuilt BVH over the model's triangles (see hasBVH()).
+/// Faces are stored as triangles in one flat index buffer, three entries per triangle
+/// (polygons with more sides are split into a fan of triangles when loading).
+/// The accessors return references into the model's own storage, so nothing is copied.
 /// </summary>
 class Model {
 private:
-	std::vector<Eigen::Vector3f> verts_, vns_; // Vertices and vertex normals
-	std::vector<Eigen::Vector2f> vts_; // Texture coordinates
-	std::vector<std::vector<VertexIndices>> faces_;  // Face indices of the vertices
+	// Storage for data parsed from an obj file.
+	std::vector<Eigen::Vector3f> vertStorage_, vnStorage_;
+	std::vector<Eigen::Vector2f> vtStorage_;
+	std::vector<VertexIndices> faceStorage_;
+	// Or the binary mesh file the data is used from.
+	std::unique_ptr<MappedFile> file_;
+
+	Eigen::Vector3f* verts_ = nullptr; // Vertices
+	const Eigen::Vector3f* vns_ = nullptr; // Vertex normals
+	const Eigen::Vector2f* vts_ = nullptr; // Texture coordinates
+	const VertexIndices* faces_ = nullptr; // Indices of the vertices of each triangle, three per triangle
+	const MeshFileBVHNode* bvhNodes_ = nullptr;
+	const int32_t* bvhPrims_ = nullptr;
+	int nverts_ = 0, nvns_ = 0, nvts_ = 0, nindices_ = 0, nbvhNodes_ = 0, nbvhPrims_ = 0;
+
+	void loadObj(const char* filename);
+	void loadMeshFile(const char* filename);
 public:
 	Model(const char *filename);
 	~Model();
+	// The accessors point into the model's own storage, so models can't be copied.
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
 	int nverts() const;
-	int nfaces() const;
-	Eigen::Vector3f vert(int i) const;
-	Eigen::Vector2f texCoord(int i) const;
-	Eigen::Vector3f normal(int i) const;
-	std::vector<VertexIndices> face(int idx) const;
+	int nfaces() const; // Number of triangles.
+	const Eigen::Vector3f& vert(int i) const;
+	void setVert(int i, const Eigen::Vector3f& v);
+	const Eigen::Vector2f& texCoord(int i) const;
+	const Eigen::Vector3f& normal(int i) const;
+	const VertexIndices* face(int idx) const; // The three vertex indices of triangle idx.
 	bool hasNormals() const;
+
+	// A BVH over the triangles, if one was stored in the binary mesh file (see MeshFileBVHNode).
+	bool hasBVH() const;
+	const MeshFileBVHNode* bvhNodes() const; // nbvhNodes() nodes, root first.
+	int nbvhNodes() const;
+	const int32_t* bvhPrimitives() const; // Triangle indices in the order the BVH leaves refer to.
+	int nbvhPrimitives() const;
+
+	/// <summary>
+	/// Write the model to a binary mesh file, optionally with a prebuilt BVH over its
+	/// triangles (see flattenBuildTree in BVHBuilder.hpp).
+	/// </summary>
+	void save(const char* filename,
+		const std::vector<MeshFileBVHNode>& bvhNodes = {}, const std::vector<int32_t>& bvhPrimitives = {}) const;
 };
 
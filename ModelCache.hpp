@@ -0,0 +1,159 @@
+#pragma once
+#include "Model.hpp"
+#include "MappedFile.hpp"
+#include "MeshFile.hpp"
+#include "BVHBuilder.hpp"
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+
+/// <summary>
+/// A directory of binary mesh files (see MeshFile.hpp), each holding a parsed model and a
+/// BVH built over it. load() looks for a cached file first, so a model that has been
+/// loaded before with the same build parameters and transform isn't parsed or built
+/// again; the cached file is just mapped into memory.
+/// Cache files are named after a hash of everything that affects their contents: the
+/// contents of the source file, the BVH build parameters and the transform. Changing any
+/// of these gives a new cache file rather than overwriting the old one, so the directory
+/// can be deleted at any time to clear it.
+/// </summary>
+class ModelCache
+{
+private:
+	std::filesystem::path directory_;
+
+	/// <summary>
+	/// 64-bit hash of a block of memory. This isn't cryptographic, just fast enough that
+	/// hashing a model is much quicker than parsing it.
+	/// </summary>
+	static uint64_t hash(const void* data, size_t size, uint64_t seed)
+	{
+		const uint64_t PRIME1 = 0x9E3779B185EBCA87ull, PRIME2 = 0xC2B2AE3D27D4EB4Full;
+		auto mix = [&](uint64_t h, uint64_t word) {
+			h ^= word * PRIME2;
+			h = (h << 31) | (h >> 33);
+			return h * PRIME1;
+		};
+		// Four independent lanes, so the multiplies don't all wait on each other.
+		uint64_t lanes[4] = { seed + PRIME1, seed + PRIME2, seed, seed - PRIME1 };
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			for (int l = 0; l < 4; ++l) {
+				uint64_t word;
+				memcpy(&word, bytes + i + 8 * l, 8);
+				lanes[l] = mix(lanes[l], word);
+			}
+		}
+		uint64_t h = size;
+		for (int l = 0; l < 4; ++l) h = mix(h, lanes[l]);
+		for (; i < size; ++i) h = mix(h, bytes[i]);
+		// Final avalanche, so similar inputs give very different hashes.
+		h ^= h >> 33;
+		h *= PRIME2;
+		h ^= h >> 29;
+		return h;
+	}
+
+	template<typename T>
+	static uint64_t hashValue(const T& value, uint64_t seed)
+	{
+		return hash(&value, sizeof(T), seed);
+	}
+
+	/// <summary>
+	/// Hashes the parameters that change the tree BVHBuilder builds. The branching factor,
+	/// node compression and refit threshold are applied when the mesh is loaded, so
+	/// they don't need their own cache files.
+	/// </summary>
+	static uint64_t hashBuildParams(const BVHBuildParams& params, uint64_t seed)
+	{
+		uint64_t h = hashValue(params.method, seed);
+		h = hashValue(params.sahBinCount, h);
+		h = hashValue(params.traversalCost, h);
+		h = hashValue(params.intersectionCost, h);
+		h = hashValue(params.maxLeafSize, h);
+		h = hashValue(params.maxDepth, h);
+		h = hashValue(params.spatialSplitAlpha, h);
+		h = hashValue(params.maxSpatialSplitDuplication, h);
+		h = hashValue(params.mortonBits, h);
+		return h;
+	}
+
+public:
+	/// <summary>
+	/// Identifies the BVH build parameters that change the tree load() stores: models loaded
+	/// with parameters that have the same key share a cache file.
+	/// </summary>
+	static uint64_t buildParamsKey(const BVHBuildParams& params)
+	{
+		return hashBuildParams(params, 0);
+	}
+
+	/// <param name="directory">Directory to keep cache files in. It is created when
+	/// something is first added to the cache.</param>
+	explicit ModelCache(const std::string& directory)
+		:directory_(directory)
+	{}
+
+	/// <summary>
+	/// Loads a model (an obj or binary mesh file), together with a BVH built with the given
+	/// parameters for the mesh placed with modelToWorld. The BVH is used by LinearMeshBVH
+	/// and BVHNode when they're constructed with the same transform (see Model::hasBVH).
+	/// </summary>
+	std::unique_ptr<Model> load(const std::string& filename, const BVHBuildParams& params,
+		const Eigen::Matrix4f& modelToWorld = Eigen::Matrix4f::Identity())
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t key;
+		{
+			MappedFile source(filename);
+			key = hash(source.data(), source.size(), MESH_FILE_VERSION);
+		}
+		key = hashBuildParams(params, key);
+		key = hash(modelToWorld.data(), 16 * sizeof(float), key);
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.rtmesh", static_cast<unsigned long long>(key));
+		std::filesystem::path cached = directory_ / name;
+		if (std::filesystem::exists(cached)) {
+			// A damaged cache file is deleted and built again, rather than failing the load.
+			try {
+				std::unique_ptr<Model> model = std::make_unique<Model>(cached.string().c_str());
+				if (model->hasBVH()) {
+					std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+					std::cout << "Loaded " << filename << " from cache in " << elapsed.count() << " ms." << std::endl;
+					return model;
+				}
+			}
+			catch (const std::runtime_error& e) {
+				std::cerr << "Warning: model cache file " << cached.string() << " can't be used (" << e.what() << "), rebuilding it." << std::endl;
+				std::filesystem::remove(cached);
+			}
+		}
+
+		// Not cached yet (or the cache file is damaged or missing its BVH): parse and build as
+		// normal, then write the result. It is written under a temporary name and renamed, so
+		// a partly written file is never picked up.
+		Model model(filename.c_str());
+		std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(model, modelToWorld);
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params).build(prims, makeMeshPrimitiveSplitter(model, modelToWorld));
+		std::vector<MeshFileBVHNode> nodes;
+		std::vector<int32_t> primitives;
+		flattenBuildTree(*root, prims, nodes, primitives);
+
+		std::filesystem::create_directories(directory_);
+		std::filesystem::path temp = cached;
+		temp += ".tmp";
+		model.save(temp.string().c_str(), nodes, primitives);
+		std::filesystem::rename(temp, cached);
+		std::cout << "Added " << filename << " to the model cache as " << cached.string() << "." << std::endl;
+		return std::make_unique<Model>(cached.string().c_str());
+	}
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include "ImageWriter.hpp"
+#include <string>
+
+/// <summary>
+/// Writes images as Portable Float Maps: a short text header followed by the raw floats,
+/// with rows from the bottom up. Values are stored without any clamping.
+/// </summary>
+class PFMWriter : public ImageWriter
+{
+private:
+	std::vector<unsigned char> band_;
+
+public:
+	virtual bool topDown() const override
+	{
+		return false;
+	}
+
+protected:
+	virtual void writeHeader() override
+	{
+		// A negative scale means the floats are little-endian.
+		std::vector<unsigned char> header;
+		append(header, ("PF\n" + std::to_string(width_) + " " + std::to_string(height_) + "\n-1.0\n").c_str());
+		writeBuffer(header);
+		band_.resize(ROWS_PER_BAND * 12 * size_t(width_));
+	}
+
+	virtual void writeBand(const Framebuffer& rows, int fileRow, int count) override
+	{
+		size_t rowBytes = 12 * size_t(width_);
+		#pragma omp parallel for
+		for (int r = 0; r < count; ++r) {
+			copyFloatsLE(rows.row(imageRow(fileRow + r)), 3 * width_, &band_[r * rowBytes]);
+		}
+		writeBuffer(band_, count * rowBytes);
+	}
+};
@@ -0,0 +1,156 @@
+#pragma once
+#include "ImageWriter.hpp"
+#include <string>
+#include <array>
+
+/// <summary>
+/// Writes images as 24-bit PNG files, clamped to 8 bits per channel (see
+/// Framebuffer::quantiseRow). To keep writing fast and free of dependencies, the image
+/// data isn't compressed: it is stored in uncompressed deflate blocks, which every PNG
+/// reader supports. Each band of rows goes in its own IDAT chunk. PNG stores rows from
+/// the top down.
+/// </summary>
+class PNGWriter : public ImageWriter
+{
+private:
+	static constexpr size_t MAX_STORED_BLOCK = 65535; // Largest uncompressed deflate block
+
+	static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+	{
+		static const std::array<uint32_t, 256> table = [] {
+			std::array<uint32_t, 256> t;
+			for (uint32_t n = 0; n < 256; ++n) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				t[n] = c;
+			}
+			return t;
+		}();
+		crc = ~crc;
+		for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	/// <summary>
+	/// Running Adler-32 checksum of the uncompressed data, which ends the zlib stream.
+	/// </summary>
+	struct Adler32
+	{
+		uint32_t a = 1, b = 0;
+
+		void update(const unsigned char* data, size_t size)
+		{
+			// 5552 is the most bytes that can be summed before b could overflow.
+			while (size > 0) {
+				size_t n = std::min<size_t>(size, 5552);
+				for (size_t i = 0; i < n; ++i) {
+					a += data[i];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+				data += n;
+				size -= n;
+			}
+		}
+
+		uint32_t value() const
+		{
+			return (b << 16) | a;
+		}
+	};
+
+	std::vector<unsigned char> band_, idat_;
+	int bandRows_ = 0; // Rows held in band_, waiting to be written
+	Adler32 adler_;
+
+	void writeChunk(const char* type, const std::vector<unsigned char>& data)
+	{
+		std::vector<unsigned char> chunk;
+		appendBE(chunk, (uint32_t)data.size());
+		append(chunk, type);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		appendBE(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+		writeBuffer(chunk);
+	}
+
+	size_t rowBytes() const
+	{
+		return 1 + 3 * size_t(width_); // Each row starts with its filter type (0, none).
+	}
+
+	/// <summary>
+	/// Writes the rows held in band_ as an IDAT chunk of stored deflate blocks.
+	/// </summary>
+	void writeIDAT(bool lastBand)
+	{
+		size_t size = bandRows_ * rowBytes();
+		adler_.update(band_.data(), size);
+		for (size_t offset = 0; offset < size; offset += MAX_STORED_BLOCK) {
+			size_t blockSize = std::min(MAX_STORED_BLOCK, size - offset);
+			bool last = lastBand && offset + blockSize == size;
+			idat_.push_back(last ? 1 : 0); // Final block flag, stored block type
+			appendLE<uint16_t>(idat_, (uint16_t)blockSize);
+			appendLE<uint16_t>(idat_, (uint16_t)~blockSize);
+			idat_.insert(idat_.end(), band_.begin() + offset, band_.begin() + offset + blockSize);
+		}
+		if (lastBand) appendBE(idat_, adler_.value());
+		writeChunk("IDAT", idat_);
+		idat_.clear();
+		bandRows_ = 0;
+	}
+
+public:
+	virtual bool topDown() const override
+	{
+		return true;
+	}
+
+protected:
+	virtual void writeHeader() override
+	{
+		std::vector<unsigned char> header = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		writeBuffer(header);
+
+		std::vector<unsigned char> ihdr;
+		appendBE(ihdr, width_);
+		appendBE(ihdr, height_);
+		ihdr.push_back(8); // Bits per channel
+		ihdr.push_back(2); // RGB
+		ihdr.push_back(0); // Deflate
+		ihdr.push_back(0); // Adaptive filtering
+		ihdr.push_back(0); // Not interlaced
+		writeChunk("IHDR", ihdr);
+
+		band_.resize(ROWS_PER_BAND * rowBytes());
+		bandRows_ = 0;
+		adler_ = Adler32();
+		idat_.clear();
+		idat_.push_back(0x78); // zlib header: deflate, 32K window, no dictionary
+		idat_.push_back(0x01);
+	}
+
+	virtual void writeBand(const Framebuffer& rows, int fileRow, int count) override
+	{
+		// Rows are collected into whole bands before they're written, so the file doesn't
+		// depend on how the image was split into bands when it was given to writeRows.
+		while (count > 0) {
+			int n = std::min(count, ROWS_PER_BAND - bandRows_);
+			#pragma omp parallel for
+			for (int r = 0; r < n; ++r) {
+				unsigned char* row = &band_[(bandRows_ + r) * rowBytes()];
+				row[0] = 0;
+				rows.quantiseRow(imageRow(fileRow + r), row + 1);
+			}
+			bandRows_ += n;
+			fileRow += n;
+			count -= n;
+			if (bandRows_ == ROWS_PER_BAND || fileRow == height_) writeIDAT(fileRow == height_);
+		}
+	}
+
+	virtual void writeFooter() override
+	{
+		writeChunk("IEND", {});
+	}
+};
@@ -0,0 +1,358 @@
+#pragma once
+#include "Renderable.hpp"
+#include "GeomUtil.hpp"
+#include "BVHHierarchy.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+#include "Plane.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <typeinfo>
+#include <cstdint>
+#include <stdexcept>
+
+// Plain copies of the data needed to find hits on the simple Renderable types, so
+// PackedScene can test them without virtual calls. Hits are recorded with the original
+// Renderable as the object, so its computeSurface fills in the attributes as usual.
+
+struct PackedSphere
+{
+	Eigen::Vector3f centre;
+	float radius;
+	IntersectMask mask;
+	const Renderable* source;
+
+	bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask rayMask) const
+	{
+		float t;
+		if (!(mask & rayMask) || !intersectSphere(ray, centre, radius, minT, maxT, t)) return false;
+		info.hitT = t;
+		info.object = source;
+		info.primitive = 0;
+		return true;
+	}
+
+	bool occluded(const Ray& ray, float minT, float maxT, IntersectMask rayMask) const
+	{
+		float t;
+		return (mask & rayMask) && intersectSphere(ray, centre, radius, minT, maxT, t);
+	}
+};
+
+struct PackedTriangle
+{
+	Eigen::Vector3f v0, v0v1, v0v2;
+	bool culling;
+	IntersectMask mask;
+	const Renderable* source;
+
+	bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask rayMask) const
+	{
+		float t, u, v;
+		if (!(mask & rayMask) || !intersectTriangleEdges(ray, v0, v0v1, v0v2, culling, t, u, v)) return false;
+		if (t < minT || t > maxT) return false;
+		info.hitT = t;
+		info.object = source;
+		info.primitive = 0;
+		info.barycentrics = Eigen::Vector2f(u, v);
+		return true;
+	}
+
+	bool occluded(const Ray& ray, float minT, float maxT, IntersectMask rayMask) const
+	{
+		float t, u, v;
+		if (!(mask & rayMask) || !intersectTriangleEdges(ray, v0, v0v1, v0v2, culling, t, u, v)) return false;
+		return t >= minT && t <= maxT;
+	}
+};
+
+struct PackedPlane
+{
+	Eigen::Vector3f point, normal;
+	IntersectMask mask;
+	const Renderable* source;
+
+	bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask rayMask) const
+	{
+		float t;
+		if (!(mask & rayMask) || !intersectPlane(ray, point, normal, minT, maxT, t)) return false;
+		info.hitT = t;
+		info.object = source;
+		info.primitive = 0;
+		return true;
+	}
+
+	bool occluded(const Ray& ray, float minT, float maxT, IntersectMask rayMask) const
+	{
+		float t;
+		return (mask & rayMask) && intersectPlane(ray, point, normal, minT, maxT, t);
+	}
+};
+
+/// <summary>
+/// Any other Renderable, which is still tested through its virtual functions.
+/// </summary>
+struct PackedRenderable
+{
+	const Renderable* object;
+
+	bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask rayMask) const
+	{
+		return object->closestHit(ray, minT, maxT, info, rayMask);
+	}
+
+	bool occluded(const Ray& ray, float minT, float maxT, IntersectMask rayMask) const
+	{
+		return object->occluded(ray, minT, maxT, rayMask);
+	}
+};
+
+enum class PrimitiveType : uint8_t
+{
+	Sphere,
+	Triangle,
+	Other
+};
+
+/// <summary>
+/// An entry in the list of primitives referenced by the leaves of a PackedScene's BVH.
+/// Within each leaf, primitives of the same type are next to each other, and stored
+/// contiguously in the array for their type.
+/// </summary>
+struct PrimitiveRef
+{
+	PrimitiveType type;
+	int index; // Index in the array for this type.
+	int runLength; // Number of primitives of this type from here to the end of the run, in the same leaf.
+};
+
+/// <summary>
+/// A list of Renderables compiled into arrays grouped by type, for faster intersection
+/// than a Scene or LinearRenderableBVH of the same objects. Spheres, Triangles and Planes
+/// are copied into plain structs in world space, and tested with inlined code rather than
+/// virtual calls. Other types of Renderable (meshes, BVHs, Instances, SphereSets etc.)
+/// keep their virtual calls. Everything except the Planes goes into a flat BVH, with the
+/// primitives in each leaf grouped into runs of the same type, so a leaf is tested with
+/// one switch per run.
+/// The Renderables are still used to fill in the attributes of the closest hit, and must
+/// stay alive. As with LinearRenderableBVH, the PackedScene can't be transformed. If any
+/// of the Renderables change, call update() to recompile it.
+/// </summary>
+class PackedScene : public Renderable
+{
+private:
+	BVHBuildParams params_;
+	BVHHierarchy bvh_;
+	std::vector<std::shared_ptr<Renderable>> renderables_;
+	std::vector<PrimitiveRef> refs_; // In BVH leaf order.
+	std::vector<PackedSphere> spheres_;
+	std::vector<PackedTriangle> triangles_;
+	std::vector<PackedRenderable> others_;
+	std::vector<PackedPlane> planes_; // Unbounded, so tested separately from the BVH.
+
+	static PrimitiveType typeOf(const Renderable& renderable)
+	{
+		// Subclasses may override the intersection code, so only exact matches are packed.
+		if (typeid(renderable) == typeid(Sphere)) return PrimitiveType::Sphere;
+		if (typeid(renderable) == typeid(Triangle)) return PrimitiveType::Triangle;
+		return PrimitiveType::Other;
+	}
+
+	void pack(const Renderable& renderable, PrimitiveType type)
+	{
+		switch (type) {
+		case PrimitiveType::Sphere: {
+			const Sphere& sphere = static_cast<const Sphere&>(renderable);
+			spheres_.push_back({ sphere.positionToWorld(Eigen::Vector3f::Zero()), sphere.radius(), sphere.mask(), &sphere });
+			break;
+		}
+		case PrimitiveType::Triangle: {
+			const Triangle& triangle = static_cast<const Triangle&>(renderable);
+			Eigen::Vector3f v0 = triangle.positionToWorld(triangle.vertex(0));
+			triangles_.push_back({ v0, triangle.positionToWorld(triangle.vertex(1)) - v0,
+				triangle.positionToWorld(triangle.vertex(2)) - v0, triangle.culling(), triangle.mask(), &triangle });
+			break;
+		}
+		default:
+			others_.push_back({ &renderable });
+			break;
+		}
+	}
+
+	int packedCount(PrimitiveType type) const
+	{
+		switch (type) {
+		case PrimitiveType::Sphere: return (int)spheres_.size();
+		case PrimitiveType::Triangle: return (int)triangles_.size();
+		default: return (int)others_.size();
+		}
+	}
+
+	/// <summary>
+	/// Groups the primitives in each leaf by type, and packs them in that order.
+	/// </summary>
+	void packLeaves(const BVHBuildNode& node, std::vector<BVHPrimitive>& prims, const std::vector<PrimitiveType>& types)
+	{
+		if (!node.isLeaf()) {
+			packLeaves(*node.children[0], prims, types);
+			packLeaves(*node.children[1], prims, types);
+			return;
+		}
+
+		int first = node.primOffset, last = node.primOffset + node.primCount;
+		std::stable_sort(prims.begin() + first, prims.begin() + last, [&](const BVHPrimitive& a, const BVHPrimitive& b) {
+			return types[a.index] < types[b.index];
+		});
+		for (int p = first; p < last; ++p) {
+			PrimitiveType type = types[prims[p].index];
+			refs_[p] = { type, packedCount(type), 1 };
+			pack(*renderables_[prims[p].index], type);
+		}
+		for (int p = last - 2; p >= first; --p) {
+			if (refs_[p].type == refs_[p + 1].type) refs_[p].runLength = refs_[p + 1].runLength + 1;
+		}
+	}
+
+	void build()
+	{
+		refs_.clear();
+		spheres_.clear();
+		triangles_.clear();
+		others_.clear();
+		planes_.clear();
+
+		std::vector<BVHPrimitive> prims;
+		std::vector<PrimitiveType> types(renderables_.size());
+		for (int r = 0; r < (int)renderables_.size(); ++r) {
+			const Renderable& renderable = *renderables_[r];
+			if (typeid(renderable) == typeid(Plane)) {
+				const Plane& plane = static_cast<const Plane&>(renderable);
+				planes_.push_back({ plane.positionToWorld(Eigen::Vector3f::Zero()), plane.normalToWorld(plane.normal()), plane.mask(), &plane });
+				continue;
+			}
+			types[r] = typeOf(renderable);
+			BVHPrimitive prim;
+			prim.bounds = renderable.getAABB();
+			prim.centroid = prim.bounds.centre();
+			prim.index = r;
+			prims.push_back(prim);
+		}
+
+		if (prims.empty()) {
+			bvh_ = BVHHierarchy();
+			return;
+		}
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params_).build(prims);
+		bvh_ = BVHHierarchy(*root, params_);
+		refs_.resize(prims.size());
+		packLeaves(*root, prims, types);
+	}
+
+	template <typename Packed>
+	static bool intersectRun(const std::vector<Packed>& packed, int first, int count,
+		const Ray& ray, float minT, float& maxT, HitInfo& info, IntersectMask mask)
+	{
+		bool hit = false;
+		for (int i = first; i < first + count; ++i) {
+			if (packed[i].closestHit(ray, minT, maxT, info, mask)) {
+				maxT = info.hitT;
+				hit = true;
+			}
+		}
+		return hit;
+	}
+
+	template <typename Packed>
+	static bool occludedRun(const std::vector<Packed>& packed, int first, int count,
+		const Ray& ray, float minT, float maxT, IntersectMask mask)
+	{
+		for (int i = first; i < first + count; ++i) {
+			if (packed[i].occluded(ray, minT, maxT, mask)) return true;
+		}
+		return false;
+	}
+
+public:
+	/// <param name="renderables">The Renderables to compile, e.g. the contents of a Scene.</param>
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size, branching factor, node compression).</param>
+	PackedScene(const std::vector<std::shared_ptr<Renderable>>& renderables, const BVHBuildParams& params)
+		:Renderable(nullptr), params_(params), renderables_(renderables)
+	{
+		build();
+	}
+
+	/// <summary>
+	/// Recompiles the scene after some of the Renderables have changed (e.g. their
+	/// modelToWorld was set).
+	/// </summary>
+	void update()
+	{
+		build();
+	}
+
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		// Test the planes first, as any hit on them shortens the BVH traversal.
+		bool hitSomething = intersectRun(planes_, 0, (int)planes_.size(), ray, minT, maxT, info, mask);
+
+		hitSomething |= bvh_.intersect(ray, minT, maxT, [&](int first, int count, float& tMax) {
+			bool leafHit = false;
+			for (int r = first; r < first + count; r += refs_[r].runLength) {
+				const PrimitiveRef& ref = refs_[r];
+				switch (ref.type) {
+				case PrimitiveType::Sphere:
+					leafHit |= intersectRun(spheres_, ref.index, ref.runLength, ray, minT, tMax, info, mask);
+					break;
+				case PrimitiveType::Triangle:
+					leafHit |= intersectRun(triangles_, ref.index, ref.runLength, ray, minT, tMax, info, mask);
+					break;
+				default:
+					leafHit |= intersectRun(others_, ref.index, ref.runLength, ray, minT, tMax, info, mask);
+					break;
+				}
+			}
+			return leafHit;
+		});
+
+		return hitSomething;
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (occludedRun(planes_, 0, (int)planes_.size(), ray, minT, maxT, mask)) return true;
+
+		return bvh_.occluded(ray, minT, maxT, [&](int first, int count) {
+			for (int r = first; r < first + count; r += refs_[r].runLength) {
+				const PrimitiveRef& ref = refs_[r];
+				bool hit;
+				switch (ref.type) {
+				case PrimitiveType::Sphere: hit = occludedRun(spheres_, ref.index, ref.runLength, ray, minT, maxT, mask); break;
+				case PrimitiveType::Triangle: hit = occludedRun(triangles_, ref.index, ref.runLength, ray, minT, maxT, mask); break;
+				default: hit = occludedRun(others_, ref.index, ref.runLength, ray, minT, maxT, mask); break;
+				}
+				if (hit) return true;
+			}
+			return false;
+		});
+	}
+
+	virtual AABB getAABB() const override
+	{
+		if (!planes_.empty()) throw std::runtime_error("Can't get an AABB enclosing a PackedScene containing planes!");
+		return bvh_.getAABB();
+	}
+
+	virtual std::string print() const override
+	{
+		std::stringstream ss;
+		ss << "PackedScene (" << bvh_.nodeCount() << " nodes, " << spheres_.size() << " spheres, "
+			<< triangles_.size() << " triangles, " << planes_.size() << " planes, " << others_.size() << " others)";
+		return ss.str();
+	}
+
+	virtual void modelToWorld(const Eigen::Matrix4f&) override
+	{
+		throw(std::runtime_error("Can't transform a PackedScene."));
+	}
+};
@@ -10,6 +10,7 @@ class Plane : public Renderable
 {
 private:
 	Eigen::Vector3f normal_;
+
 public:
 	Plane(const Shader* shader, const Eigen::Vector3f& normal, IntersectMask mask=DEFAULT_BITMASK)
 		:Renderable(shader, mask), normal_(normal)
@@ -18,30 +19,46 @@ public:
 	virtual ~Plane()
 	{}
 
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	/// <summary>
+	/// Model space normal of the plane.
+	/// </summary>
+	const Eigen::Vector3f& normal() const
 	{
-		if (!checkMask(mask)) return false;
-
-		// Work out plane position and normal in world space.
-		Eigen::Vector3f centreWorldSpace = transformPosition(modelToWorld(), Eigen::Vector3f::Zero());
-		Eigen::Vector3f normalWorldSpace = transformNormal(modelToWorld(), normal_);
+		return normal_;
+	}
 
-		float rayDotNorm = ray.direction.dot(normalWorldSpace);
-		if (abs(rayDotNorm) < 1e-6f) return false; // ray parallel to plane.
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
 
-		float t = (centreWorldSpace - ray.origin).dot(normalWorldSpace) / rayDotNorm;
-		if (t < minT || t > maxT) return false; // intersection not in range.
+		float t;
+		if (!intersectPlane(ray, positionToWorld(Eigen::Vector3f::Zero()), normalToWorld(normal_), minT, maxT, t)) return false;
 
 		info.hitT = t;
+		info.object = this;
+		info.primitive = 0;
+		return true;
+	}
+
+	virtual void computeSurface(const Ray& ray, HitInfo& info) const override
+	{
+		float t = info.hitT;
 		info.inDirection = ray.direction;
 		info.location = ray.origin + t * ray.direction;
-		info.normal = normalWorldSpace;
+		info.normal = normalToWorld(normal_);
 		info.shader = shader();
 		info.texCoords = Eigen::Vector2f(
 			fmodf(info.location.x(), 1.0f),
 			fmodf(info.location.y(), 1.0f));
-		
-		return true;
+		info.texCoordScale = 1.f;
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		float t;
+		return intersectPlane(ray, positionToWorld(Eigen::Vector3f::Zero()), normalToWorld(normal_), minT, maxT, t);
 	}
 
 	virtual AABB getAABB() const override
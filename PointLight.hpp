@@ -17,8 +17,7 @@ public:
 		shadowRay.origin = location;
 		shadowRay.direction = (location_ - location).normalized();
 		float maxT = (location_ - location).norm();
-		HitInfo info;
-		return !renderable->intersect(shadowRay, 1e-4f, maxT, info, SHADOW_BITMASK);
+		return !renderable->occluded(shadowRay, 1e-4f, maxT, SHADOW_BITMASK);
 	}
 
 	virtual Eigen::Vector3f getIntensity(const Eigen::Vector3f& location) const override
@@ -3,10 +3,15 @@
 
 /// <summary>
 /// Struct encoding a Ray, with an origin and a direction.
+/// Rays traced from the camera also carry a cone around them, covering one pixel, so
+/// shaders can tell how large an area of a surface a hit represents (e.g. to filter
+/// textures). The cone is coneWidth wide at the origin, and widens by coneSpread per unit
+/// distance along the ray.
 /// </summary>
 struct Ray
 {
 	Eigen::Vector3f origin, direction;
+	float coneWidth = 0.f, coneSpread = 0.f;
 };
 
 std::ostream& operator <<(std::ostream& str, const Ray& ray)
@@ -16,7 +16,7 @@ class Shader;
 /// can be set to nullptr.
 /// Renderable is an Abstract Data Type (ADT) as it has a pure virtual function.
 /// To make a Renderable subclass you can instantiate, you must implement
-/// the intersect function.
+/// the closestHit function.
 /// </summary>
 class Renderable : public Entity
 {
@@ -28,10 +28,47 @@ public:
 	{}
 
 	/// <summary>
-	/// Renderables must implement an intersect function, that fills out the contents of 
-	/// the HitInfo struct if a hit occurs.
+	/// Finds the closest hit between minT and maxT, and fills out the contents of the HitInfo
+	/// struct for it. Normals, texture coordinates etc. are only worked out for the closest
+	/// hit, after the search (see closestHit and computeSurface).
 	/// </summary>
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const = 0;
+	bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const
+	{
+		if (!closestHit(ray, minT, maxT, info, mask)) return false;
+		resolveHit(ray, info);
+		info.coneWidth = ray.coneWidth + info.hitT * ray.coneSpread;
+		info.coneSpread = ray.coneSpread;
+		return true;
+	}
+
+	/// <summary>
+	/// Renderables must implement a closestHit function, that finds the closest hit between
+	/// minT and maxT. On a hit, it should set hitT, and either set object, primitive and
+	/// barycentrics so that object->computeSurface can work out the rest of the HitInfo
+	/// later, or fill in the rest itself and set object to nullptr.
+	/// info must not be changed if there isn't a hit. So containers can pass the same
+	/// HitInfo to each of their children in turn, reducing maxT after each hit.
+	/// </summary>
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const = 0;
+
+	/// <summary>
+	/// Fills in the location, normal, texture coordinates, shader and incoming direction of
+	/// a hit found by this renderable's closestHit, given the same ray.
+	/// </summary>
+	virtual void computeSurface(const Ray&, HitInfo&) const
+	{}
+
+	/// <summary>
+	/// Checks whether the ray hits anything between minT and maxT (e.g. for shadow rays).
+	/// Unlike intersect, this can stop at the first hit found rather than the closest one,
+	/// and doesn't need to work out normals, texture coordinates etc. The default version
+	/// just calls closestHit, so subclasses should override it where they can do better.
+	/// </summary>
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const
+	{
+		HitInfo info;
+		return closestHit(ray, minT, maxT, info, mask);
+	}
 
 	/// <summary>
 	/// This function finds an AABB that should fully enclose the renderable. AABBs should always
@@ -49,9 +86,49 @@ public:
 		return mask_ & mask;
 	}
 
+	IntersectMask mask() const
+	{
+		return mask_;
+	}
+
 	const Shader* shader() const
 	{
 		return shader_;
 	}
+
+protected:
+	/// <summary>
+	/// Fills in the attributes of a hit found by closestHit, if they aren't already.
+	/// </summary>
+	static void resolveHit(const Ray& ray, HitInfo& info)
+	{
+		if (!info.object) return;
+		info.object->computeSurface(ray, info);
+		info.object = nullptr;
+	}
+
+	/// <summary>
+	/// For renderables that transform rays into model space before testing their children.
+	/// The attributes of a hit can't be worked out later from the world space ray, so they
+	/// are filled in here (once per call, for the closest hit) and moved back to world space.
+	/// </summary>
+	void hitToWorld(const Ray& ray, const Ray& modelRay, HitInfo& info) const
+	{
+		if (isIdentity()) return;
+		resolveHit(modelRay, info);
+		info.location = positionToWorld(info.location);
+		info.normal = normalToWorld(info.normal).normalized();
+		info.inDirection = ray.direction;
+		info.texCoordScale = texCoordScaleToWorld(info.texCoordScale);
+	}
+
+	/// <summary>
+	/// Converts a HitInfo::texCoordScale worked out in model space to world space.
+	/// Distances across the surface are scaled by (roughly) the cube root of the determinant.
+	/// </summary>
+	float texCoordScaleToWorld(float modelScale) const
+	{
+		return modelScale / std::cbrt(std::abs(modelToWorld().block<3, 3>(0, 0).determinant()));
+	}
 };
 
@@ -20,32 +20,40 @@ public:
 
 	std::vector<std::shared_ptr<Renderable>> renderables;
 
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
 	{
 		if (!checkMask(mask)) return false;
 
 		// Transform ray from world space to scene space.
-		Ray tRay;
-		tRay.origin = transformPosition(worldToModel(), ray.origin);
-		tRay.direction = transformDirection(worldToModel(), ray.direction);
+		Ray tRay = rayToModel(ray);
 
-		// Identify closest valid hit.
-		float t = std::numeric_limits<float>::max();
+		// Identify closest valid hit. After each hit, only closer hits are of interest,
+		// so maxT is reduced to the hit distance.
+		bool hitSomething = false;
 		for (const auto& object : renderables) {
-			HitInfo currInfo;
-			if (object->intersect(tRay, minT, maxT, currInfo, mask)) {
-				if (currInfo.hitT < t) {
-					info = currInfo;
-					t = currInfo.hitT;
-				}
+			if (object->closestHit(tRay, minT, maxT, info, mask)) {
+				maxT = info.hitT;
+				hitSomething = true;
 			}
 		}
+		if (!hitSomething) return false;
 
 		// Transform hit location and normal back into world space.
-		info.location = transformPosition(modelToWorld(), info.location);
-		info.normal = transformDirection(modelToWorld(), info.normal);
+		hitToWorld(ray, tRay, info);
 
-		return t < std::numeric_limits<float>::max();
+		return true;
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		Ray tRay = rayToModel(ray);
+
+		for (const auto& object : renderables) {
+			if (object->occluded(tRay, minT, maxT, mask)) return true;
+		}
+		return false;
 	}
 
 	AABB getAABB() const override
@@ -0,0 +1,505 @@
+#pragma once
+#include <json/json.hpp>
+#include <Eigen/Dense>
+#include <string>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <exception>
+#include <stdexcept>
+#include <iostream>
+#include <chrono>
+#include "GeomUtil.hpp"
+#include "BitMasks.hpp"
+#include "Scene.hpp"
+#include "Plane.hpp"
+#include "Sphere.hpp"
+#include "SphereSet.hpp"
+#include "Triangle.hpp"
+#include "Mesh.hpp"
+#include "LinearMeshBVH.hpp"
+#include "LinearRenderableBVH.hpp"
+#include "BVHNode.hpp"
+#include "Instance.hpp"
+#include "PointLight.hpp"
+#include "DirectionalLight.hpp"
+#include "LambertianShader.hpp"
+#include "TexturedLambertianShader.hpp"
+#include "PhongShader.hpp"
+#include "MirrorShader.hpp"
+#include "TexCoordTestShader.hpp"
+#include "Model.hpp"
+#include "ModelCache.hpp"
+#include "TextureCache.hpp"
+
+/// <summary>
+/// Load an Eigen Vector3f from a config file.
+/// Call as for example loadVec3FromConfig(config["myVector3"]);
+/// </summary>
+Eigen::Vector3f loadVec3FromConfig(const nlohmann::json& config)
+{
+	return Eigen::Vector3f(config[0], config[1], config[2]);
+}
+
+/// <summary>
+/// Load BVH build parameters from a config file. Any entries not present in the
+/// config keep the values in params (by default, the defaults of BVHBuildParams).
+/// </summary>
+BVHBuildParams loadBVHBuildParamsFromConfig(const nlohmann::json& config, BVHBuildParams params = BVHBuildParams())
+{
+	if (config.contains("method")) {
+		std::string method = config["method"];
+		if (method == "sah") params.method = BVHBuildMethod::SAH;
+		else if (method == "sbvh") params.method = BVHBuildMethod::SBVH;
+		else if (method == "lbvh") params.method = BVHBuildMethod::LBVH;
+		else throw std::runtime_error("Unknown BVH build method \"" + method + "\" in config (expected \"sah\", \"sbvh\" or \"lbvh\").");
+	}
+	params.sahBinCount = config.value("sahBinCount", params.sahBinCount);
+	params.traversalCost = config.value("traversalCost", params.traversalCost);
+	params.intersectionCost = config.value("intersectionCost", params.intersectionCost);
+	params.maxLeafSize = config.value("maxLeafSize", params.maxLeafSize);
+	params.maxDepth = config.value("maxDepth", params.maxDepth);
+	params.spatialSplitAlpha = config.value("spatialSplitAlpha", params.spatialSplitAlpha);
+	params.maxSpatialSplitDuplication = config.value("maxSpatialSplitDuplication", params.maxSpatialSplitDuplication);
+	params.mortonBits = config.value("mortonBits", params.mortonBits);
+	params.branchingFactor = config.value("branchingFactor", params.branchingFactor);
+	params.compressNodes = config.value("compressNodes", params.compressNodes);
+	params.refitRebuildThreshold = config.value("refitRebuildThreshold", params.refitRebuildThreshold);
+	return params;
+}
+
+/// <summary>
+/// A scene loaded from a JSON scene file, together with the shaders, textures and models it
+/// uses, which last as long as the SceneFile. The file is a JSON object with these entries,
+/// all optional:
+///   "bvh": BVH build parameters, as in the main config, overriding the ones given to the
+///     constructor. Objects with their own BVH (sphere sets, meshes and groups) can override
+///     them again with their own "bvh", and groups pass their parameters on to the objects
+///     in them, so the innermost setting wins.
+///   "ambientLight": [r, g, b].
+///   "textures": { name: { "filename": TGA file, "format": "unorm8" (default) or "float" } }
+///   "models": { name: { "filename": obj or binary mesh file, "cache": true to load it
+///     through the ModelCache (default false) } }
+///     Meshes use the BVH stored with a model when it has one. Models with "cache": true are
+///     cached with the BVH parameters of the meshes that use them, so each set of parameters
+///     gets its own tree. A BVH stored in a binary mesh file (e.g. by meshconvert) is used
+///     whatever the parameters, apart from the branching factor, node compression and refit
+///     threshold, which are applied when the mesh is built; a warning is given if a mesh
+///     using one sets its own "bvh".
+///   "shaders": { name: { "type": "lambertian", "albedo": [r, g, b] }
+///     or { "type": "phong", "albedo": [r, g, b], "specular": [r, g, b], "shininess": s }
+///     or { "type": "texturedLambertian", "texture": texture name }
+///     or { "type": "mirror" } or { "type": "texCoordTest" } }
+///     Lambertian, phong and textured shaders also take "shadowTest" (default true).
+///   "objects": a list of objects, each { "type": ..., "shader": shader name } and:
+///     "plane": "normal": [x, y, z] (the plane passes through the origin).
+///     "sphere": "radius": r (centred on the origin).
+///     "triangle": "vertices": [[x, y, z], [x, y, z], [x, y, z]], "culling" (default false).
+///     "sphereSet": "centres": [[x, y, z], ...], and "radius": r or "radii": [r, ...].
+///     "mesh": "model": model name, "culling" (default true), "accel": "linearBVH"
+///       (default), "bvhNode" or "none". With "instanced": true, meshes using the same model,
+///       shader and acceleration structure share one copy of it, built in model space,
+///       placed with an Instance for each object.
+///     "group": "objects": a list of objects, "accel": "linearBVH" (default), "bvhNode" or
+///       "none". The objects are put in a BVH of their own. Groups have no shader.
+///   Objects can also have a "transform" and a "mask" (except sphere sets, which take
+///   world space centres). A transform is either a list of 16 numbers (a 4x4 matrix, row by
+///   row), or a list of steps that are multiplied together in order, as they would be in
+///   code: { "translate": [x, y, z] }, { "rotateX": radians } (or Y or Z),
+///   { "scale": s or [x, y, z] }, { "matrix": [16 numbers] }.
+///   A mask is "default", "visible", "shadow", "all", a list of these, or a number.
+///   "lights": a list of { "type": "point", "position": [x, y, z], "intensity": [r, g, b] }
+///     and { "type": "directional", "direction": [x, y, z], "intensity": [r, g, b] }.
+/// Filenames are relative to the directory the scene file is in.
+/// Each texture and model file is loaded once, however many names refer to it, and only if
+/// a shader or object uses it. Files are loaded in parallel, before the objects are built.
+/// Errors in the file are thrown as std::runtime_error (or nlohmann::json exceptions for
+/// values of the wrong type).
+/// </summary>
+class SceneFile
+{
+private:
+	// Shared meshes for instanced objects: model, shader, culling, accel and BVH overrides.
+	typedef std::tuple<const Model*, const Shader*, bool, std::string, std::string> SharedMeshKey;
+
+	// A model loaded for meshes with particular BVH parameters: the model's name, and the
+	// ModelCache::buildParamsKey of the parameters if it is cached (0 if not).
+	typedef std::pair<std::string, uint64_t> ModelKey;
+
+	// A model file: filename, whether it is cached, and the parameters' key if it is.
+	typedef std::tuple<std::string, bool, uint64_t> ModelFileKey;
+
+	std::string filename_;
+	std::filesystem::path directory_;
+	BVHBuildParams bvhParams_;
+	Eigen::Vector3f ambientLight_;
+
+	std::map<std::string, const Texture*> textures_;
+	nlohmann::json modelEntries_;
+	std::map<ModelFileKey, std::unique_ptr<Model>> modelFiles_;
+	std::map<ModelKey, const Model*> models_;
+	std::map<std::string, std::unique_ptr<Shader>> shaders_;
+	std::map<SharedMeshKey, std::shared_ptr<const Renderable>> sharedMeshes_;
+
+	Scene scene_;
+	std::vector<std::unique_ptr<Light>> lights_;
+
+	std::runtime_error error(const std::string& message) const
+	{
+		return std::runtime_error("Scene file " + filename_ + ": " + message);
+	}
+
+	std::string path(const std::string& filename) const
+	{
+		return (directory_ / filename).string();
+	}
+
+	template<typename T>
+	const T& find(const std::map<std::string, T>& items, const nlohmann::json& name, const char* kind) const
+	{
+		auto item = items.find(name.get<std::string>());
+		if (item == items.end()) throw error(std::string("unknown ") + kind + " \"" + name.get<std::string>() + "\".");
+		return item->second;
+	}
+
+	/// <summary>
+	/// Combines an object's "bvh" settings with those it inherits from the groups it is in.
+	/// </summary>
+	static nlohmann::json mergeBVHOverrides(const nlohmann::json& inherited, const nlohmann::json& object)
+	{
+		nlohmann::json merged = inherited;
+		if (object.contains("bvh")) merged.update(object["bvh"]);
+		return merged;
+	}
+
+	/// <summary>
+	/// The key of the model a mesh with the given BVH parameters uses.
+	/// </summary>
+	ModelKey modelKey(const std::string& name, const BVHBuildParams& params) const
+	{
+		if (!modelEntries_.contains(name)) throw error("unknown model \"" + name + "\".");
+		return ModelKey(name, modelEntries_[name].value("cache", false) ? ModelCache::buildParamsKey(params) : 0);
+	}
+
+	/// <summary>
+	/// Finds the models used by a list of objects (and any groups in it), with the BVH
+	/// parameters of the meshes using them.
+	/// </summary>
+	void findModels(const nlohmann::json& objects, const nlohmann::json& inheritedOverrides,
+		std::map<ModelKey, BVHBuildParams>& models) const
+	{
+		for (const nlohmann::json& object : objects) {
+			nlohmann::json overrides = mergeBVHOverrides(inheritedOverrides, object);
+			if (object.contains("model")) {
+				BVHBuildParams params = loadBVHBuildParamsFromConfig(overrides, bvhParams_);
+				models.emplace(modelKey(object["model"], params), params);
+			}
+			if (object.contains("objects")) findModels(object["objects"], overrides, models);
+		}
+	}
+
+	ModelFileKey modelFileKey(const ModelKey& key) const
+	{
+		const nlohmann::json& model = modelEntries_[key.first];
+		return ModelFileKey(path(model.at("filename")), model.value("cache", false), key.second);
+	}
+
+	/// <summary>
+	/// Loads the textures and models the scene uses, in parallel.
+	/// </summary>
+	void loadAssets(const nlohmann::json& file, ModelCache& modelCache, TextureCache& textureCache)
+	{
+		nlohmann::json textures = file.value("textures", nlohmann::json::object());
+		modelEntries_ = file.value("models", nlohmann::json::object());
+		nlohmann::json shaders = file.value("shaders", nlohmann::json::object());
+
+		std::set<std::string> usedTextures;
+		std::map<ModelKey, BVHBuildParams> usedModels;
+		for (const nlohmann::json& shader : shaders) {
+			if (shader.contains("texture")) usedTextures.insert(shader["texture"].get<std::string>());
+		}
+		findModels(file.value("objects", nlohmann::json::array()), nlohmann::json::object(), usedModels);
+
+		// One job per file. Textures are shared through the texture cache, which loads each
+		// file once even when asked for it by several jobs.
+		struct TextureJob { std::string name, filename; Texture::Format format; };
+		std::vector<TextureJob> textureJobs;
+		for (const std::string& name : usedTextures) {
+			if (!textures.contains(name)) throw error("unknown texture \"" + name + "\".");
+			const nlohmann::json& texture = textures[name];
+			std::string format = texture.value("format", std::string("unorm8"));
+			if (format != "unorm8" && format != "float") throw error("unknown texture format \"" + format + "\" (expected \"unorm8\" or \"float\").");
+			textureJobs.push_back({ name, path(texture["filename"]), format == "float" ? Texture::Format::Float : Texture::Format::UNorm8 });
+		}
+		struct ModelJob { ModelFileKey file; BVHBuildParams params; };
+		std::vector<ModelJob> modelJobs;
+		for (const auto& [key, params] : usedModels) {
+			ModelFileKey file = modelFileKey(key);
+			if (modelFiles_.emplace(file, nullptr).second) modelJobs.push_back({ file, params });
+		}
+
+		// Exceptions can't leave an OpenMP loop, so they are kept and rethrown afterwards.
+		// A single job runs on its own, so it can use all the threads itself.
+		int jobs = (int)(textureJobs.size() + modelJobs.size());
+		std::vector<std::exception_ptr> errors(jobs);
+		std::vector<const Texture*> loadedTextures(textureJobs.size());
+		std::vector<std::unique_ptr<Model>> loadedModels(modelJobs.size());
+		auto start = std::chrono::steady_clock::now();
+		#pragma omp parallel for schedule(dynamic) if(jobs > 1)
+		for (int j = 0; j < jobs; ++j) {
+			try {
+				if (j < (int)textureJobs.size()) {
+					loadedTextures[j] = textureCache.get(textureJobs[j].filename, textureJobs[j].format);
+				}
+				else {
+					int m = j - (int)textureJobs.size();
+					const std::string& filename = std::get<0>(modelJobs[m].file);
+					loadedModels[m] = std::get<1>(modelJobs[m].file) ? modelCache.load(filename, modelJobs[m].params)
+						: std::make_unique<Model>(filename.c_str());
+				}
+			}
+			catch (...) {
+				errors[j] = std::current_exception();
+			}
+		}
+		for (const std::exception_ptr& e : errors) {
+			if (e) std::rethrow_exception(e);
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Loaded " << textureJobs.size() << " texture(s) and " << modelJobs.size() << " model file(s) in " << elapsed.count() << " ms." << std::endl;
+
+		for (size_t t = 0; t < textureJobs.size(); ++t) textures_[textureJobs[t].name] = loadedTextures[t];
+		for (size_t m = 0; m < modelJobs.size(); ++m) modelFiles_[modelJobs[m].file] = std::move(loadedModels[m]);
+		for (const auto& [key, params] : usedModels) models_[key] = modelFiles_[modelFileKey(key)].get();
+	}
+
+	void loadShaders(const nlohmann::json& shaders)
+	{
+		for (auto& item : shaders.items()) {
+			const std::string& name = item.key();
+			const nlohmann::json& shader = item.value();
+			std::string type = shader.at("type");
+			bool shadowTest = shader.value("shadowTest", true);
+			if (type == "lambertian") {
+				shaders_[name] = std::make_unique<LambertianShader>(loadVec3FromConfig(shader.at("albedo")), shadowTest);
+			}
+			else if (type == "phong") {
+				shaders_[name] = std::make_unique<PhongShader>(loadVec3FromConfig(shader.at("albedo")),
+					loadVec3FromConfig(shader.at("specular")), shader.at("shininess").get<float>(), shadowTest);
+			}
+			else if (type == "texturedLambertian") {
+				shaders_[name] = std::make_unique<TexturedLambertianShader>(find(textures_, shader.at("texture"), "texture"), shadowTest);
+			}
+			else if (type == "mirror") {
+				shaders_[name] = std::make_unique<MirrorShader>();
+			}
+			else if (type == "texCoordTest") {
+				shaders_[name] = std::make_unique<TexCoordTestShader>();
+			}
+			else throw error("unknown shader type \"" + type + "\" for shader \"" + name + "\".");
+		}
+	}
+
+	Eigen::Matrix4f loadMatrix(const nlohmann::json& values) const
+	{
+		if (values.size() != 16) throw error("matrices need 16 numbers.");
+		Eigen::Matrix4f matrix;
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) matrix(r, c) = values[4 * r + c];
+		}
+		return matrix;
+	}
+
+	Eigen::Matrix4f loadTransform(const nlohmann::json& object) const
+	{
+		Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+		if (!object.contains("transform")) return transform;
+		const nlohmann::json& steps = object["transform"];
+		if (!steps.empty() && steps[0].is_number()) return loadMatrix(steps);
+		for (const nlohmann::json& step : steps) {
+			if (step.contains("translate")) transform *= makeTranslationMatrix(loadVec3FromConfig(step["translate"]));
+			else if (step.contains("rotateX")) transform *= rotateX(step["rotateX"]);
+			else if (step.contains("rotateY")) transform *= rotateY(step["rotateY"]);
+			else if (step.contains("rotateZ")) transform *= rotateZ(step["rotateZ"]);
+			else if (step.contains("scale") && step["scale"].is_number()) transform *= uniformScale(step["scale"]);
+			else if (step.contains("scale")) {
+				Eigen::Matrix4f scale = Eigen::Matrix4f::Identity();
+				scale.block<3, 3>(0, 0) = loadVec3FromConfig(step["scale"]).asDiagonal();
+				transform *= scale;
+			}
+			else if (step.contains("matrix")) transform *= loadMatrix(step["matrix"]);
+			else throw error("unknown transform step " + step.dump() + ".");
+		}
+		return transform;
+	}
+
+	IntersectMask loadMask(const nlohmann::json& mask) const
+	{
+		if (mask.is_number()) return mask.get<IntersectMask>();
+		if (mask.is_array()) {
+			IntersectMask bits = 0;
+			for (const nlohmann::json& m : mask) bits |= loadMask(m);
+			return bits;
+		}
+		std::string name = mask;
+		if (name == "default") return DEFAULT_BITMASK;
+		if (name == "visible") return VISIBLE_BITMASK;
+		if (name == "shadow") return SHADOW_BITMASK;
+		if (name == "all") return ALL_BITMASK;
+		throw error("unknown mask \"" + name + "\".");
+	}
+
+	/// <summary>
+	/// Makes an object. inheritedOverrides holds the "bvh" settings of the groups it is in.
+	/// </summary>
+	std::shared_ptr<Renderable> loadObject(const nlohmann::json& object, const nlohmann::json& inheritedOverrides)
+	{
+		std::string type = object.at("type");
+		nlohmann::json overrides = mergeBVHOverrides(inheritedOverrides, object);
+		BVHBuildParams params = loadBVHBuildParamsFromConfig(overrides, bvhParams_);
+		Eigen::Matrix4f transform = loadTransform(object);
+		IntersectMask mask = object.contains("mask") ? loadMask(object["mask"]) : DEFAULT_BITMASK;
+		const Shader* shader = type == "group" ? nullptr : find(shaders_, object.at("shader"), "shader").get();
+
+		std::shared_ptr<Renderable> renderable;
+		if (type == "plane") {
+			renderable = std::make_shared<Plane>(shader, loadVec3FromConfig(object.at("normal")), mask);
+		}
+		else if (type == "sphere") {
+			renderable = std::make_shared<Sphere>(shader, object.at("radius").get<float>(), mask);
+		}
+		else if (type == "triangle") {
+			const nlohmann::json& v = object.at("vertices");
+			renderable = std::make_shared<Triangle>(shader, loadVec3FromConfig(v.at(0)), loadVec3FromConfig(v.at(1)), loadVec3FromConfig(v.at(2)),
+				object.value("culling", false), mask);
+		}
+		else if (type == "sphereSet") {
+			if (object.contains("transform")) throw error("sphere sets can't be transformed (give the centres in world space).");
+			std::vector<Eigen::Vector3f> centres;
+			for (const nlohmann::json& centre : object.at("centres")) centres.push_back(loadVec3FromConfig(centre));
+			std::vector<float> radii = object.contains("radii") ? object["radii"].get<std::vector<float>>()
+				: std::vector<float>(centres.size(), object.at("radius").get<float>());
+			if (radii.size() != centres.size()) throw error("sphere sets need one radius per centre.");
+			return std::make_shared<SphereSet>(shader, centres, radii, params, mask);
+		}
+		else if (type == "mesh") {
+			ModelKey key = modelKey(object.at("model"), params);
+			const Model* model = models_.at(key);
+			bool culling = object.value("culling", true);
+			std::string accel = object.value("accel", std::string("linearBVH"));
+			if (key.second == 0 && model->hasBVH() && !overrides.empty() && accel != "none") {
+				std::cerr << "Warning: scene file " << filename_ << ": model \"" << key.first << "\" has a stored BVH, "
+					<< "which is used instead of building one with the mesh's \"bvh\" settings." << std::endl;
+			}
+			if (object.value("instanced", false)) {
+				std::shared_ptr<const Renderable>& shared = sharedMeshes_[SharedMeshKey(model, shader, culling, accel, overrides.dump())];
+				if (!shared) shared = loadMesh(*model, shader, params, Eigen::Matrix4f::Identity(), culling, accel, ALL_BITMASK);
+				return std::make_shared<Instance>(shared, transform, nullptr, mask);
+			}
+			return loadMesh(*model, shader, params, transform, culling, accel, mask);
+		}
+		else if (type == "group") {
+			std::vector<std::shared_ptr<Renderable>> objects;
+			for (const nlohmann::json& child : object.at("objects")) objects.push_back(loadObject(child, overrides));
+			std::string accel = object.value("accel", std::string("linearBVH"));
+			std::shared_ptr<Renderable> group;
+			if (accel == "linearBVH") group = std::make_shared<LinearRenderableBVH>(objects, params);
+			else if (accel == "bvhNode") group = std::make_shared<BVHNode>(objects, params);
+			else if (accel == "none") {
+				std::shared_ptr<Scene> scene = std::make_shared<Scene>();
+				scene->renderables = objects;
+				group = scene;
+			}
+			else throw error("unknown acceleration structure \"" + accel + "\" (expected \"linearBVH\", \"bvhNode\" or \"none\").");
+			if (transform.isIdentity() && mask == DEFAULT_BITMASK) return group;
+			return std::make_shared<Instance>(group, transform, nullptr, mask);
+		}
+		else throw error("unknown object type \"" + type + "\".");
+
+		renderable->modelToWorld(transform);
+		return renderable;
+	}
+
+	std::shared_ptr<Renderable> loadMesh(const Model& model, const Shader* shader, const BVHBuildParams& params,
+		const Eigen::Matrix4f& transform, bool culling, const std::string& accel, IntersectMask mask)
+	{
+		if (accel == "linearBVH") return std::make_shared<LinearMeshBVH>(model, shader, params, transform, culling, mask);
+		if (accel == "bvhNode") {
+			std::shared_ptr<Renderable> bvh = std::make_shared<BVHNode>(model, shader, params, transform, culling);
+			if (mask == DEFAULT_BITMASK) return bvh;
+			return std::make_shared<Instance>(bvh, Eigen::Matrix4f::Identity(), nullptr, mask);
+		}
+		if (accel == "none") {
+			std::shared_ptr<Renderable> mesh = std::make_shared<Mesh>(shader, &model, nullptr, culling, true, mask);
+			mesh->modelToWorld(transform);
+			return mesh;
+		}
+		throw error("unknown acceleration structure \"" + accel + "\" (expected \"linearBVH\", \"bvhNode\" or \"none\").");
+	}
+
+	void loadLights(const nlohmann::json& lights)
+	{
+		for (const nlohmann::json& light : lights) {
+			std::string type = light.at("type");
+			Eigen::Vector3f intensity = loadVec3FromConfig(light.at("intensity"));
+			if (type == "point") lights_.push_back(std::make_unique<PointLight>(loadVec3FromConfig(light.at("position")), intensity));
+			else if (type == "directional") lights_.push_back(std::make_unique<DirectionalLight>(loadVec3FromConfig(light.at("direction")), intensity));
+			else throw error("unknown light type \"" + type + "\".");
+		}
+	}
+
+public:
+	/// <param name="filename">The scene file to load.</param>
+	/// <param name="bvhParams">BVH build parameters to use where the scene file doesn't give any.</param>
+	/// <param name="modelCache">Cache for models with "cache": true.</param>
+	/// <param name="textureCache">Cache the textures are loaded through, which must last as long as the SceneFile.</param>
+	SceneFile(const std::string& filename, const BVHBuildParams& bvhParams, ModelCache& modelCache, TextureCache& textureCache)
+		:filename_(filename), directory_(std::filesystem::path(filename).parent_path())
+	{
+		std::ifstream stream(filename);
+		if (stream.fail()) throw error("couldn't open file.");
+		nlohmann::json file = nlohmann::json::parse(stream);
+
+		bvhParams_ = loadBVHBuildParamsFromConfig(file.value("bvh", nlohmann::json::object()), bvhParams);
+		ambientLight_ = file.contains("ambientLight") ? loadVec3FromConfig(file["ambientLight"]) : Eigen::Vector3f::Zero();
+		loadAssets(file, modelCache, textureCache);
+		loadShaders(file.value("shaders", nlohmann::json::object()));
+		for (const nlohmann::json& object : file.value("objects", nlohmann::json::array())) {
+			scene_.renderables.push_back(loadObject(object, nlohmann::json::object()));
+		}
+		loadLights(file.value("lights", nlohmann::json::array()));
+	}
+
+	SceneFile(const SceneFile&) = delete;
+	SceneFile& operator=(const SceneFile&) = delete;
+
+	/// <summary>
+	/// The objects in the scene.
+	/// </summary>
+	Scene& scene()
+	{
+		return scene_;
+	}
+
+	const std::vector<std::unique_ptr<Light>>& lights() const
+	{
+		return lights_;
+	}
+
+	const Eigen::Vector3f& ambientLight() const
+	{
+		return ambientLight_;
+	}
+
+	/// <summary>
+	/// BVH build parameters for the scene as a whole, e.g. for a PackedScene made from it.
+	/// </summary>
+	const BVHBuildParams& bvhParams() const
+	{
+		return bvhParams_;
+	}
+};
@@ -12,6 +12,7 @@ class Sphere : public Renderable
 {
 private:
 	float radius_;
+
 public:
 	Sphere(const Shader* shader, float radius, IntersectMask mask=DEFAULT_BITMASK)
 		:Renderable(shader, mask), radius_(radius)
@@ -20,54 +21,52 @@ public:
 	virtual ~Sphere()
 	{}
 
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	float radius() const
 	{
-		if (!checkMask(mask)) return false;
-
-		Eigen::Vector3f centreWorldSpace = transformPosition(modelToWorld(), Eigen::Vector3f::Zero());
-
-		Eigen::Vector3f centreToOrigin = ray.origin - centreWorldSpace;
-
-		// Quadratic equation coefficients
-		float a = 1.0f;
-		float b = 2 * centreToOrigin.dot(ray.direction);
-		float c = centreToOrigin.dot(centreToOrigin) - radius_ * radius_;
-
-		double discriminant = b * b - 4 * a * c;
-
-		// No intersection at all. Note we don't worry about the tangent case here!
-		if (discriminant < 1e-6f) return false;
-
-		// Two intersections.
-		discriminant = sqrtf(discriminant); // This is safe now we know discriminant > 0.f
-		float t0 = (-b - discriminant) / (2.f * a);
-		float t1 = (-b + discriminant) / (2.f * a);
+		return radius_;
+	}
 
-		if (t0 > t1) std::swap(t0, t1);
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
 
 		float t;
-
-		if (t0 > maxT || t1 < minT) return false;
-		else if (t0 < minT) {
-			if (t1 < maxT) t = t1;
-			else return false;
-		}
-		else t = t0;
+		if (!intersectSphere(ray, positionToWorld(Eigen::Vector3f::Zero()), radius_, minT, maxT, t)) return false;
 
 		info.hitT = t;
+		info.object = this;
+		info.primitive = 0;
+		return true;
+	}
+
+	virtual void computeSurface(const Ray& ray, HitInfo& info) const override
+	{
+		Eigen::Vector3f centreWorldSpace = positionToWorld(Eigen::Vector3f::Zero());
+		float t = info.hitT;
+
 		info.location = ray.origin + t * ray.direction;
-		info.normal = (info.location - centreWorldSpace).normalized();
+		Eigen::Vector3f fromCentre = info.location - centreWorldSpace;
+		info.normal = fromCentre.normalized();
 		info.inDirection = ray.direction;
 		info.shader = shader();
-		Eigen::Vector3f modelSpaceLoc = transformPosition(modelToWorld().inverse(), info.location);
+		Eigen::Vector3f modelSpaceLoc = positionToModel(info.location);
 		modelSpaceLoc = modelSpaceLoc.normalized();
 		info.texCoords = Eigen::Vector2f((atan2f(modelSpaceLoc.x(), modelSpaceLoc.z()) + M_PI) / (2.f * M_PI), (asinf(modelSpaceLoc.y()) / M_PI) + 0.5f);
-		return true;
+		// u goes round the equator (2 pi r) and v from pole to pole (pi r).
+		info.texCoordScale = 1.f / (float(M_PI) * sqrtf(2.f) * fromCentre.norm());
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		float t;
+		return intersectSphere(ray, positionToWorld(Eigen::Vector3f::Zero()), radius_, minT, maxT, t);
 	}
 
 	AABB getAABB() const override
 	{
-		auto pos = transformPosition(modelToWorld(), Eigen::Vector3f::Zero());
+		auto pos = positionToWorld(Eigen::Vector3f::Zero());
 		AABB aabb;
 		aabb.min = pos - Eigen::Vector3f::Ones() * radius_;
 		aabb.max = pos + Eigen::Vector3f::Ones() * radius_;
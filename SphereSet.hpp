@@ -0,0 +1,258 @@
+#pragma once
+#include "Renderable.hpp"
+#include "GeomUtil.hpp"
+#include "BVHHierarchy.hpp"
+#include "CpuFeatures.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/// <summary>
+/// A large number of spheres sharing one shader, e.g. particles or atoms in a molecule.
+/// Rather than a Sphere instance (with its own matrices, vtable and shared_ptr) per sphere,
+/// the centres and radii are stored as structure-of-arrays in the order of the leaves of
+/// an internal flat BVH (see BVHHierarchy). Leaves are tested 8 (AVX) or 4 (SSE) spheres
+/// at a time where the CPU supports it, with the same results as Sphere.
+/// As with LinearRenderableBVH, the spheres are given in world space and the set can't be
+/// transformed afterwards. Use an Instance to place copies of it.
+/// </summary>
+class SphereSet : public Renderable
+{
+private:
+	// The arrays are padded with empty spheres so SIMD code can always load a whole
+	// packet, starting from any sphere.
+	static constexpr int PADDING = 7;
+
+	BVHBuildParams params_;
+	BVHHierarchy bvh_;
+	std::vector<float> cx_, cy_, cz_, radii_; // In BVH leaf order.
+	int size_ = 0;
+	int simdWidth_ = 1;
+
+	void build(const std::vector<Eigen::Vector3f>& centres, const std::vector<float>& radii)
+	{
+		if (centres.size() != radii.size()) {
+			throw std::runtime_error("SphereSet needs one radius per sphere!");
+		}
+
+		std::vector<BVHPrimitive> prims(centres.size());
+		for (int i = 0; i < (int)centres.size(); ++i) {
+			prims[i].bounds.min = centres[i] - Eigen::Vector3f::Constant(radii[i]);
+			prims[i].bounds.max = centres[i] + Eigen::Vector3f::Constant(radii[i]);
+			prims[i].centroid = centres[i];
+			prims[i].index = i;
+		}
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params_).build(prims);
+		bvh_ = BVHHierarchy(*root, params_);
+
+		// SBVH builds may reference a sphere from more than one leaf, so there can be more
+		// entries than spheres.
+		size_ = (int)prims.size();
+		for (auto* a : { &cx_, &cy_, &cz_, &radii_ }) {
+			a->assign(size_ + PADDING, 0.f);
+		}
+		for (int s = 0; s < size_; ++s) {
+			const Eigen::Vector3f& centre = centres[prims[s].index];
+			cx_[s] = centre.x(); cy_[s] = centre.y(); cz_[s] = centre.z();
+			radii_[s] = radii[prims[s].index];
+		}
+	}
+
+	Eigen::Vector3f centre(int s) const
+	{
+		return Eigen::Vector3f(cx_[s], cy_[s], cz_[s]);
+	}
+
+	/// <summary>
+	/// Picks the closest of the lanes in hitMask. Ties go to the lowest lane.
+	/// </summary>
+	static int closestLane(int hitMask, const float* t)
+	{
+		int best = -1;
+		for (int lane = 0; hitMask; ++lane, hitMask >>= 1) {
+			if ((hitMask & 1) && (best == -1 || t[lane] < t[best])) best = lane;
+		}
+		return best;
+	}
+
+#ifdef HAS_X86_SIMD
+	// These follow intersectSphere operation for operation, so results are bit for bit
+	// the same. Note the discriminant test there is done in double precision, but on a
+	// value computed in float, so comparing in float gives the same answer.
+
+	int intersectPacketSSE(const Ray& ray, int first, float minT, float maxT, float* tOut) const
+	{
+		__m128 ox = _mm_sub_ps(_mm_set1_ps(ray.origin.x()), _mm_loadu_ps(&cx_[first]));
+		__m128 oy = _mm_sub_ps(_mm_set1_ps(ray.origin.y()), _mm_loadu_ps(&cy_[first]));
+		__m128 oz = _mm_sub_ps(_mm_set1_ps(ray.origin.z()), _mm_loadu_ps(&cz_[first]));
+		__m128 r = _mm_loadu_ps(&radii_[first]);
+
+		__m128 dDotO = _mm_add_ps(_mm_mul_ps(ox, _mm_set1_ps(ray.direction.x())),
+			_mm_add_ps(_mm_mul_ps(oy, _mm_set1_ps(ray.direction.y())), _mm_mul_ps(oz, _mm_set1_ps(ray.direction.z()))));
+		__m128 b = _mm_mul_ps(_mm_set1_ps(2.f), dDotO);
+		__m128 oDotO = _mm_add_ps(_mm_mul_ps(ox, ox), _mm_add_ps(_mm_mul_ps(oy, oy), _mm_mul_ps(oz, oz)));
+		__m128 c = _mm_sub_ps(oDotO, _mm_mul_ps(r, r));
+		__m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4.f), c));
+		__m128 valid = _mm_cmpge_ps(discriminant, _mm_set1_ps(1e-6f));
+
+		__m128 root = _mm_sqrt_ps(discriminant);
+		__m128 negB = _mm_xor_ps(b, _mm_set1_ps(-0.f));
+		__m128 t0 = _mm_div_ps(_mm_sub_ps(negB, root), _mm_set1_ps(2.f));
+		__m128 t1 = _mm_div_ps(_mm_add_ps(negB, root), _mm_set1_ps(2.f));
+
+		__m128 vMinT = _mm_set1_ps(minT), vMaxT = _mm_set1_ps(maxT);
+		__m128 nearHit = _mm_and_ps(_mm_cmpge_ps(t0, vMinT), _mm_cmple_ps(t0, vMaxT));
+		__m128 farHit = _mm_and_ps(_mm_cmplt_ps(t0, vMinT), _mm_and_ps(_mm_cmpge_ps(t1, vMinT), _mm_cmplt_ps(t1, vMaxT)));
+		__m128 hit = _mm_and_ps(valid, _mm_or_ps(nearHit, farHit));
+
+		_mm_storeu_ps(tOut, _mm_or_ps(_mm_and_ps(nearHit, t0), _mm_andnot_ps(nearHit, t1)));
+		return _mm_movemask_ps(hit);
+	}
+
+	SIMD_TARGET_AVX
+	int intersectPacketAVX(const Ray& ray, int first, float minT, float maxT, float* tOut) const
+	{
+		__m256 ox = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x()), _mm256_loadu_ps(&cx_[first]));
+		__m256 oy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y()), _mm256_loadu_ps(&cy_[first]));
+		__m256 oz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z()), _mm256_loadu_ps(&cz_[first]));
+		__m256 r = _mm256_loadu_ps(&radii_[first]);
+
+		__m256 dDotO = _mm256_add_ps(_mm256_mul_ps(ox, _mm256_set1_ps(ray.direction.x())),
+			_mm256_add_ps(_mm256_mul_ps(oy, _mm256_set1_ps(ray.direction.y())), _mm256_mul_ps(oz, _mm256_set1_ps(ray.direction.z()))));
+		__m256 b = _mm256_mul_ps(_mm256_set1_ps(2.f), dDotO);
+		__m256 oDotO = _mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_add_ps(_mm256_mul_ps(oy, oy), _mm256_mul_ps(oz, oz)));
+		__m256 c = _mm256_sub_ps(oDotO, _mm256_mul_ps(r, r));
+		__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(4.f), c));
+		__m256 valid = _mm256_cmp_ps(discriminant, _mm256_set1_ps(1e-6f), _CMP_GE_OQ);
+
+		__m256 root = _mm256_sqrt_ps(discriminant);
+		__m256 negB = _mm256_xor_ps(b, _mm256_set1_ps(-0.f));
+		__m256 t0 = _mm256_div_ps(_mm256_sub_ps(negB, root), _mm256_set1_ps(2.f));
+		__m256 t1 = _mm256_div_ps(_mm256_add_ps(negB, root), _mm256_set1_ps(2.f));
+
+		__m256 vMinT = _mm256_set1_ps(minT), vMaxT = _mm256_set1_ps(maxT);
+		__m256 nearHit = _mm256_and_ps(_mm256_cmp_ps(t0, vMinT, _CMP_GE_OQ), _mm256_cmp_ps(t0, vMaxT, _CMP_LE_OQ));
+		__m256 farHit = _mm256_and_ps(_mm256_cmp_ps(t0, vMinT, _CMP_LT_OQ),
+			_mm256_and_ps(_mm256_cmp_ps(t1, vMinT, _CMP_GE_OQ), _mm256_cmp_ps(t1, vMaxT, _CMP_LT_OQ)));
+		__m256 hit = _mm256_and_ps(valid, _mm256_or_ps(nearHit, farHit));
+
+		_mm256_storeu_ps(tOut, _mm256_blendv_ps(t1, t0, nearHit));
+		return _mm256_movemask_ps(hit);
+	}
+#endif
+
+	/// <summary>
+	/// Tests the packet of simdWidth_ spheres starting at first, returning a bit mask of
+	/// the ones hit with t in [minT, maxT].
+	/// </summary>
+	int intersectPacket(const Ray& ray, int first, float minT, float maxT, float* t) const
+	{
+#ifdef HAS_X86_SIMD
+		if (simdWidth_ == 8) return intersectPacketAVX(ray, first, minT, maxT, t);
+		if (simdWidth_ == 4) return intersectPacketSSE(ray, first, minT, maxT, t);
+#endif
+		return intersectSphere(ray, centre(first), radii_[first], minT, maxT, t[0]) ? 1 : 0;
+	}
+
+public:
+	/// <param name="shader">The shader to use for all of the spheres.</param>
+	/// <param name="centres">World space centres of the spheres.</param>
+	/// <param name="radii">Radius of each sphere, in the same order as centres.</param>
+	/// <param name="params">Parameters controlling the BVH build (SAH bins, costs, leaf size, branching factor, node compression).</param>
+	/// <param name="mask">Intersection mask for the spheres.</param>
+	SphereSet(const Shader* shader, const std::vector<Eigen::Vector3f>& centres, const std::vector<float>& radii,
+		const BVHBuildParams& params, IntersectMask mask = DEFAULT_BITMASK)
+		:Renderable(shader, mask), params_(params)
+	{
+		// SSE is part of the x86-64 baseline; 8-wide packets need AVX.
+#ifdef HAS_X86_SIMD
+		simdWidth_ = CpuFeatures::get().avx ? 8 : 4;
+#endif
+		build(centres, radii);
+	}
+
+	/// <summary>
+	/// Makes a set of spheres that all have the same radius.
+	/// </summary>
+	SphereSet(const Shader* shader, const std::vector<Eigen::Vector3f>& centres, float radius,
+		const BVHBuildParams& params, IntersectMask mask = DEFAULT_BITMASK)
+		:SphereSet(shader, centres, std::vector<float>(centres.size(), radius), params, mask)
+	{}
+
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		int closest = -1;
+		float closestT = maxT;
+
+		bool hit = bvh_.intersect(ray, minT, maxT, [&](int first, int count, float& tMax) {
+			float tPacket[8];
+			bool leafHit = false;
+			for (int base = first; base < first + count; base += simdWidth_) {
+				int lanes = std::min(simdWidth_, first + count - base);
+				int hitMask = intersectPacket(ray, base, minT, tMax, tPacket) & ((1 << lanes) - 1);
+				if (!hitMask) continue;
+				int lane = closestLane(hitMask, tPacket);
+				closest = base + lane;
+				tMax = tPacket[lane];
+				leafHit = true;
+			}
+			if (leafHit) closestT = tMax;
+			return leafHit;
+		});
+
+		if (!hit) return false;
+
+		info.hitT = closestT;
+		info.object = this;
+		info.primitive = closest;
+		return true;
+	}
+
+	/// <summary>
+	/// Texture coordinates are worked out as for a Sphere that hasn't been rotated.
+	/// </summary>
+	virtual void computeSurface(const Ray& ray, HitInfo& info) const override
+	{
+		info.location = ray.origin + info.hitT * ray.direction;
+		info.normal = (info.location - centre(info.primitive)).normalized();
+		info.inDirection = ray.direction;
+		info.shader = shader();
+		const Eigen::Vector3f& n = info.normal;
+		info.texCoords = Eigen::Vector2f((atan2f(n.x(), n.z()) + M_PI) / (2.f * M_PI), (asinf(n.y()) / M_PI) + 0.5f);
+		info.texCoordScale = 1.f / (float(M_PI) * sqrtf(2.f) * radii_[info.primitive]); // As for Sphere
+	}
+
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		return bvh_.occluded(ray, minT, maxT, [&](int first, int count) {
+			float tPacket[8];
+			for (int base = first; base < first + count; base += simdWidth_) {
+				int lanes = std::min(simdWidth_, first + count - base);
+				if (intersectPacket(ray, base, minT, maxT, tPacket) & ((1 << lanes) - 1)) return true;
+			}
+			return false;
+		});
+	}
+
+	virtual AABB getAABB() const override
+	{
+		return bvh_.getAABB();
+	}
+
+	virtual std::string print() const override
+	{
+		std::stringstream ss;
+		ss << "SphereSet (" << bvh_.nodeCount() << " nodes, " << size_ << " spheres)";
+		return ss.str();
+	}
+
+	virtual void modelToWorld(const Eigen::Matrix4f&) override
+	{
+		throw(std::runtime_error("Can't transform a SphereSet, use an Instance of it instead."));
+	}
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include "ImageWriter.hpp"
+#include <string>
+
+/// <summary>
+/// Writes images as uncompressed 24-bit TGA files, clamped to 8 bits per channel (see
+/// Framebuffer::quantiseRow). The rows are stored from the bottom up, as in the
+/// Framebuffer, so the image doesn't need flipping.
+/// </summary>
+class TGAWriter : public ImageWriter
+{
+private:
+	std::vector<unsigned char> band_;
+
+public:
+	virtual bool topDown() const override
+	{
+		return false;
+	}
+
+protected:
+	virtual void writeHeader() override
+	{
+		if (width_ > 65535 || height_ > 65535) throw std::runtime_error("Image is too large to save as TGA!");
+		std::vector<unsigned char> header;
+		header.push_back(0); // No image ID
+		header.push_back(0); // No colour map
+		header.push_back(2); // Uncompressed true colour
+		header.insert(header.end(), 5, 0); // Colour map specification
+		appendLE<uint16_t>(header, 0); // x origin
+		appendLE<uint16_t>(header, 0); // y origin
+		appendLE<uint16_t>(header, width_);
+		appendLE<uint16_t>(header, height_);
+		header.push_back(24); // Bits per pixel
+		header.push_back(0); // Bottom-left origin, no alpha
+		writeBuffer(header);
+		band_.resize(ROWS_PER_BAND * 3 * size_t(width_));
+	}
+
+	virtual void writeBand(const Framebuffer& rows, int fileRow, int count) override
+	{
+		size_t rowBytes = 3 * size_t(width_);
+		#pragma omp parallel for
+		for (int r = 0; r < count; ++r) {
+			unsigned char* row = &band_[r * rowBytes];
+			rows.quantiseRow(imageRow(fileRow + r), row);
+			for (int x = 0; x < width_; ++x) std::swap(row[3 * x], row[3 * x + 2]); // TGA stores BGR
+		}
+		writeBuffer(band_, count * rowBytes);
+	}
+
+	virtual void writeFooter() override
+	{
+		// TGA 2.0 footer: no extension or developer areas, then the signature.
+		static const char footer[] = "\0\0\0\0\0\0\0\0TRUEVISION-XFILE.";
+		out_.write(footer, sizeof(footer)); // Including the terminating null
+	}
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <Eigen/Dense>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "tgaimage.h"
+
+/// <summary>
+/// An RGBA texture, converted from a TGAImage when it is loaded into a form that is quick
+/// to sample: a MIP chain of images, each half the size of the one before, with each
+/// level stored in 4x4 tiles of texels so the texels a lookup reads are usually in the same
+/// cache line. Texels are stored either as floats, or as bytes (Format::UNorm8) so that a
+/// tile is exactly one 64 byte cache line.
+/// Texture coordinates run from (0, 0) at the bottom left of the image to (1, 1) at the top
+/// right, and are clamped to the edges of the image.
+/// </summary>
+class Texture
+{
+public:
+	enum class Format
+	{
+		Float, // 16 bytes per texel
+		UNorm8 // 4 bytes per texel, value / 255
+	};
+
+private:
+	static constexpr int TILE_SIZE = 4;
+
+	struct alignas(64) ByteTile
+	{
+		unsigned char texels[TILE_SIZE * TILE_SIZE][4];
+	};
+
+	struct alignas(64) FloatTile
+	{
+		float texels[TILE_SIZE * TILE_SIZE][4];
+	};
+
+	struct Level
+	{
+		int width, height;
+		int tilesX; // Tiles per row of tiles
+		size_t firstTile;
+	};
+
+	Format format_;
+	std::vector<Level> levels_;
+	std::vector<ByteTile> byteTiles_; // Format::UNorm8
+	std::vector<FloatTile> floatTiles_; // Format::Float
+
+	/// <summary>
+	/// Index of the tile holding texel (x, y) of a level, and of the texel within the tile.
+	/// Row 0 is the top row of the image, as in TGAImage.
+	/// </summary>
+	static size_t tileIndex(const Level& level, int x, int y)
+	{
+		return level.firstTile + size_t(y / TILE_SIZE) * level.tilesX + x / TILE_SIZE;
+	}
+
+	static int texelIndex(int x, int y)
+	{
+		return (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+	}
+
+	Eigen::Vector4f texel(const Level& level, int x, int y) const
+	{
+		size_t tile = tileIndex(level, x, y);
+		int i = texelIndex(x, y);
+		if (format_ == Format::Float) {
+			const float* t = floatTiles_[tile].texels[i];
+			return Eigen::Vector4f(t[0], t[1], t[2], t[3]);
+		}
+		const unsigned char* t = byteTiles_[tile].texels[i];
+		return Eigen::Vector4f(t[0], t[1], t[2], t[3]) * (1.f / 255.f);
+	}
+
+	/// <summary>
+	/// Samples one level of the MIP chain, interpolating bilinearly between the four
+	/// nearest texels.
+	/// </summary>
+	Eigen::Vector4f sampleLevel(int l, const Eigen::Vector2f& texCoords) const
+	{
+		const Level& level = levels_[l];
+		float x = texCoords.x() * level.width - 0.5f;
+		float y = (1.f - texCoords.y()) * level.height - 0.5f;
+		float fx = std::floor(x), fy = std::floor(y);
+		float wx = x - fx, wy = y - fy;
+		// Clamp to the edge, so lookups never read outside the image.
+		int x0 = std::clamp(static_cast<int>(fx), 0, level.width - 1), x1 = std::min(x0 + 1, level.width - 1);
+		int y0 = std::clamp(static_cast<int>(fy), 0, level.height - 1), y1 = std::min(y0 + 1, level.height - 1);
+		if (fx < 0.f) x1 = x0;
+		if (fy < 0.f) y1 = y0;
+		Eigen::Vector4f top = (1.f - wx) * texel(level, x0, y0) + wx * texel(level, x1, y0);
+		Eigen::Vector4f bottom = (1.f - wx) * texel(level, x0, y1) + wx * texel(level, x1, y1);
+		return (1.f - wy) * top + wy * bottom;
+	}
+
+	/// <summary>
+	/// Adds a level of the MIP chain, stored in tiles, from texels given row by row.
+	/// </summary>
+	void addLevel(int width, int height, const std::vector<Eigen::Vector4f>& texels)
+	{
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		size_t tiles = size_t(level.tilesX) * tilesY;
+		if (format_ == Format::Float) {
+			level.firstTile = floatTiles_.size();
+			floatTiles_.resize(floatTiles_.size() + tiles, FloatTile());
+		}
+		else {
+			level.firstTile = byteTiles_.size();
+			byteTiles_.resize(byteTiles_.size() + tiles, ByteTile());
+		}
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				const Eigen::Vector4f& value = texels[size_t(y) * width + x];
+				size_t tile = tileIndex(level, x, y);
+				int i = texelIndex(x, y);
+				for (int c = 0; c < 4; ++c) {
+					if (format_ == Format::Float) {
+						floatTiles_[tile].texels[i][c] = value[c];
+					}
+					else {
+						float v = std::min(std::max(value[c], 0.f), 1.f);
+						byteTiles_[tile].texels[i][c] = static_cast<unsigned char>(v * 255.f + 0.5f);
+					}
+				}
+			}
+		}
+		levels_.push_back(level);
+	}
+
+public:
+	/// <summary>
+	/// Converts an image to a texture, building its MIP chain. Each level is filtered from
+	/// the one before in floating point, so the byte format only rounds each level once.
+	/// Greyscale images give the same value in the red, green and blue channels, and images
+	/// without alpha have an alpha of 1.
+	/// </summary>
+	Texture(const TGAImage& image, Format format = Format::Float)
+		:format_(format)
+	{
+		int width = image.get_width(), height = image.get_height();
+		if (width <= 0 || height <= 0) throw std::runtime_error("Can't make a texture from an empty image!");
+		int bytespp = image.get_bytespp();
+
+		std::vector<Eigen::Vector4f> texels(size_t(width) * height);
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				TGAColor c = image.get(x, y);
+				Eigen::Vector4f& t = texels[size_t(y) * width + x];
+				if (bytespp == TGAImage::GRAYSCALE) t = Eigen::Vector4f(c.b, c.b, c.b, 255.f);
+				else t = Eigen::Vector4f(c.r, c.g, c.b, bytespp == TGAImage::RGBA ? c.a : 255.f);
+				t /= 255.f;
+			}
+		}
+		addLevel(width, height, texels);
+
+		// Each level averages 2x2 blocks of the one before. Sizes are halved rounding
+		// down, so an odd sized level's last row or column is left out, except that a side
+		// already one texel across is used twice.
+		while (width > 1 || height > 1) {
+			int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+			std::vector<Eigen::Vector4f> next(size_t(nextWidth) * nextHeight);
+			for (int y = 0; y < nextHeight; ++y) {
+				int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+				for (int x = 0; x < nextWidth; ++x) {
+					int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+					next[size_t(y) * nextWidth + x] = 0.25f * (
+						texels[size_t(y0) * width + x0] + texels[size_t(y0) * width + x1] +
+						texels[size_t(y1) * width + x0] + texels[size_t(y1) * width + x1]);
+				}
+			}
+			texels.swap(next);
+			width = nextWidth;
+			height = nextHeight;
+			addLevel(width, height, texels);
+		}
+	}
+
+	Format format() const
+	{
+		return format_;
+	}
+
+	int width() const
+	{
+		return levels_[0].width;
+	}
+
+	int height() const
+	{
+		return levels_[0].height;
+	}
+
+	int levels() const
+	{
+		return static_cast<int>(levels_.size());
+	}
+
+	/// <summary>
+	/// The MIP level to sample for a lookup covering an area footprint wide, in texture
+	/// coordinates: the level where the footprint is about one texel across.
+	/// </summary>
+	float levelOfDetail(float footprint) const
+	{
+		if (!(footprint > 0.f)) return 0.f;
+		float texels = footprint * std::sqrt(float(width()) * float(height()));
+		return std::min(std::max(std::log2(texels), 0.f), float(levels() - 1));
+	}
+
+	/// <summary>
+	/// Samples the texture with trilinear filtering: bilinearly within the two MIP levels
+	/// either side of lod, blending between them. lod is clamped to the levels there are.
+	/// </summary>
+	Eigen::Vector4f sample(const Eigen::Vector2f& texCoords, float lod = 0.f) const
+	{
+		lod = std::min(std::max(lod, 0.f), float(levels() - 1));
+		int l = static_cast<int>(lod);
+		float w = lod - l;
+		Eigen::Vector4f value = sampleLevel(l, texCoords);
+		if (w > 0.f) value = (1.f - w) * value + w * sampleLevel(l + 1, texCoords);
+		return value;
+	}
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include "Texture.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <iostream>
+
+/// <summary>
+/// Loads textures, keeping one copy of each so shaders that use the same image share it.
+/// Textures can't be changed once they're loaded, so the pointers get() returns can be used
+/// from any number of rendering threads without locking.
+/// get() can also be called from several threads at once while loading a scene: different
+/// files are loaded in parallel, and threads asking for the same file wait for it to be
+/// loaded once.
+/// </summary>
+class TextureCache
+{
+private:
+	struct Entry
+	{
+		std::once_flag loaded;
+		std::unique_ptr<Texture> texture;
+	};
+
+	std::mutex mutex_; // Guards the map, not the entries
+	std::map<std::pair<std::string, Texture::Format>, std::unique_ptr<Entry>> textures_;
+
+public:
+	/// <summary>
+	/// The texture made from the named TGA file, loading it if this is the first time it
+	/// has been asked for in this format. The texture lasts as long as the cache.
+	/// Throws std::runtime_error if the file can't be read.
+	/// </summary>
+	const Texture* get(const std::string& filename, Texture::Format format = Texture::Format::UNorm8)
+	{
+		Entry* entry;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::unique_ptr<Entry>& slot = textures_[std::make_pair(filename, format)];
+			if (!slot) slot = std::make_unique<Entry>();
+			entry = slot.get();
+		}
+		// If loading throws, the entry stays empty and the next call tries again.
+		std::call_once(entry->loaded, [&]() {
+			TGAImage image;
+			if (!image.read_tga_file(filename.c_str())) throw std::runtime_error("Couldn't read texture file " + filename + "!");
+			entry->texture = std::make_unique<Texture>(image, format);
+			std::cout << "Loaded texture " << filename << " (" << entry->texture->width() << "x" << entry->texture->height()
+				<< ", " << entry->texture->levels() << " MIP levels)." << std::endl;
+		});
+		return entry->texture.get();
+	}
+};
@@ -1,18 +1,19 @@
 #pragma once
 #include "Shader.hpp"
-#include "tgaimage.h"
+#include "Texture.hpp"
 
 /// <summary>
 /// Lambertian reflectance shader that samples albedo values from a texture.
-/// The texture should be stored as an image file (TGAImage instance).
+/// The texture is filtered to match the area each hit covers (see Texture), so it doesn't
+/// alias when seen from far away. Textures are usually shared through a TextureCache.
 /// </summary>
 class TexturedLambertianShader : public Shader
 {
 private:
-	const TGAImage* albedoTexture_;
+	const Texture* albedoTexture_;
 	bool shadowTest_;
 public:
-	TexturedLambertianShader(const TGAImage* albedoTexture, bool shadowTest=true)
+	TexturedLambertianShader(const Texture* albedoTexture, bool shadowTest=true)
 		:shadowTest_(shadowTest), albedoTexture_(albedoTexture)
 	{}
 
@@ -23,20 +24,11 @@ public:
 		int currBounceCount,
 		const int maxBounces) const
 	{
-		Eigen::Vector3f albedo;
-
-		Eigen::Vector2f tex = hitInfo.texCoords;
-		int pixX = static_cast<int>(tex.x() * albedoTexture_->get_width());
-		int pixY = static_cast<int>((1.f - tex.y()) * albedoTexture_->get_height());
-		pixX = std::max(pixX, 0);
-		pixY = std::max(pixY, 0);
-		pixX = std::min(pixX, albedoTexture_->get_width());
-		pixY = std::min(pixY, albedoTexture_->get_height());
-		TGAColor albedoTGA = albedoTexture_->get(pixX, pixY);
-
-		albedo.x() = static_cast<float>(albedoTGA.r) / 255.f;
-		albedo.y() = static_cast<float>(albedoTGA.g) / 255.f;
-		albedo.z() = static_cast<float>(albedoTGA.b) / 255.f;
+		// The area of the texture the hit covers: the width of the ray's cone, stretched
+		// where the surface is seen at a grazing angle.
+		float cosine = std::max(std::abs(hitInfo.inDirection.dot(hitInfo.normal)), 0.05f);
+		float footprint = hitInfo.coneWidth * hitInfo.texCoordScale / cosine;
+		Eigen::Vector3f albedo = albedoTexture_->sample(hitInfo.texCoords, albedoTexture_->levelOfDetail(footprint)).head<3>();
 
 		Eigen::Vector3f color = coefftWiseMul(albedo, ambientLight);
 
@@ -18,60 +18,70 @@ public:
 		:Renderable(shader, mask), v0_(v0), v1_(v1), v2_(v2), culling_(culling)
 	{}
 
-
-	virtual bool intersect(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	/// <summary>
+	/// Model space position of vertex 0, 1 or 2.
+	/// </summary>
+	const Eigen::Vector3f& vertex(int i) const
 	{
-		if (!checkMask(mask)) return false;
-		// Intersection code from
-		// https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection.html
-		Eigen::Vector3f v0World = transformPosition(modelToWorld(), v0_);
-		Eigen::Vector3f v1World = transformPosition(modelToWorld(), v1_);
-		Eigen::Vector3f v2World = transformPosition(modelToWorld(), v2_);
-
-		Eigen::Vector3f v0v1 = v1World - v0World;
-		Eigen::Vector3f v0v2 = v2World - v0World;
-		Eigen::Vector3f pvec = ray.direction.cross(v0v2);
-		float det = v0v1.dot(pvec);
-
-		if (culling_) {
-			// if the determinant is negative, the triangle is 'back facing'
-			// if the determinant is close to 0, the ray misses the triangle
-			if (det < 1e-6) return false;
-		}
-		else {
-			// ray and triangle are parallel if det is close to 0
-			if (fabs(det) < 1e-6) return false;
-		}
+		return i == 0 ? v0_ : (i == 1 ? v1_ : v2_);
+	}
 
-		float invDet = 1 / det;
+	bool culling() const
+	{
+		return culling_;
+	}
 
-		Eigen::Vector3f tvec = ray.origin - v0World;
-		float u = tvec.dot(pvec) * invDet;
-		if (u < 0 || u > 1) return false;
+	virtual bool closestHit(const Ray& ray, float minT, float maxT, HitInfo& info, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
 
-		Eigen::Vector3f qvec = tvec.cross(v0v1);
-		float v = ray.direction.dot(qvec) * invDet;
-		if (v < 0 || u + v > 1) return false;
+		Eigen::Vector3f v0World = positionToWorld(v0_);
+		Eigen::Vector3f v0v1 = positionToWorld(v1_) - v0World;
+		Eigen::Vector3f v0v2 = positionToWorld(v2_) - v0World;
 
-		float t = v0v2.dot(qvec) * invDet;
+		float t, u, v;
+		if (!intersectTriangleEdges(ray, v0World, v0v1, v0v2, culling_, t, u, v)) return false;
 
 		if (t < minT || t > maxT) return false;
 
 		info.hitT = t;
+		info.object = this;
+		info.primitive = 0;
+		info.barycentrics = Eigen::Vector2f(u, v);
+		return true;
+	}
+
+	virtual void computeSurface(const Ray& ray, HitInfo& info) const override
+	{
+		Eigen::Vector3f v0World = positionToWorld(v0_);
+		Eigen::Vector3f v0v1 = positionToWorld(v1_) - v0World;
+		Eigen::Vector3f v0v2 = positionToWorld(v2_) - v0World;
+
+		float t = info.hitT;
 		info.inDirection = ray.direction;
 		info.location = ray.origin + t * ray.direction;
 		info.normal = v0v1.cross(v0v2).normalized();
 		info.shader = shader();
-		info.texCoords = Eigen::Vector2f(u, v);
+		info.texCoords = info.barycentrics;
+		info.texCoordScale = triangleTexCoordScale(v0v1, v0v2,
+			Eigen::Vector2f(0.f, 0.f), Eigen::Vector2f(1.f, 0.f), Eigen::Vector2f(0.f, 1.f));
+	}
 
-		return true;
+	virtual bool occluded(const Ray& ray, float minT, float maxT, IntersectMask mask) const override
+	{
+		if (!checkMask(mask)) return false;
+
+		float t, u, v;
+		if (!intersectTriangle(ray, positionToWorld(v0_), positionToWorld(v1_),
+			positionToWorld(v2_), culling_, t, u, v)) return false;
+		return t >= minT && t <= maxT;
 	}
 
 	virtual AABB getAABB() const override
 	{
-		Eigen::Vector3f v0World = transformPosition(modelToWorld(), v0_);
-		Eigen::Vector3f v1World = transformPosition(modelToWorld(), v1_);
-		Eigen::Vector3f v2World = transformPosition(modelToWorld(), v2_);
+		Eigen::Vector3f v0World = positionToWorld(v0_);
+		Eigen::Vector3f v1World = positionToWorld(v1_);
+		Eigen::Vector3f v2World = positionToWorld(v2_);
 
 		AABB aabb;
 		aabb.min = v0World;
@@ -0,0 +1,590 @@
+#pragma once
+#include "AABB.hpp"
+#include "Ray.hpp"
+#include "BVHBuildTypes.hpp"
+#include "CpuFeatures.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <stdexcept>
+
+/// <summary>
+/// A node of a WideBVH, with up to Width children. The bounds of the children are stored
+/// as a structure of arrays (all the min x values together, then all the min y values
+/// etc.), so a single SIMD instruction can process the same coordinate of every child.
+/// Each child is either another node (count == 0, child is the node index) or a leaf
+/// (child is the first primitive, count the number of primitives). Unused slots have
+/// empty (inverted) bounds, so rays never hit them.
+/// </summary>
+template <int Width>
+struct alignas(32) WideBVHNode
+{
+	typedef float Bounds[6][Width];
+	typedef uint32_t Count;
+
+	Bounds bounds; // min x, min y, min z, max x, max y, max z of each child.
+	uint32_t child[Width];
+	Count count[Width];
+
+	AABB slotBounds(int slot) const
+	{
+		AABB aabb;
+		aabb.min = Eigen::Vector3f(bounds[0][slot], bounds[1][slot], bounds[2][slot]);
+		aabb.max = Eigen::Vector3f(bounds[3][slot], bounds[4][slot], bounds[5][slot]);
+		return aabb;
+	}
+
+	/// <summary>
+	/// Sets the bounds of all Width children at once.
+	/// </summary>
+	void setBounds(const AABB* slotBounds)
+	{
+		for (int slot = 0; slot < Width; ++slot) {
+			for (int a = 0; a < 3; ++a) {
+				bounds[a][slot] = slotBounds[slot].min[a];
+				bounds[3 + a][slot] = slotBounds[slot].max[a];
+			}
+		}
+	}
+
+	/// <summary>
+	/// The children's bounds as floats, for the box tests. scratch is only needed by
+	/// nodes that have to decode them.
+	/// </summary>
+	const Bounds& decodeBounds([[maybe_unused]] Bounds& scratch) const
+	{
+		return bounds;
+	}
+
+	/// <summary>
+	/// Bit mask of the slots that may be hit. Unused slots have empty bounds, so all are included.
+	/// </summary>
+	int slotMask() const
+	{
+		return (1 << Width) - 1;
+	}
+};
+static_assert(sizeof(WideBVHNode<4>) == 128, "WideBVHNode<4> should be 128 bytes.");
+static_assert(sizeof(WideBVHNode<8>) == 256, "WideBVHNode<8> should be 256 bytes.");
+
+/// <summary>
+/// A compressed node of a WideBVH, half the size of a WideBVHNode. The children's bounds
+/// are stored as 8 bit integers on a grid covering the node's own bounds: origin is the
+/// minimum corner, and the grid spacing on each axis is a power of two, 2^exponent, so
+/// child bounds decode to origin + q * 2^exponent. Bounds are rounded outwards when they
+/// are quantised, so the decoded boxes always contain the real ones and traversal is still
+/// exact, if a little less efficient. Child offsets stay 32 bit; leaves are limited to
+/// 65535 primitives.
+/// </summary>
+template <int Width>
+struct alignas(64) CompressedWideBVHNode
+{
+	typedef float Bounds[6][Width];
+	typedef uint16_t Count;
+
+	float origin[3];
+	int8_t exponent[3];
+	uint8_t emptySlots; // Bit mask of unused slots.
+	uint8_t qbounds[6][Width]; // Quantised min x, min y, min z, max x, max y, max z of each child.
+	uint32_t child[Width];
+	Count count[Width];
+
+	float scale(int axis) const
+	{
+		// Build the float 2^exponent directly from its bits.
+		uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+		float s;
+		std::memcpy(&s, &bits, sizeof(s));
+		return s;
+	}
+
+	float decode(int axis, uint8_t q) const
+	{
+		// q * scale is exact, so this rounds once however the compiler evaluates it.
+		return origin[axis] + q * scale(axis);
+	}
+
+	bool isEmptySlot(int slot) const
+	{
+		return (emptySlots >> slot) & 1;
+	}
+
+	AABB slotBounds(int slot) const
+	{
+		if (isEmptySlot(slot)) return AABB::empty();
+		AABB aabb;
+		for (int a = 0; a < 3; ++a) {
+			aabb.min[a] = decode(a, qbounds[a][slot]);
+			aabb.max[a] = decode(a, qbounds[3 + a][slot]);
+		}
+		return aabb;
+	}
+
+	/// <summary>
+	/// Sets the bounds of all Width children at once. The node's grid is fitted to the
+	/// union of the children, so this can't be done one child at a time.
+	/// </summary>
+	void setBounds(const AABB* slotBounds)
+	{
+		AABB nodeBounds = AABB::empty();
+		for (int slot = 0; slot < Width; ++slot) {
+			nodeBounds.expand(slotBounds[slot]);
+		}
+		if (nodeBounds.isEmpty()) nodeBounds.min = nodeBounds.max = Eigen::Vector3f::Zero();
+
+		for (int a = 0; a < 3; ++a) {
+			origin[a] = nodeBounds.min[a];
+			// Smallest grid spacing for which 255 steps reach the far side of the node.
+			float extent = nodeBounds.max[a] - nodeBounds.min[a];
+			int e = extent > 0.f ? static_cast<int>(std::ceil(std::log2(extent / 255.f))) : -126;
+			exponent[a] = static_cast<int8_t>(std::max(e, -126));
+			while (decode(a, 255) < nodeBounds.max[a]) {
+				if (exponent[a] == 127) throw std::runtime_error("BVH node bounds are too large to be compressed!");
+				++exponent[a];
+			}
+		}
+		emptySlots = 0;
+
+		for (int slot = 0; slot < Width; ++slot) {
+			const AABB& aabb = slotBounds[slot];
+			if (aabb.isEmpty()) {
+				for (int a = 0; a < 3; ++a) {
+					qbounds[a][slot] = 255;
+					qbounds[3 + a][slot] = 0;
+				}
+				emptySlots |= 1 << slot;
+				continue;
+			}
+			for (int a = 0; a < 3; ++a) {
+				float s = scale(a);
+				int qMin = static_cast<int>(std::floor((aabb.min[a] - origin[a]) / s));
+				int qMax = static_cast<int>(std::ceil((aabb.max[a] - origin[a]) / s));
+				qMin = std::min(std::max(qMin, 0), 255);
+				qMax = std::min(std::max(qMax, 0), 255);
+				// Make sure rounding in the division never moves a bound inwards.
+				while (qMin > 0 && decode(a, qMin) > aabb.min[a]) --qMin;
+				while (qMax < 255 && decode(a, qMax) < aabb.max[a]) ++qMax;
+				qbounds[a][slot] = static_cast<uint8_t>(qMin);
+				qbounds[3 + a][slot] = static_cast<uint8_t>(qMax);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Decodes the children's bounds to floats, for the box tests. Unused slots decode to
+	/// arbitrary boxes, so are left out by slotMask instead.
+	/// </summary>
+	const Bounds& decodeBounds(Bounds& scratch) const
+	{
+		for (int row = 0; row < 6; ++row) {
+			int a = row % 3;
+			float o = origin[a], s = scale(a);
+#ifdef HAS_X86_SIMD
+			// Widen 4 bytes at a time to 32 bit integers and convert (SSE2 only).
+			__m128 vo = _mm_set1_ps(o), vs = _mm_set1_ps(s);
+			__m128i zero = _mm_setzero_si128();
+			for (int slot = 0; slot < Width; slot += 4) {
+				int32_t packed;
+				std::memcpy(&packed, &qbounds[row][slot], sizeof(packed));
+				__m128i q = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+				_mm_storeu_ps(&scratch[row][slot], _mm_add_ps(vo, _mm_mul_ps(_mm_cvtepi32_ps(q), vs)));
+			}
+#else
+			for (int slot = 0; slot < Width; ++slot) {
+				scratch[row][slot] = o + qbounds[row][slot] * s;
+			}
+#endif
+		}
+		return scratch;
+	}
+
+	int slotMask() const
+	{
+		return ~emptySlots & ((1 << Width) - 1);
+	}
+};
+static_assert(sizeof(CompressedWideBVHNode<4>) == 64, "CompressedWideBVHNode<4> should be 64 bytes.");
+static_assert(sizeof(CompressedWideBVHNode<8>) == 128, "CompressedWideBVHNode<8> should be 128 bytes.");
+
+/// <summary>
+/// A multi-branching (4- or 8-wide) BVH made by collapsing the binary tree from BVHBuilder.
+/// Each node tests the ray against all of its children's boxes at once with SSE (4-wide)
+/// or AVX (8-wide) instructions, falling back to a scalar loop if the CPU doesn't support
+/// them. Hit children are visited nearest first.
+/// As with LinearBVH, only the hierarchy is stored here: leaves refer to contiguous ranges
+/// of the primitive list that was passed to the builder.
+/// If Compressed is set, nodes store quantised child bounds (see CompressedWideBVHNode),
+/// halving the memory used by the hierarchy.
+/// </summary>
+template <int Width, bool Compressed = false>
+class WideBVH
+{
+	static_assert(Width == 4 || Width == 8, "WideBVH supports 4 or 8 children per node.");
+
+public:
+	typedef typename std::conditional<Compressed, CompressedWideBVHNode<Width>, WideBVHNode<Width>>::type Node;
+	typedef typename Node::Bounds Bounds;
+	static constexpr int MAX_STACK_DEPTH = 128;
+
+private:
+	std::vector<Node> nodes_;
+	AABB bounds_;
+	bool useSIMD_;
+
+	/// <summary>
+	/// Per-ray values needed by the box tests, computed once per ray.
+	/// </summary>
+	struct RayData
+	{
+		float origin[3], invDir[3], originTimesInvDir[3];
+		int nearIndex[3], farIndex[3]; // Rows of Node::bounds holding the near and far planes on each axis.
+	};
+
+	struct StackEntry
+	{
+		uint32_t child, count;
+		float tEntry;
+	};
+
+	/// <summary>
+	/// Bounds of all children of a node. Unused slots have empty bounds, so don't contribute.
+	/// </summary>
+	static AABB nodeBounds(const Node& node)
+	{
+		AABB aabb = AABB::empty();
+		for (int slot = 0; slot < Width; ++slot) {
+			aabb.expand(node.slotBounds(slot));
+		}
+		return aabb;
+	}
+
+	/// <summary>
+	/// Whether a slot refers to a child node. The root is never a child, so unused slots
+	/// (child and count both 0) can't be mistaken for a child node.
+	/// </summary>
+	static bool isInteriorSlot(const Node& node, int slot)
+	{
+		return node.count[slot] == 0 && node.child[slot] != 0;
+	}
+
+	/// <summary>
+	/// Makes a wide node from a binary build node, by repeatedly replacing the interior child
+	/// with the largest surface area with its own two children, until there are Width
+	/// children (or all are leaves). Returns the index of the new node.
+	/// </summary>
+	int collapseRecursive(const BVHBuildNode& buildNode, int depth)
+	{
+		if (depth >= MAX_STACK_DEPTH) {
+			throw std::runtime_error("BVH is too deep to be converted to a WideBVH!");
+		}
+
+		const BVHBuildNode* children[Width];
+		int nChildren = 0;
+		if (buildNode.isLeaf()) {
+			children[nChildren++] = &buildNode;
+		}
+		else {
+			children[nChildren++] = buildNode.children[0].get();
+			children[nChildren++] = buildNode.children[1].get();
+		}
+		while (nChildren < Width) {
+			int largest = -1;
+			float largestArea = -1.f;
+			for (int c = 0; c < nChildren; ++c) {
+				if (!children[c]->isLeaf() && children[c]->bounds.surfaceArea() > largestArea) {
+					largest = c;
+					largestArea = children[c]->bounds.surfaceArea();
+				}
+			}
+			if (largest < 0) break;
+			const BVHBuildNode* expanded = children[largest];
+			children[largest] = expanded->children[0].get();
+			children[nChildren++] = expanded->children[1].get();
+		}
+
+		int index = static_cast<int>(nodes_.size());
+		nodes_.emplace_back();
+		Node node;
+		AABB slotBounds[Width];
+		for (int slot = 0; slot < Width; ++slot) {
+			slotBounds[slot] = AABB::empty();
+			node.child[slot] = 0;
+			node.count[slot] = 0;
+		}
+		for (int c = 0; c < nChildren; ++c) {
+			const BVHBuildNode& child = *children[c];
+			slotBounds[c] = child.bounds;
+			if (child.isLeaf()) {
+				if (static_cast<uint32_t>(child.primCount) > std::numeric_limits<typename Node::Count>::max()) {
+					throw std::runtime_error("Too many primitives in a BVH leaf! Try increasing maxDepth.");
+				}
+				node.child[c] = static_cast<uint32_t>(child.primOffset);
+				node.count[c] = static_cast<typename Node::Count>(child.primCount);
+			}
+			else {
+				node.child[c] = static_cast<uint32_t>(collapseRecursive(child, depth + 1));
+			}
+		}
+		node.setBounds(slotBounds);
+		nodes_[index] = node;
+		return index;
+	}
+
+	/// <summary>
+	/// Tests the ray against the boxes of all children of a node. Returns a bit mask of
+	/// the children hit, and writes the distance at which the ray enters each box to tEntry.
+	/// </summary>
+	static int intersectChildrenScalar(const Bounds& bounds, const RayData& ray, float minT, float maxT, float* tEntry)
+	{
+		int hitMask = 0;
+		for (int c = 0; c < Width; ++c) {
+			float tNear = minT, tFar = maxT;
+			for (int a = 0; a < 3; ++a) {
+				float t0 = (bounds[ray.nearIndex[a]][c] - ray.origin[a]) * ray.invDir[a];
+				float t1 = (bounds[ray.farIndex[a]][c] - ray.origin[a]) * ray.invDir[a];
+				if (t0 > tNear) tNear = t0;
+				if (t1 < tFar) tFar = t1;
+			}
+			tEntry[c] = tNear;
+			if (tNear <= tFar) hitMask |= 1 << c;
+		}
+		return hitMask;
+	}
+
+#ifdef HAS_X86_SIMD
+	// Note when the ray is parallel to an axis, (bound - origin) * invDir can be NaN.
+	// The SSE/AVX min and max instructions return their second operand if either is NaN,
+	// so the running tNear/tFar are always passed second to ignore those planes.
+
+	static int intersectChildrenSSE(const float (&bounds)[6][4], const RayData& ray, float minT, float maxT, float* tEntry)
+	{
+		__m128 tNear = _mm_set1_ps(minT), tFar = _mm_set1_ps(maxT);
+		for (int a = 0; a < 3; ++a) {
+			__m128 invDir = _mm_set1_ps(ray.invDir[a]);
+			__m128 originTimesInvDir = _mm_set1_ps(ray.originTimesInvDir[a]);
+			__m128 t0 = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(bounds[ray.nearIndex[a]]), invDir), originTimesInvDir);
+			__m128 t1 = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(bounds[ray.farIndex[a]]), invDir), originTimesInvDir);
+			tNear = _mm_max_ps(t0, tNear);
+			tFar = _mm_min_ps(t1, tFar);
+		}
+		_mm_storeu_ps(tEntry, tNear);
+		return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+	}
+
+	SIMD_TARGET_AVX
+	static int intersectChildrenAVX(const float (&bounds)[6][8], const RayData& ray, float minT, float maxT, float* tEntry)
+	{
+		__m256 tNear = _mm256_set1_ps(minT), tFar = _mm256_set1_ps(maxT);
+		for (int a = 0; a < 3; ++a) {
+			__m256 invDir = _mm256_set1_ps(ray.invDir[a]);
+			__m256 originTimesInvDir = _mm256_set1_ps(ray.originTimesInvDir[a]);
+			__m256 t0 = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(bounds[ray.nearIndex[a]]), invDir), originTimesInvDir);
+			__m256 t1 = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(bounds[ray.farIndex[a]]), invDir), originTimesInvDir);
+			tNear = _mm256_max_ps(t0, tNear);
+			tFar = _mm256_min_ps(t1, tFar);
+		}
+		_mm256_storeu_ps(tEntry, tNear);
+		return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+	}
+
+	static int intersectChildrenSIMD(const float (&bounds)[6][4], const RayData& ray, float minT, float maxT, float* tEntry)
+	{
+		return intersectChildrenSSE(bounds, ray, minT, maxT, tEntry);
+	}
+
+	static int intersectChildrenSIMD(const float (&bounds)[6][8], const RayData& ray, float minT, float maxT, float* tEntry)
+	{
+		return intersectChildrenAVX(bounds, ray, minT, maxT, tEntry);
+	}
+#endif
+
+	int intersectChildren(const Node& node, const RayData& ray, float minT, float maxT, float* tEntry) const
+	{
+		Bounds scratch;
+		const Bounds& bounds = node.decodeBounds(scratch);
+#ifdef HAS_X86_SIMD
+		if (useSIMD_) return intersectChildrenSIMD(bounds, ray, minT, maxT, tEntry) & node.slotMask();
+#endif
+		return intersectChildrenScalar(bounds, ray, minT, maxT, tEntry) & node.slotMask();
+	}
+
+public:
+	WideBVH()
+		:bounds_(AABB::empty()), useSIMD_(false)
+	{}
+
+	/// <summary>
+	/// Collapses a tree made by BVHBuilder into a WideBVH. The primitive ranges of the
+	/// leaves are kept unchanged, so they refer to the primitive list passed to the builder.
+	/// </summary>
+	explicit WideBVH(const BVHBuildNode& root)
+		:bounds_(root.bounds)
+	{
+		// SSE is part of the x86-64 baseline; 8-wide nodes need AVX.
+#ifdef HAS_X86_SIMD
+		useSIMD_ = Width == 4 || CpuFeatures::get().avx;
+#else
+		useSIMD_ = false;
+#endif
+		collapseRecursive(root, 0);
+	}
+
+	const std::vector<Node>& nodes() const
+	{
+		return nodes_;
+	}
+
+	AABB getAABB() const
+	{
+		return bounds_;
+	}
+
+	/// <summary>
+	/// Recomputes the bounds of all nodes after the primitives have moved, keeping the
+	/// structure of the tree unchanged. See LinearBVH::refit.
+	/// </summary>
+	template <typename LeafBounds>
+	void refit(LeafBounds&& leafBounds)
+	{
+		int nNodes = static_cast<int>(nodes_.size());
+
+		// The new bounds of every slot are gathered first, as a compressed node can only be
+		// set once the bounds of all its children are known.
+		std::vector<AABB> slotBounds(static_cast<size_t>(nNodes) * Width, AABB::empty());
+
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < nNodes; ++i) {
+			const Node& node = nodes_[i];
+			for (int slot = 0; slot < Width; ++slot) {
+				if (node.count[slot] > 0)
+					slotBounds[static_cast<size_t>(i) * Width + slot] = leafBounds(static_cast<int>(node.child[slot]), static_cast<int>(node.count[slot]));
+			}
+		}
+
+		// Child nodes are always stored after their parent.
+		for (int i = nNodes - 1; i >= 0; --i) {
+			Node& node = nodes_[i];
+			for (int slot = 0; slot < Width; ++slot) {
+				if (!isInteriorSlot(node, slot)) continue;
+				AABB& bounds = slotBounds[static_cast<size_t>(i) * Width + slot];
+				for (int childSlot = 0; childSlot < Width; ++childSlot) {
+					bounds.expand(slotBounds[static_cast<size_t>(node.child[slot]) * Width + childSlot]);
+				}
+			}
+			node.setBounds(&slotBounds[static_cast<size_t>(i) * Width]);
+		}
+
+		bounds_ = AABB::empty();
+		for (int slot = 0; slot < Width && nNodes > 0; ++slot) {
+			bounds_.expand(slotBounds[slot]);
+		}
+	}
+
+	/// <summary>
+	/// Estimated cost of tracing a ray through the tree with the Surface Area Heuristic.
+	/// Testing all the children of a node counts as a single traversal step.
+	/// </summary>
+	float sahCost(float traversalCost, float intersectionCost) const
+	{
+		float rootArea = bounds_.surfaceArea();
+		if (rootArea <= 0.f) return 0.f;
+		double cost = 0.0;
+		for (const Node& node : nodes_) {
+			cost += traversalCost * nodeBounds(node).surfaceArea();
+			for (int slot = 0; slot < Width; ++slot) {
+				if (node.count[slot] > 0)
+					cost += intersectionCost * node.count[slot] * node.slotBounds(slot).surfaceArea();
+			}
+		}
+		return static_cast<float>(cost / rootArea);
+	}
+
+	/// <summary>
+	/// Finds the closest hit along the ray, calling intersectLeaf(firstPrim, primCount, maxT)
+	/// for each leaf the ray reaches, as for LinearBVH::intersect.
+	/// </summary>
+	template <typename LeafIntersector>
+	bool intersect(const Ray& ray, float minT, float maxT, LeafIntersector&& intersectLeaf) const
+	{
+		return traverse<false>(ray, minT, maxT, intersectLeaf);
+	}
+
+	/// <summary>
+	/// Checks whether anything blocks the ray between minT and maxT. occludedLeaf(firstPrim,
+	/// primCount) is called for each leaf the ray reaches, and should return true if any of
+	/// its primitives are hit. The search stops at the first leaf that returns true.
+	/// </summary>
+	template <typename LeafOccluder>
+	bool occluded(const Ray& ray, float minT, float maxT, LeafOccluder&& occludedLeaf) const
+	{
+		return traverse<true>(ray, minT, maxT, [&](int first, int count, float&) { return occludedLeaf(first, count); });
+	}
+
+private:
+	/// <summary>
+	/// Traversal shared by intersect and occluded. If AnyHit is set, it stops at the
+	/// first leaf that reports a hit.
+	/// </summary>
+	template <bool AnyHit, typename LeafIntersector>
+	bool traverse(const Ray& ray, float minT, float maxT, LeafIntersector&& intersectLeaf) const
+	{
+		if (nodes_.empty()) return false;
+
+		RayData rayData;
+		for (int a = 0; a < 3; ++a) {
+			rayData.origin[a] = ray.origin[a];
+			rayData.invDir[a] = 1.f / ray.direction[a];
+			rayData.originTimesInvDir[a] = ray.origin[a] * rayData.invDir[a];
+			bool negative = rayData.invDir[a] < 0;
+			rayData.nearIndex[a] = negative ? 3 + a : a;
+			rayData.farIndex[a] = negative ? a : 3 + a;
+		}
+
+		StackEntry stack[MAX_STACK_DEPTH * (Width - 1) + 1];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, minT };
+		bool hitSomething = false;
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+			// Skip anything that starts beyond the closest hit found since it was pushed.
+			if (entry.tEntry > maxT) continue;
+
+			if (entry.count > 0) {
+				if (intersectLeaf(static_cast<int>(entry.child), static_cast<int>(entry.count), maxT)) {
+					hitSomething = true;
+					if (AnyHit) return true;
+				}
+				continue;
+			}
+
+			const Node& node = nodes_[entry.child];
+			float tEntry[Width];
+			int hitMask = intersectChildren(node, rayData, minT, maxT, tEntry);
+			if (!hitMask) continue;
+
+			// Sort the hit children far to near, then push them so the nearest is popped first.
+			int hitChildren[Width];
+			int nHits = 0;
+			for (int c = 0; c < Width; ++c) {
+				if (!(hitMask & (1 << c))) continue;
+				int pos = nHits++;
+				while (pos > 0 && tEntry[hitChildren[pos - 1]] < tEntry[c]) {
+					hitChildren[pos] = hitChildren[pos - 1];
+					--pos;
+				}
+				hitChildren[pos] = c;
+			}
+			for (int h = 0; h < nHits; ++h) {
+				int c = hitChildren[h];
+				stack[stackSize++] = { node.child[c], node.count[c], tEntry[c] };
+			}
+		}
+
+		return hitSomething;
+	}
+};
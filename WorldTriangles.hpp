@@ -0,0 +1,272 @@
+#pragma once
+#include "Entity.hpp"
+#include "Model.hpp"
+#include "GeomUtil.hpp"
+#include "CpuFeatures.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+/// <summary>
+/// World space copies of a list of mesh triangles, for meshes that test triangles one at
+/// a time. The first vertex and the two edges leaving it are baked when the mesh's
+/// transform is set and stored as structure-of-arrays, so testing a triangle only loads
+/// floats and does arithmetic. World space vertex normals are cached too if the model has
+/// normals. Call bake() again after changing the transform or the model's vertices.
+/// Ranges of triangles (e.g. BVH leaves) are tested 8 (AVX) or 4 (SSE) at a time where
+/// the CPU supports it, with the same results as the scalar intersectTriangle.
+/// </summary>
+class WorldTriangles
+{
+private:
+	// The arrays are padded with degenerate triangles so SIMD code can always load a
+	// whole packet, starting from any triangle.
+	static constexpr int PADDING = 7;
+
+	std::vector<float> v0x_, v0y_, v0z_; // First vertex.
+	std::vector<float> e1x_, e1y_, e1z_; // Edge from the first to the second vertex.
+	std::vector<float> e2x_, e2y_, e2z_; // Edge from the first to the third vertex.
+	std::vector<Eigen::Vector3f> normals_; // Three per triangle, if the model has normals.
+	int size_ = 0;
+	int simdWidth_ = 1;
+
+	/// <summary>
+	/// Picks the closest of the lanes in hitMask. Ties go to the lowest lane, as if the
+	/// triangles had been tested one at a time in order.
+	/// </summary>
+	static int closestLane(int hitMask, const float* t)
+	{
+		int best = -1;
+		for (int lane = 0; hitMask; ++lane, hitMask >>= 1) {
+			if ((hitMask & 1) && (best == -1 || t[lane] < t[best])) best = lane;
+		}
+		return best;
+	}
+
+#ifdef HAS_X86_SIMD
+	// These follow intersectTriangleEdges operation for operation, so results are bit for
+	// bit the same. Note det < 1e-6 there is a double comparison, i.e. det <= 1e-6f, and
+	// dot products are summed as x + (y + z) like Eigen does for 3-vectors.
+
+	int intersectPacketSSE(const Ray& ray, int first, bool culling, float minT, float maxT,
+		float* tOut, float* uOut, float* vOut) const
+	{
+		__m128 dx = _mm_set1_ps(ray.direction.x()), dy = _mm_set1_ps(ray.direction.y()), dz = _mm_set1_ps(ray.direction.z());
+		__m128 e1x = _mm_loadu_ps(&e1x_[first]), e1y = _mm_loadu_ps(&e1y_[first]), e1z = _mm_loadu_ps(&e1z_[first]);
+		__m128 e2x = _mm_loadu_ps(&e2x_[first]), e2y = _mm_loadu_ps(&e2y_[first]), e2z = _mm_loadu_ps(&e2z_[first]);
+
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_mul_ps(e1x, px), _mm_add_ps(_mm_mul_ps(e1y, py), _mm_mul_ps(e1z, pz)));
+
+		__m128 epsilon = _mm_set1_ps(1e-6f);
+		__m128 miss = culling ? _mm_cmple_ps(det, epsilon)
+			: _mm_cmple_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), det), epsilon);
+
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+		__m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x()), _mm_loadu_ps(&v0x_[first]));
+		__m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y()), _mm_loadu_ps(&v0y_[first]));
+		__m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z()), _mm_loadu_ps(&v0z_[first]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_add_ps(_mm_mul_ps(ty, py), _mm_mul_ps(tz, pz))), invDet);
+		__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_add_ps(_mm_mul_ps(dy, qy), _mm_mul_ps(dz, qz))), invDet);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_add_ps(_mm_mul_ps(e2y, qy), _mm_mul_ps(e2z, qz))), invDet);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(t, _mm_set1_ps(minT)), _mm_cmpgt_ps(t, _mm_set1_ps(maxT))));
+
+		_mm_storeu_ps(tOut, t);
+		_mm_storeu_ps(uOut, u);
+		_mm_storeu_ps(vOut, v);
+		return ~_mm_movemask_ps(miss) & 0xf;
+	}
+
+	SIMD_TARGET_AVX
+	int intersectPacketAVX(const Ray& ray, int first, bool culling, float minT, float maxT,
+		float* tOut, float* uOut, float* vOut) const
+	{
+		__m256 dx = _mm256_set1_ps(ray.direction.x()), dy = _mm256_set1_ps(ray.direction.y()), dz = _mm256_set1_ps(ray.direction.z());
+		__m256 e1x = _mm256_loadu_ps(&e1x_[first]), e1y = _mm256_loadu_ps(&e1y_[first]), e1z = _mm256_loadu_ps(&e1z_[first]);
+		__m256 e2x = _mm256_loadu_ps(&e2x_[first]), e2y = _mm256_loadu_ps(&e2y_[first]), e2z = _mm256_loadu_ps(&e2z_[first]);
+
+		__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+		__m256 det = _mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_add_ps(_mm256_mul_ps(e1y, py), _mm256_mul_ps(e1z, pz)));
+
+		__m256 epsilon = _mm256_set1_ps(1e-6f);
+		__m256 miss = culling ? _mm256_cmp_ps(det, epsilon, _CMP_LE_OQ)
+			: _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), det), epsilon, _CMP_LE_OQ);
+
+		__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+		__m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x()), _mm256_loadu_ps(&v0x_[first]));
+		__m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y()), _mm256_loadu_ps(&v0y_[first]));
+		__m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z()), _mm256_loadu_ps(&v0z_[first]));
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_add_ps(_mm256_mul_ps(ty, py), _mm256_mul_ps(tz, pz))), invDet);
+		__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)));
+
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+		__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_add_ps(_mm256_mul_ps(dy, qy), _mm256_mul_ps(dz, qz))), invDet);
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+
+		__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_add_ps(_mm256_mul_ps(e2y, qy), _mm256_mul_ps(e2z, qz))), invDet);
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(t, _mm256_set1_ps(minT), _CMP_LT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(maxT), _CMP_GT_OQ)));
+
+		_mm256_storeu_ps(tOut, t);
+		_mm256_storeu_ps(uOut, u);
+		_mm256_storeu_ps(vOut, v);
+		return ~_mm256_movemask_ps(miss) & 0xff;
+	}
+#endif
+
+	/// <summary>
+	/// Tests the packet of simdWidth_ triangles starting at first, returning a bit mask of
+	/// the ones hit with t in [minT, maxT].
+	/// </summary>
+	int intersectPacket(const Ray& ray, int first, bool culling, float minT, float maxT,
+		float* t, float* u, float* v) const
+	{
+#ifdef HAS_X86_SIMD
+		if (simdWidth_ == 8) return intersectPacketAVX(ray, first, culling, minT, maxT, t, u, v);
+		if (simdWidth_ == 4) return intersectPacketSSE(ray, first, culling, minT, maxT, t, u, v);
+#endif
+		if (!intersect(first, ray, culling, t[0], u[0], v[0])) return 0;
+		return t[0] >= minT && t[0] <= maxT ? 1 : 0;
+	}
+
+public:
+	WorldTriangles()
+	{
+		// SSE is part of the x86-64 baseline; 8-wide packets need AVX.
+#ifdef HAS_X86_SIMD
+		simdWidth_ = CpuFeatures::get().avx ? 8 : 4;
+#endif
+	}
+
+	/// <param name="model">The model the triangles' vertices and normals come from.</param>
+	/// <param name="triangles">Vertex indices of the triangles, three entries per triangle.</param>
+	/// <param name="transform">The entity whose modelToWorld transform places the triangles.</param>
+	void bake(const Model& model, const std::vector<VertexIndices>& triangles, const Entity& transform)
+	{
+		if (triangles.size() % 3 != 0) {
+			throw std::runtime_error("WorldTriangles needs three vertex indices per triangle!");
+		}
+		size_ = (int)triangles.size() / 3;
+		for (auto* a : { &v0x_, &v0y_, &v0z_, &e1x_, &e1y_, &e1z_, &e2x_, &e2y_, &e2z_ }) {
+			a->assign(size_ + PADDING, 0.f);
+		}
+		normals_.resize(model.hasNormals() ? triangles.size() : 0);
+
+		for (int tri = 0; tri < size_; ++tri) {
+			const VertexIndices* face = &triangles[3 * tri];
+			Eigen::Vector3f v0 = transform.positionToWorld(model.vert(face[0].vert));
+			Eigen::Vector3f v0v1 = transform.positionToWorld(model.vert(face[1].vert)) - v0;
+			Eigen::Vector3f v0v2 = transform.positionToWorld(model.vert(face[2].vert)) - v0;
+			v0x_[tri] = v0.x(); v0y_[tri] = v0.y(); v0z_[tri] = v0.z();
+			e1x_[tri] = v0v1.x(); e1y_[tri] = v0v1.y(); e1z_[tri] = v0v1.z();
+			e2x_[tri] = v0v2.x(); e2y_[tri] = v0v2.y(); e2z_[tri] = v0v2.z();
+			if (!normals_.empty()) {
+				for (int v = 0; v < 3; ++v) {
+					normals_[3 * tri + v] = transform.normalToWorld(model.normal(face[v].norm));
+				}
+			}
+		}
+	}
+
+	int size() const
+	{
+		return size_;
+	}
+
+	/// <summary>
+	/// World space normal of the triangle's plane (not interpolated from vertex normals).
+	/// </summary>
+	Eigen::Vector3f faceNormal(int tri) const
+	{
+		Eigen::Vector3f v0v1(e1x_[tri], e1y_[tri], e1z_[tri]);
+		Eigen::Vector3f v0v2(e2x_[tri], e2y_[tri], e2z_[tri]);
+		return v0v1.cross(v0v2).normalized();
+	}
+
+	/// <summary>
+	/// See triangleTexCoordScale in GeomUtil.
+	/// </summary>
+	float texCoordScale(int tri, const Eigen::Vector2f& t0, const Eigen::Vector2f& t1, const Eigen::Vector2f& t2) const
+	{
+		return triangleTexCoordScale(
+			Eigen::Vector3f(e1x_[tri], e1y_[tri], e1z_[tri]),
+			Eigen::Vector3f(e2x_[tri], e2y_[tri], e2z_[tri]),
+			t0, t1, t2);
+	}
+
+	/// <summary>
+	/// Normal at the given barycentric coordinates, interpolated from the vertex normals if
+	/// the model has them.
+	/// </summary>
+	Eigen::Vector3f normal(int tri, float u, float v) const
+	{
+		if (normals_.empty()) return faceNormal(tri);
+		return ((1 - (u + v)) * normals_[3 * tri] + u * normals_[3 * tri + 1] + v * normals_[3 * tri + 2]).normalized();
+	}
+
+	/// <summary>
+	/// Intersect a ray with one triangle (see intersectTriangleEdges in GeomUtil).
+	/// </summary>
+	bool intersect(int tri, const Ray& ray, bool culling, float& t, float& u, float& v) const
+	{
+		return intersectTriangleEdges(ray,
+			Eigen::Vector3f(v0x_[tri], v0y_[tri], v0z_[tri]),
+			Eigen::Vector3f(e1x_[tri], e1y_[tri], e1z_[tri]),
+			Eigen::Vector3f(e2x_[tri], e2y_[tri], e2z_[tri]),
+			culling, t, u, v);
+	}
+
+	/// <summary>
+	/// Finds the closest hit with t in [minT, maxT] among triangles first to first + count - 1.
+	/// Returns the index of the triangle hit, or -1 if there isn't one. On a hit, maxT is
+	/// set to its distance and u, v to its barycentric coordinates.
+	/// </summary>
+	int intersectRange(const Ray& ray, int first, int count, bool culling, float minT, float& maxT, float& u, float& v) const
+	{
+		float tPacket[8], uPacket[8], vPacket[8];
+		int closest = -1;
+		for (int base = first; base < first + count; base += simdWidth_) {
+			int lanes = std::min(simdWidth_, first + count - base);
+			int hitMask = intersectPacket(ray, base, culling, minT, maxT, tPacket, uPacket, vPacket) & ((1 << lanes) - 1);
+			if (!hitMask) continue;
+			int lane = closestLane(hitMask, tPacket);
+			if (closest != -1 && tPacket[lane] >= maxT) continue;
+			closest = base + lane;
+			maxT = tPacket[lane];
+			u = uPacket[lane];
+			v = vPacket[lane];
+		}
+		return closest;
+	}
+
+	/// <summary>
+	/// Checks whether any of triangles first to first + count - 1 is hit with t in [minT, maxT].
+	/// </summary>
+	bool occludedRange(const Ray& ray, int first, int count, bool culling, float minT, float maxT) const
+	{
+		float tPacket[8], uPacket[8], vPacket[8];
+		for (int base = first; base < first + count; base += simdWidth_) {
+			int lanes = std::min(simdWidth_, first + count - base);
+			if (intersectPacket(ray, base, culling, minT, maxT, tPacket, uPacket, vPacket) & ((1 << lanes) - 1)) return true;
+		}
+		return false;
+	}
+};
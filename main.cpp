@@ -5,20 +5,18 @@
 #include <vector>
 #include <random>
 #include <chrono>
-#include "BVHNode.hpp"
-#include "Sphere.hpp"
-#include "Plane.hpp"
-#include "Triangle.hpp"
+#include <atomic>
 #include "Scene.hpp"
+#include "PackedScene.hpp"
+#include "SceneFile.hpp"
 #include "Camera.hpp"
-#include "PointLight.hpp"
-#include "DirectionalLight.hpp"
-#include "LambertianShader.hpp"
-#include "TexturedLambertianShader.hpp"
-#include "PhongShader.hpp"
-#include "MirrorShader.hpp"
-#include "TexCoordTestShader.hpp"
-#include "Model.hpp"
+#include "ModelCache.hpp"
+#include "TextureCache.hpp"
+#include "Framebuffer.hpp"
+#include "TGAWriter.hpp"
+#include "PNGWriter.hpp"
+#include "PFMWriter.hpp"
+#include "EXRWriter.hpp"
 
 /// <summary>
 /// Load a JSON config file using the nlohmann library.
@@ -31,12 +29,18 @@ nlohmann::json loadConfig(const std::string& filename)
 }
 
 /// <summary>
-/// Load an Eigen Vector3f from a config file.
-/// Call as for example loadVec3FromConfig(config["myVector3"]);
+/// Choose how to save the output image from the extension of its filename
+/// (.tga, .png, .pfm or .exr).
 /// </summary>
-Eigen::Vector3f loadVec3FromConfig(const nlohmann::json& config)
+std::unique_ptr<ImageWriter> makeImageWriter(const std::string& filename)
 {
-	return Eigen::Vector3f(config[0], config[1], config[2]);
+	std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == ".tga") return std::make_unique<TGAWriter>();
+	if (extension == ".png") return std::make_unique<PNGWriter>();
+	if (extension == ".pfm") return std::make_unique<PFMWriter>();
+	if (extension == ".exr") return std::make_unique<EXRWriter>();
+	throw std::runtime_error("Unknown output image format \"" + extension + "\" (expected .tga, .png, .pfm or .exr).");
 }
 
 int main(int argc, char* argv[]) {
@@ -46,10 +50,16 @@ int main(int argc, char* argv[]) {
 
 	int pixHeight = config["pixHeight"], pixWidth = config["pixWidth"];
 
+	BVHBuildParams bvhParams = loadBVHBuildParamsFromConfig(config.value("bvh", nlohmann::json::object()));
+
+	// Parsed models and their BVHs are cached here between runs (see ModelCache).
+	ModelCache modelCache(config.value("modelCacheDirectory", std::string("../cache")));
+
 	// Color that will be drawn where no objects are present.
-	TGAColor clearColor(
-		config["clearColor"][0], config["clearColor"][1], 
-		config["clearColor"][2], config["clearColor"][3]);
+	Eigen::Vector3f clearColor(
+		config["clearColor"][0].get<float>() / 255.f,
+		config["clearColor"][1].get<float>() / 255.f,
+		config["clearColor"][2].get<float>() / 255.f);
 
 	// *** Set up camera and output image ***
 	Camera cam(
@@ -59,88 +69,37 @@ int main(int argc, char* argv[]) {
 		pixWidth, pixHeight,
 		config["cameraFov"]);
 
-	TGAImage outImage(pixWidth, pixHeight, TGAImage::RGB);
-
-	Eigen::Vector3f
-		red(1.f, 0.f, 0.f),
-		blue(0.f, 0.f, 1.f),
-		aqua(0.f, .8f, .8f),
-		lavender(178.f / 255.f, 164.f / 255.f, 212.f / 255.f);
-
-	// *** Load shaders and textures ***
-	TGAImage spotTexture;
-	spotTexture.read_tga_file("../models/spot.tga");
-	LambertianShader redLambertianShader(red);
-	PhongShader bluePlasticShader(blue, Eigen::Vector3f(1.f, 1.f, 1.f), 100.f);
-	LambertianShader aquaLambertianShader(aqua);
-	LambertianShader lavenderLambertianShader(lavender);
-	TexturedLambertianShader spotShader(&spotTexture);
-	MirrorShader mirrorShader;
-	TexCoordTestShader texCoordTestShader;
-
-	// *** Set up scene ***
-	Scene scene;
-
-	// Set up some planes to surround our scene.
-	scene.renderables.push_back(std::make_shared<Plane>(&aquaLambertianShader, Eigen::Vector3f(0.f, 0.f, -1.f)));
-	scene.renderables.back()->modelToWorld(makeTranslationMatrix(Eigen::Vector3f(0.f, 0.f, 3.f)));
-
-	scene.renderables.push_back(std::make_shared<Plane>(&lavenderLambertianShader, Eigen::Vector3f(0.f, 1.f, 0.f)));
-	scene.renderables.back()->modelToWorld(makeTranslationMatrix(Eigen::Vector3f(0.f, -3.f, 0.f)));
-
-	scene.renderables.push_back(std::make_shared<Plane>(&aquaLambertianShader, Eigen::Vector3f(0.f, 0.f, 1.f), VISIBLE_BITMASK));
-	scene.renderables.back()->modelToWorld(makeTranslationMatrix(Eigen::Vector3f(0.f, 0.f, -6.f)));
-
-	scene.renderables.push_back(std::make_shared<Plane>(&aquaLambertianShader, Eigen::Vector3f(0.f, 0.f, 1.f), VISIBLE_BITMASK));
-	scene.renderables.back()->modelToWorld(makeTranslationMatrix(Eigen::Vector3f(0.f, 0.f, -6.f)));
-
-
-	std::vector<std::shared_ptr<Renderable>> spheres;
-
-	float sphereSpacing = 0.5f;
-	float sphereRadius = 0.2f;
-
-	int sphereCountXY = 3;
-
-	for (int x = -sphereCountXY; x <= sphereCountXY; ++x) {
-		for (int y = -sphereCountXY; y <= sphereCountXY; ++y) {
-			for (int z = -1; z <= 1; ++z) {
-				spheres.push_back(std::make_shared<Sphere>(&mirrorShader, sphereRadius));
-				spheres.back()->modelToWorld(makeTranslationMatrix(Eigen::Vector3f(x*sphereSpacing, y*sphereSpacing, z*sphereSpacing)));
-			}
-		}
-	}
-
-	// This version of the code doesn't use a BVH, and just adds all the spheres to the scene.
-	scene.renderables.insert(scene.renderables.end(), spheres.begin(), spheres.end());
-
-	// This version adds the spheres to a BVH (this will only work once you've implemented it!
-	//scene.renderables.push_back(std::make_shared<BVHNode>(spheres, 5));
-
-	// Optional code: here's how to add the spot mesh to the scene, using a BVH
-	// Try enabling this and comparing it to the non-BVH version below!
-	//Model spotModel("../models/spot.obj");
-	//scene.renderables.push_back(std::make_shared<BVHNode>(spotModel, &spotShader, 4, rotateY(M_PI / 4.0f)));
+	// The image is rendered in bands of tileRows rows, and each band is written to the
+	// output file as soon as it is finished, so only one band is ever held in memory.
+	// 0 renders the whole image in one go.
+	int tileRows = config.value("tileRows", 0);
+	if (tileRows <= 0) tileRows = pixHeight;
+	Framebuffer outImage(pixWidth, pixHeight, tileRows);
+	std::string outputFilename = config["outputFilename"];
+	std::unique_ptr<ImageWriter> imageWriter = makeImageWriter(outputFilename);
 
-	// Here's how to add the mesh without using the BVH.
-	// Try comparing performance to the BVH version above.
-	//Model spotModel("../models/spot.obj");
-	//scene.renderables.push_back(std::make_shared<Mesh>(&spotShader, &spotModel));
-	//scene.renderables.back()->modelToWorld(rotateY(M_PI / 4.0f));
+	// *** Load the scene ***
+	// Shaders, textures, models, objects and lights are all described by the scene file
+	// (see SceneFile for its format).
+	TextureCache textureCache;
+	SceneFile sceneFile(config.value("sceneFilename", std::string("../config/scene.json")), bvhParams, modelCache, textureCache);
+	Scene& scene = sceneFile.scene();
 
-	// *** Add lights to scene ***
-	Eigen::Vector3f ambientLight(.1f, .1f, .1f);
+	// Compile the scene into arrays of primitives grouped by type, so the spheres, triangles
+	// and planes in it can be intersected without virtual calls. To trace the Scene itself
+	// instead, use scene in place of packedScene below.
+	PackedScene packedScene(scene.renderables, sceneFile.bvhParams());
 
-	std::vector<std::unique_ptr<Light>> lightSources;
-	lightSources.push_back(std::make_unique<PointLight>(Eigen::Vector3f(-1.f, 3.f, -1.f), 3.f * Eigen::Vector3f(1.f, 1.f, 1.f)));
-	lightSources.push_back(std::make_unique<DirectionalLight>(Eigen::Vector3f(0.f, -1.f, 1.f), .5f * Eigen::Vector3f(1.f, 1.f, 1.f)));
+	const Eigen::Vector3f& ambientLight = sceneFile.ambientLight();
+	const std::vector<std::unique_ptr<Light>>& lightSources = sceneFile.lights();
 
 	// *** Render the scene ***
 
 	// Shuffling the scanline order gets better CPU usage between threads
 	// when some lines take longer to render than others.
-	std::vector<unsigned int> scanlines(pixHeight);
-	for (int i = 0; i < pixHeight; ++i) scanlines[i] = i;
+	// The same order is used for the rows of each band.
+	std::vector<int> scanlines(outImage.maxRows());
+	for (int i = 0; i < outImage.maxRows(); ++i) scanlines[i] = i;
 
 	if (config["shuffleScanlines"]) {
 		std::random_device rd;
@@ -155,42 +114,55 @@ int main(int argc, char* argv[]) {
 	scene.intersect(ray, 1e-6f, 1e6f, hitInfo, VISIBLE_BITMASK);
 	float x = hitInfo.hitT;
 
-
-	#pragma omp parallel for
-	for (int y = 0; y < pixHeight; ++y) {
-		for (int x = 0; x < pixWidth; ++x) {
-			Ray ray = cam.getRay(x, scanlines[y]);
-			HitInfo hitInfo;
-			if (scene.intersect(ray, 1e-6f, 1e6f, hitInfo, VISIBLE_BITMASK)) {
-				Eigen::Vector3f color = hitInfo.shader->getColor(
-					hitInfo, &scene,
-					lightSources, ambientLight,
-					0, config["maxBounces"]);
-
-				color.x() = std::min(color.x(), 1.f);
-				color.y() = std::min(color.y(), 1.f);
-				color.z() = std::min(color.z(), 1.f);
-
-				TGAColor tgaColor(color.x() * 255, color.y() * 255, color.z() * 255, 255);
-				outImage.set(x, scanlines[y], tgaColor);
+	// Colours are clamped to [0, 1] when saving to 8-bit formats (TGA, PNG), but kept as
+	// they are in PFM and EXR files.
+	imageWriter->open(outputFilename, pixWidth, pixHeight);
+	std::chrono::steady_clock::duration writeTime(0);
+	std::atomic<int> rowsDone(0);
+
+	// Bands are rendered in the order the output format stores rows in.
+	for (int bandStart = 0; bandStart < pixHeight; bandStart += tileRows) {
+		int bandRows = std::min(tileRows, pixHeight - bandStart);
+		int firstRow = imageWriter->topDown() ? pixHeight - bandStart - bandRows : bandStart;
+		outImage.setRows(firstRow, bandRows);
+
+		#pragma omp parallel for
+		for (int i = 0; i < (int)scanlines.size(); ++i) {
+			if (scanlines[i] >= bandRows) continue;
+			int y = firstRow + scanlines[i];
+			for (int x = 0; x < pixWidth; ++x) {
+				Ray ray = cam.getRay(x, y);
+				HitInfo hitInfo;
+				if (packedScene.intersect(ray, 1e-6f, 1e6f, hitInfo, VISIBLE_BITMASK)) {
+					Eigen::Vector3f color = hitInfo.shader->getColor(
+						hitInfo, &packedScene,
+						lightSources, ambientLight,
+						0, config["maxBounces"]);
+
+					outImage.set(x, y, color);
+				}
+				else
+					outImage.set(x, y, clearColor);
+			}
+			int done = ++rowsDone;
+			if (omp_get_thread_num() == omp_get_num_threads()-1) {
+				std::clog << "\rScanlines remaining: " << (pixHeight - done) << ' ' << std::flush;
 			}
-			else
-				outImage.set(x, scanlines[y], clearColor);
-		}
-		if (omp_get_thread_num() == omp_get_num_threads()-1) {
-			std::clog << "\rScanlines remaining: " << (pixHeight - y) << ' ' << std::flush;
 		}
 
+		auto writeStart = std::chrono::steady_clock::now();
+		imageWriter->writeRows(outImage);
+		writeTime += std::chrono::steady_clock::now() - writeStart;
 	}
 
-	auto renderTime = std::chrono::steady_clock::now() - startTime;
+	auto writeStart = std::chrono::steady_clock::now();
+	imageWriter->close();
+	writeTime += std::chrono::steady_clock::now() - writeStart;
 
-	std::cout << "Render duration " << std::chrono::duration_cast<std::chrono::milliseconds>(renderTime).count() * 1e-3f << " seconds." << std::endl;
+	auto renderTime = std::chrono::steady_clock::now() - startTime - writeTime;
 
-	// *** Save the output image ***
-	outImage.flip_vertically();
-	std::string outputFilename = config["outputFilename"];
-	outImage.write_tga_file(outputFilename.c_str());
+	std::cout << "Render duration " << std::chrono::duration_cast<std::chrono::milliseconds>(renderTime).count() * 1e-3f << " seconds." << std::endl;
+	std::cout << "Saved " << outputFilename << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(writeTime).count() * 1e-3f << " seconds." << std::endl;
 
 	return 0;
 }
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BVHBuilder.hpp"
+#include "Model.hpp"
+
+/// <summary>
+/// Converts an obj file to a binary mesh file (see MeshFile.hpp), which Model can load
+/// much more quickly by mapping it into memory. By default a BVH is built over the mesh in
+/// model space and stored in the file too, so LinearMeshBVH doesn't have to build one.
+/// Usage: meshconvert input.obj output.rtmesh [sah|sbvh|lbvh|none]
+/// </summary>
+int main(int argc, char** argv)
+{
+	if (argc < 3 || argc > 4) {
+		std::cerr << "Usage: " << argv[0] << " input.obj output.rtmesh [sah|sbvh|lbvh|none]" << std::endl;
+		return 1;
+	}
+	std::string method = argc > 3 ? argv[3] : "sah";
+
+	try {
+		Model model(argv[1]);
+
+		std::vector<MeshFileBVHNode> nodes;
+		std::vector<int32_t> primitives;
+		if (method != "none") {
+			BVHBuildParams params;
+			if (method == "sah") params.method = BVHBuildMethod::SAH;
+			else if (method == "sbvh") params.method = BVHBuildMethod::SBVH;
+			else if (method == "lbvh") params.method = BVHBuildMethod::LBVH;
+			else throw std::runtime_error("Unknown BVH build method \"" + method + "\" (expected \"sah\", \"sbvh\", \"lbvh\" or \"none\").");
+
+			Eigen::Matrix4f identity = Eigen::Matrix4f::Identity();
+			std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(model, identity);
+			BVHBuilder builder(params);
+			std::unique_ptr<BVHBuildNode> root = builder.build(prims, makeMeshPrimitiveSplitter(model, identity));
+			flattenBuildTree(*root, prims, nodes, primitives);
+			std::cout << "Built BVH with " << nodes.size() << " nodes in " << builder.lastBuildSeconds() << "s" << std::endl;
+		}
+
+		model.save(argv[2], nodes, primitives);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
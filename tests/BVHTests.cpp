@@ -0,0 +1,755 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <limits>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "Model.hpp"
+#include "Mesh.hpp"
+#include "BVHNode.hpp"
+#include "BVHBuilder.hpp"
+#include "LinearMeshBVH.hpp"
+#include "LinearRenderableBVH.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "Instance.hpp"
+#include "SphereSet.hpp"
+#include "PackedScene.hpp"
+#include "Triangle.hpp"
+#include "Plane.hpp"
+#include "LambertianShader.hpp"
+
+/// <summary>
+/// Closest hit found for a ray (hit is false if there wasn't one).
+/// </summary>
+struct RayResult
+{
+	bool hit;
+	float t;
+	Eigen::Vector3f location, normal;
+	Eigen::Vector2f texCoords;
+};
+
+/// <summary>
+/// A fixed set of rays towards an object: from random points around its bounds, through
+/// random points inside them, so most (but not all) of them hit. The same seed always
+/// gives the same rays.
+/// </summary>
+std::vector<Ray> makeRays(const AABB& bounds, int count, unsigned seed = 1)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	Eigen::Vector3f centre = 0.5f * (bounds.min + bounds.max), size = bounds.max - bounds.min;
+	float radius = size.norm();
+	std::vector<Ray> rays(count);
+	for (Ray& ray : rays) {
+		Eigen::Vector3f from, to;
+		do {
+			from = Eigen::Vector3f(uniform(random), uniform(random), uniform(random)) * 2.f - Eigen::Vector3f::Ones();
+		} while (from.squaredNorm() > 1.f || from.squaredNorm() < 1e-4f);
+		from = centre + radius * from.normalized();
+		to = bounds.min + Eigen::Vector3f(uniform(random), uniform(random), uniform(random)).cwiseProduct(size);
+		ray.origin = from;
+		ray.direction = (to - from).normalized();
+	}
+	return rays;
+}
+
+std::vector<RayResult> trace(const Renderable& renderable, const std::vector<Ray>& rays)
+{
+	std::vector<RayResult> results(rays.size());
+	for (size_t r = 0; r < rays.size(); ++r) {
+		HitInfo info;
+		results[r].hit = renderable.intersect(rays[r], 0.f, std::numeric_limits<float>::max(), info, DEFAULT_BITMASK);
+		if (!results[r].hit) continue;
+		results[r].t = info.hitT;
+		results[r].location = info.location;
+		results[r].normal = info.normal;
+		results[r].texCoords = info.texCoords;
+	}
+	return results;
+}
+
+/// <summary>
+/// Checks that a renderable finds the same closest hits as a reference (e.g. testing every
+/// triangle of a mesh), with the same surface attributes. Rays that graze an edge can land either side of it once the ray
+/// is transformed, so up to allowedMismatches rays may hit in one and not the other.
+/// </summary>
+void checkSameHits(const std::vector<RayResult>& expected, const Renderable& renderable, const std::vector<Ray>& rays,
+	const std::string& name, int allowedMismatches = 0)
+{
+	std::vector<RayResult> results = trace(renderable, rays);
+	int mismatches = 0, wrongT = 0, wrongSurface = 0, hits = 0;
+	for (size_t r = 0; r < rays.size(); ++r) {
+		if (results[r].hit != expected[r].hit) {
+			++mismatches;
+			continue;
+		}
+		if (!results[r].hit) continue;
+		++hits;
+		if (std::abs(results[r].t - expected[r].t) > 1e-4f * std::max(1.f, expected[r].t)) ++wrongT;
+		else if ((results[r].location - expected[r].location).norm() > 1e-3f * std::max(1.f, expected[r].t)
+			|| (results[r].normal - expected[r].normal).norm() > 1e-3f
+			|| (results[r].texCoords - expected[r].texCoords).norm() > 1e-3f) ++wrongSurface;
+	}
+	std::cout << name << ": " << hits << " hits, " << mismatches << " hit/miss mismatches." << std::endl;
+	checkResult(mismatches <= allowedMismatches, name + ": rays hit in one and missed in the other ("
+		+ std::to_string(mismatches) + ")", __FILE__, __LINE__);
+	checkResult(wrongT == 0, name + ": closest hits at a different distance (" + std::to_string(wrongT) + ")", __FILE__, __LINE__);
+	checkResult(wrongSurface == 0, name + ": hits with a different location, normal or texture coordinates ("
+		+ std::to_string(wrongSurface) + ")", __FILE__, __LINE__);
+}
+
+/// <summary>
+/// Checks that occlusion queries agree with the closest hits of a reference: a ray is
+/// occluded if its closest hit is before maxT. maxT is tried just before and just after
+/// the closest hit, as well as unlimited.
+/// </summary>
+void checkSameOcclusion(const std::vector<RayResult>& expected, const Renderable& renderable, const std::vector<Ray>& rays,
+	const std::string& name)
+{
+	int wrong = 0;
+	for (size_t r = 0; r < rays.size(); ++r) {
+		if (renderable.occluded(rays[r], 0.f, std::numeric_limits<float>::max(), DEFAULT_BITMASK) != expected[r].hit) ++wrong;
+		if (!expected[r].hit) continue;
+		if (renderable.occluded(rays[r], 0.f, 0.999f * expected[r].t, DEFAULT_BITMASK)) ++wrong;
+		if (!renderable.occluded(rays[r], 0.f, 1.001f * expected[r].t, DEFAULT_BITMASK)) ++wrong;
+		// Shadow rays only test renderables with the shadow bit set, and these all have it.
+		if (!renderable.occluded(rays[r], 0.f, std::numeric_limits<float>::max(), SHADOW_BITMASK)) ++wrong;
+	}
+	checkResult(wrong == 0, name + ": occlusion queries disagreeing with the closest hits (" + std::to_string(wrong) + ")", __FILE__, __LINE__);
+}
+
+/// <summary>
+/// True if inner is inside outer, allowing for rounding.
+/// </summary>
+bool encloses(const AABB& outer, const AABB& inner)
+{
+	Eigen::Vector3f tolerance = Eigen::Vector3f::Constant(1e-4f);
+	return (inner.min - outer.min + tolerance).minCoeff() >= 0.f && (outer.max - inner.max + tolerance).minCoeff() >= 0.f;
+}
+
+/// <summary>
+/// Checks the structure of a tree made by BVHBuilder: the leaves hold every primitive
+/// (once each, unless spatial splits can put them in several leaves), each node's bounds
+/// hold its children's, and interior nodes have two children.
+/// </summary>
+void checkBuildTree(const BVHBuildNode& root, const std::vector<BVHPrimitive>& prims, int primitiveCount,
+	bool allowDuplicates, const std::string& name)
+{
+	std::vector<int> references(primitiveCount, 0);
+	int badBounds = 0, badRanges = 0;
+	std::function<void(const BVHBuildNode&)> visit = [&](const BVHBuildNode& node) {
+		if (node.isLeaf()) {
+			if (node.primOffset < 0 || node.primOffset + node.primCount > (int)prims.size()) {
+				++badRanges;
+				return;
+			}
+			for (int i = node.primOffset; i < node.primOffset + node.primCount; ++i) {
+				++references[prims[i].index];
+				// Spatial splits clip primitives to the leaf, so their whole bounds can stick out of it.
+				if (!allowDuplicates && !encloses(node.bounds, prims[i].bounds)) ++badBounds;
+			}
+			return;
+		}
+		if (!node.children[1]) {
+			++badRanges;
+			return;
+		}
+		for (const std::unique_ptr<BVHBuildNode>& child : node.children) {
+			if (!encloses(node.bounds, child->bounds)) ++badBounds;
+			visit(*child);
+		}
+	};
+	visit(root);
+
+	int missing = 0, duplicated = 0;
+	for (int count : references) {
+		if (count == 0) ++missing;
+		if (count > 1) ++duplicated;
+	}
+	checkResult(badRanges == 0, name + ": leaves outside the primitive list or interior nodes without two children", __FILE__, __LINE__);
+	checkResult(badBounds == 0, name + ": bounds not holding their contents (" + std::to_string(badBounds) + ")", __FILE__, __LINE__);
+	checkResult(missing == 0, name + ": primitives not in any leaf (" + std::to_string(missing) + ")", __FILE__, __LINE__);
+	checkResult(allowDuplicates || duplicated == 0, name + ": primitives in several leaves (" + std::to_string(duplicated) + ")", __FILE__, __LINE__);
+}
+
+/// <summary>
+/// A mesh to test BVHs over, placed with a transform, and the closest hits of a fixed set
+/// of rays found by testing every triangle.
+/// </summary>
+struct MeshTest
+{
+	const Model& model;
+	Eigen::Matrix4f transform;
+	std::vector<Ray> rays;
+	std::vector<RayResult> expected;
+
+	MeshTest(const Model& model, const Eigen::Matrix4f& transform, int rayCount)
+		:model(model), transform(transform)
+	{
+		Mesh reference(nullptr, &model);
+		reference.modelToWorld(transform);
+		rays = makeRays(reference.getAABB(), rayCount);
+		expected = trace(reference, rays);
+	}
+};
+
+/// <summary>
+/// Spheres of random sizes scattered through a box, as separate Renderables.
+/// </summary>
+std::vector<std::shared_ptr<Renderable>> makeSpheres(int count, unsigned seed = 2)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> position(-5.f, 5.f), radius(0.05f, 0.5f);
+	std::vector<std::shared_ptr<Renderable>> spheres;
+	for (int i = 0; i < count; ++i) {
+		std::shared_ptr<Renderable> sphere = std::make_shared<Sphere>(nullptr, radius(random));
+		Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+		transform.block<3, 1>(0, 3) = Eigen::Vector3f(position(random), position(random), position(random));
+		sphere->modelToWorld(transform);
+		spheres.push_back(sphere);
+	}
+	return spheres;
+}
+
+/// <summary>
+/// Writes an obj file of a bumpy square of size x size quads, for tests that need more
+/// triangles than spot.obj has.
+/// </summary>
+void writeGridObj(const std::string& filename, int size)
+{
+	std::ofstream out(filename);
+	for (int z = 0; z <= size; ++z) {
+		for (int x = 0; x <= size; ++x) {
+			out << "v " << x << " " << 3.f * std::sin(0.3f * x) * std::cos(0.2f * z) << " " << z << "\n";
+		}
+	}
+	for (int z = 0; z < size; ++z) {
+		for (int x = 0; x < size; ++x) {
+			int v = z * (size + 1) + x + 1;
+			out << "f " << v << " " << v + size + 1 << " " << v + size + 2 << " " << v + 1 << "\n";
+		}
+	}
+}
+
+/// <summary>
+/// Writes an obj file of long, thin triangles running diagonally through a box, which
+/// overlap a lot when only whole triangles are put in each node.
+/// </summary>
+void writeNeedlesObj(const std::string& filename, int count, unsigned seed = 4)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> position(-1.f, 1.f);
+	std::ofstream out(filename);
+	for (int i = 0; i < count; ++i) {
+		Eigen::Vector3f a(position(random), position(random), -1.f), b(-a.x(), -a.y(), 1.f);
+		Eigen::Vector3f side = 0.02f * (b - a).unitOrthogonal();
+		out << "v " << a.x() << " " << a.y() << " " << a.z() << "\n"
+			<< "v " << b.x() << " " << b.y() << " " << b.z() << "\n"
+			<< "v " << b.x() + side.x() << " " << b.y() + side.y() << " " << b.z() + side.z() << "\n";
+		out << "f " << 3 * i + 1 << " " << 3 * i + 2 << " " << 3 * i + 3 << "\n";
+	}
+}
+
+void testSAH(const MeshTest& test)
+{
+	BVHBuildParams sah;
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(test.model, test.transform);
+	std::unique_ptr<BVHBuildNode> root = BVHBuilder(sah).build(prims);
+	checkBuildTree(*root, prims, test.model.nfaces(), false, "SAH build tree");
+	checkSameHits(test.expected, BVHNode(test.model, nullptr, sah, test.transform), test.rays, "BVHNode (SAH)");
+}
+
+void testLinearBVH(const MeshTest& test, const std::filesystem::path& directory)
+{
+	BVHBuildParams params;
+	checkSameHits(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH");
+
+	Scene scene;
+	scene.renderables = makeSpheres(500);
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	checkSameHits(trace(scene, rays), LinearRenderableBVH(scene.renderables, params), rays, "LinearRenderableBVH");
+
+	// Trees with nothing in them are a single empty leaf, which nothing hits.
+	std::ofstream((directory / "empty.obj").string()) << "# Nothing here\n";
+	Model empty((directory / "empty.obj").string().c_str());
+	LinearMeshBVH emptyMesh(empty, nullptr, params);
+	LinearRenderableBVH emptyGroup({}, params);
+	int hits = 0;
+	for (const Ray& ray : test.rays) {
+		HitInfo info;
+		if (emptyMesh.intersect(ray, 0.f, std::numeric_limits<float>::max(), info, DEFAULT_BITMASK)) ++hits;
+		if (emptyGroup.intersect(ray, 0.f, std::numeric_limits<float>::max(), info, DEFAULT_BITMASK)) ++hits;
+		if (emptyMesh.occluded(ray, 0.f, std::numeric_limits<float>::max(), DEFAULT_BITMASK)) ++hits;
+	}
+	CHECK(hits == 0);
+}
+
+void testLBVH(const MeshTest& test)
+{
+	for (int bits : { 30, 63 }) {
+		BVHBuildParams params;
+		params.method = BVHBuildMethod::LBVH;
+		params.mortonBits = bits;
+		std::string name = "LBVH (" + std::to_string(bits) + " bit codes)";
+		std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(test.model, test.transform);
+		std::unique_ptr<BVHBuildNode> root = BVHBuilder(params).build(prims);
+		checkBuildTree(*root, prims, test.model.nfaces(), false, name + " build tree");
+		checkSameHits(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH " + name);
+		checkSameHits(test.expected, BVHNode(test.model, nullptr, params, test.transform), test.rays, "BVHNode " + name);
+	}
+}
+
+void testWideBVH(const MeshTest& test)
+{
+	std::cout << "SIMD: " << (CpuFeatures::get().avx ? "AVX" : "SSE or scalar") << std::endl;
+	Scene scene;
+	scene.renderables = makeSpheres(500);
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	std::vector<RayResult> expected = trace(scene, rays);
+
+	for (int width : { 4, 8 }) {
+		BVHBuildParams params;
+		params.branchingFactor = width;
+		std::string name = " (" + std::to_string(width) + " wide)";
+		checkSameHits(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH" + name);
+		checkSameHits(expected, LinearRenderableBVH(scene.renderables, params), rays, "LinearRenderableBVH" + name);
+	}
+
+	// Each wide node takes the place of several binary ones.
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(test.model, test.transform);
+	std::unique_ptr<BVHBuildNode> root = BVHBuilder().build(prims);
+	BVHHierarchy binary(*root, 2), wide4(*root, 4), wide8(*root, 8);
+	CHECK(wide4.branchingFactor() == 4 && wide8.branchingFactor() == 8);
+	CHECK(wide4.nodeCount() < binary.nodeCount() && wide8.nodeCount() < wide4.nodeCount());
+	CHECK(encloses(wide8.getAABB(), binary.getAABB()) && encloses(binary.getAABB(), wide8.getAABB()));
+	CHECK_THROWS(BVHHierarchy(*root, 3));
+}
+
+void testInstances(const MeshTest& test)
+{
+	// Rays are transformed into model space, so the odd ray grazing an edge can change sides.
+	int allowedMismatches = static_cast<int>(test.rays.size()) / 500;
+	BVHBuildParams params;
+	std::shared_ptr<LinearMeshBVH> shared = std::make_shared<LinearMeshBVH>(test.model, nullptr, params);
+	checkSameHits(test.expected, Instance(shared, test.transform), test.rays, "Instance", allowedMismatches);
+	checkSameHits(test.expected, Instance(std::make_shared<BVHNode>(test.model, nullptr, params, Eigen::Matrix4f::Identity()),
+		test.transform), test.rays, "Instance of a BVHNode", allowedMismatches);
+
+	// Two levels: a BVH over copies of the mesh, each an Instance of the same BVH.
+	Scene scene;
+	std::vector<std::shared_ptr<Renderable>> instances;
+	for (int i = 0; i < 8; ++i) {
+		Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+		offset.block<3, 1>(0, 3) = Eigen::Vector3f(1.5f * (i % 4), 0.f, 2.f * (i / 4));
+		Eigen::Matrix4f transform = offset * test.transform * Eigen::Affine3f(Eigen::Scaling(1.f + 0.1f * i)).matrix();
+		std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>(nullptr, &test.model);
+		mesh->modelToWorld(transform);
+		scene.renderables.push_back(mesh);
+		instances.push_back(std::make_shared<Instance>(shared, transform));
+	}
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	checkSameHits(trace(scene, rays), LinearRenderableBVH(instances, params), rays, "LinearRenderableBVH of instances",
+		static_cast<int>(rays.size()) / 500);
+}
+
+void testSBVH(const MeshTest& test, const std::filesystem::path& directory)
+{
+	BVHBuildParams params;
+	params.method = BVHBuildMethod::SBVH;
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(test.model, test.transform);
+	std::unique_ptr<BVHBuildNode> root = BVHBuilder(params).build(prims, makeMeshPrimitiveSplitter(test.model, test.transform));
+	checkBuildTree(*root, prims, test.model.nfaces(), true, "SBVH build tree");
+	checkSameHits(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH (SBVH)");
+	checkSameHits(test.expected, BVHNode(test.model, nullptr, params, test.transform), test.rays, "BVHNode (SBVH)");
+
+	// Long, thin triangles, where spatial splits are worth making. Culling is off, as
+	// the triangles face every which way.
+	std::string filename = (directory / "needles.obj").string();
+	writeNeedlesObj(filename, 2000);
+	Model needles(filename.c_str());
+	prims = makeMeshBuildPrimitives(needles, Eigen::Matrix4f::Identity());
+	root = BVHBuilder(params).build(prims, makeMeshPrimitiveSplitter(needles, Eigen::Matrix4f::Identity()));
+	checkBuildTree(*root, prims, needles.nfaces(), true, "SBVH build tree (thin triangles)");
+	CHECK(prims.size() > size_t(needles.nfaces()));
+	CHECK(prims.size() <= size_t(needles.nfaces() * (1.f + params.maxSpatialSplitDuplication)));
+
+	Mesh reference(nullptr, &needles, nullptr, false);
+	std::vector<Ray> rays = makeRays(reference.getAABB(), 4000);
+	std::vector<RayResult> expected = trace(reference, rays);
+	checkSameHits(expected, LinearMeshBVH(needles, nullptr, params, Eigen::Matrix4f::Identity(), false), rays,
+		"LinearMeshBVH (SBVH, thin triangles)");
+	checkSameHits(expected, BVHNode(needles, nullptr, params, Eigen::Matrix4f::Identity(), false), rays,
+		"BVHNode (SBVH, thin triangles)");
+
+	// Without any duplication allowed, it's an ordinary SAH build.
+	params.maxSpatialSplitDuplication = 0.f;
+	prims = makeMeshBuildPrimitives(needles, Eigen::Matrix4f::Identity());
+	root = BVHBuilder(params).build(prims, makeMeshPrimitiveSplitter(needles, Eigen::Matrix4f::Identity()));
+	checkBuildTree(*root, prims, needles.nfaces(), false, "SBVH build tree (no duplication)");
+}
+
+/// <summary>
+/// Closest hits of rays against a model, found by testing every triangle.
+/// </summary>
+std::vector<RayResult> traceAllTriangles(const Model& model, const Eigen::Matrix4f& transform, const std::vector<Ray>& rays,
+	bool culling = true)
+{
+	Mesh reference(nullptr, &model, nullptr, culling);
+	reference.modelToWorld(transform);
+	return trace(reference, rays);
+}
+
+void testRefit(const MeshTest& test, const std::filesystem::path& sourceDir)
+{
+	BVHBuildParams params;
+
+	// Moving the mesh after building it.
+	LinearMeshBVH moved(test.model, nullptr, params, Eigen::Matrix4f::Identity());
+	moved.modelToWorld(test.transform);
+	checkSameHits(test.expected, moved, test.rays, "LinearMeshBVH moved after building");
+
+	// Changing the vertices: a small change only needs the bounds refitted, but scrambling
+	// them makes the tree bad enough to be rebuilt.
+	Model model((sourceDir / "models" / "spot.obj").string().c_str());
+	LinearMeshBVH mesh(model, nullptr, params, test.transform);
+	params.refitRebuildThreshold = 1e9f;
+	LinearMeshBVH refitOnly(model, nullptr, params, test.transform);
+	for (int v = 0; v < model.nverts(); ++v) model.setVert(v, 1.02f * model.vert(v));
+	CHECK(!mesh.update());
+	CHECK(!refitOnly.update());
+	std::vector<RayResult> expected = traceAllTriangles(model, test.transform, test.rays);
+	checkSameHits(expected, mesh, test.rays, "LinearMeshBVH refitted");
+
+	std::vector<Eigen::Vector3f> verts;
+	for (int v = 0; v < model.nverts(); ++v) verts.push_back(model.vert(v));
+	std::shuffle(verts.begin(), verts.end(), std::mt19937(3));
+	for (int v = 0; v < model.nverts(); ++v) model.setVert(v, verts[v]);
+	CHECK(mesh.update());
+	CHECK(!refitOnly.update());
+	expected = traceAllTriangles(model, test.transform, test.rays);
+	checkSameHits(expected, mesh, test.rays, "LinearMeshBVH rebuilt");
+	checkSameHits(expected, refitOnly, test.rays, "LinearMeshBVH refitted past the rebuild threshold");
+
+	// Moving renderables in a BVH.
+	Scene scene;
+	scene.renderables = makeSpheres(500);
+	LinearRenderableBVH bvh(scene.renderables, BVHBuildParams());
+	for (size_t i = 0; i < scene.renderables.size(); i += 10) {
+		Eigen::Matrix4f transform = scene.renderables[i]->modelToWorld();
+		transform.block<3, 1>(0, 3) *= -0.5f;
+		scene.renderables[i]->modelToWorld(transform);
+	}
+	bvh.update();
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	checkSameHits(trace(scene, rays), bvh, rays, "LinearRenderableBVH after moving renderables");
+}
+
+void testTraversalRange(const MeshTest& test)
+{
+	// Rays starting just past their first hit, so the closest hit is further into the mesh.
+	// Culling is turned off, so the inside of the mesh can be hit.
+	std::vector<Ray> rays;
+	for (size_t r = 0; r < test.rays.size(); ++r) {
+		if (!test.expected[r].hit) continue;
+		Ray ray = test.rays[r];
+		ray.origin += (test.expected[r].t + 1e-3f) * ray.direction;
+		rays.push_back(ray);
+	}
+	std::vector<RayResult> expected = traceAllTriangles(test.model, test.transform, rays, false);
+
+	std::vector<std::pair<std::string, std::shared_ptr<Renderable>>> bvhs;
+	bvhs.emplace_back("BVHNode", std::make_shared<BVHNode>(test.model, nullptr, BVHBuildParams(), test.transform, false));
+	for (int width : { 2, 4, 8 }) {
+		BVHBuildParams params;
+		params.branchingFactor = width;
+		bvhs.emplace_back("LinearMeshBVH (" + std::to_string(width) + " wide)",
+			std::make_shared<LinearMeshBVH>(test.model, nullptr, params, test.transform, false));
+	}
+
+	for (const auto& bvh : bvhs) {
+		checkSameHits(expected, *bvh.second, rays, bvh.first + " from inside the mesh");
+
+		// Nothing is hit closer than the closest hit.
+		int closer = 0;
+		for (size_t r = 0; r < test.rays.size(); ++r) {
+			HitInfo info;
+			if (test.expected[r].hit && bvh.second->intersect(test.rays[r], 0.f, 0.999f * test.expected[r].t, info, DEFAULT_BITMASK)) ++closer;
+		}
+		checkResult(closer == 0, bvh.first + ": hits found before maxT", __FILE__, __LINE__);
+	}
+}
+
+void testOcclusion(const MeshTest& test)
+{
+	BVHBuildParams params;
+	Mesh mesh(nullptr, &test.model);
+	mesh.modelToWorld(test.transform);
+	checkSameOcclusion(test.expected, mesh, test.rays, "Mesh");
+	checkSameOcclusion(test.expected, BVHNode(test.model, nullptr, params, test.transform), test.rays, "BVHNode");
+	for (int width : { 2, 4, 8 }) {
+		params.branchingFactor = width;
+		checkSameOcclusion(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays,
+			"LinearMeshBVH (" + std::to_string(width) + " wide)");
+	}
+	params.branchingFactor = 2;
+	checkSameOcclusion(test.expected, Instance(std::make_shared<LinearMeshBVH>(test.model, nullptr, params), test.transform),
+		test.rays, "Instance");
+
+	Scene scene;
+	scene.renderables = makeSpheres(500);
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	std::vector<RayResult> expected = trace(scene, rays);
+	checkSameOcclusion(expected, scene, rays, "Scene");
+	checkSameOcclusion(expected, LinearRenderableBVH(scene.renderables, params), rays, "LinearRenderableBVH");
+
+	// Renderables without the shadow bit don't occlude shadow rays.
+	LinearMeshBVH unshadowed(test.model, nullptr, params, test.transform, true, VISIBLE_BITMASK);
+	int occluded = 0;
+	for (const Ray& ray : test.rays) {
+		if (unshadowed.occluded(ray, 0.f, std::numeric_limits<float>::max(), SHADOW_BITMASK)) ++occluded;
+	}
+	CHECK(occluded == 0);
+}
+
+void testDeferredAttributes(const MeshTest& test)
+{
+	// closestHit only records what was hit, and must leave the HitInfo alone on a miss.
+	// intersect then fills in the surface, including the shader of whatever was hit.
+	LambertianShader meshShader(Eigen::Vector3f::Ones()), instanceShader(Eigen::Vector3f::Zero());
+	BVHBuildParams params;
+	LinearMeshBVH mesh(test.model, &meshShader, params, test.transform);
+	Instance instance(std::make_shared<LinearMeshBVH>(test.model, &meshShader, params), test.transform, &instanceShader);
+
+	int wrong = 0;
+	for (size_t r = 0; r < test.rays.size(); ++r) {
+		const Ray& ray = test.rays[r];
+		HitInfo info;
+		info.hitT = -1.f;
+		info.object = nullptr;
+		bool hit = mesh.closestHit(ray, 0.f, std::numeric_limits<float>::max(), info, DEFAULT_BITMASK);
+		if (hit != test.expected[r].hit) ++wrong;
+		if (!hit) {
+			if (info.hitT != -1.f || info.object) ++wrong;
+			continue;
+		}
+		if (info.object != &mesh || info.primitive < 0 || info.primitive >= test.model.nfaces()) ++wrong;
+
+		HitInfo full;
+		mesh.intersect(ray, 0.f, std::numeric_limits<float>::max(), full, DEFAULT_BITMASK);
+		if (full.object || full.shader != &meshShader || full.hitT != info.hitT) ++wrong;
+		if ((full.location - (ray.origin + full.hitT * ray.direction)).norm() > 1e-4f * std::max(1.f, full.hitT)) ++wrong;
+		if (std::abs(full.normal.norm() - 1.f) > 1e-4f || full.inDirection != ray.direction) ++wrong;
+
+		HitInfo instanced;
+		if (!instance.intersect(ray, 0.f, std::numeric_limits<float>::max(), instanced, DEFAULT_BITMASK)) ++wrong;
+		else if (instanced.object || instanced.shader != &instanceShader) ++wrong;
+	}
+	CHECK(wrong == 0);
+}
+
+void testSphereSet()
+{
+	Scene scene;
+	scene.renderables = makeSpheres(2000);
+	std::vector<Eigen::Vector3f> centres;
+	std::vector<float> radii;
+	for (const std::shared_ptr<Renderable>& sphere : scene.renderables) {
+		centres.push_back(sphere->positionToWorld(Eigen::Vector3f::Zero()));
+		radii.push_back(static_cast<const Sphere&>(*sphere).radius());
+	}
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	std::vector<RayResult> expected = trace(scene, rays);
+
+	for (int width : { 2, 4, 8 }) {
+		BVHBuildParams params;
+		params.branchingFactor = width;
+		SphereSet spheres(nullptr, centres, radii, params);
+		std::string name = "SphereSet (" + std::to_string(width) + " wide)";
+		checkSameHits(expected, spheres, rays, name);
+		checkSameOcclusion(expected, spheres, rays, name);
+	}
+
+	// Spheres of the same size.
+	Scene same;
+	for (const Eigen::Vector3f& centre : centres) {
+		std::shared_ptr<Renderable> sphere = std::make_shared<Sphere>(nullptr, 0.2f);
+		sphere->modelToWorld(Eigen::Affine3f(Eigen::Translation3f(centre)).matrix());
+		same.renderables.push_back(sphere);
+	}
+	checkSameHits(trace(same, rays), SphereSet(nullptr, centres, 0.2f, BVHBuildParams()), rays, "SphereSet (one radius)");
+}
+
+void testPackedScene(const MeshTest& test)
+{
+	// A bit of everything: packed spheres, triangles and planes, and other renderables
+	// that keep their virtual calls.
+	std::mt19937 random(8);
+	std::uniform_real_distribution<float> position(-5.f, 5.f);
+	BVHBuildParams params;
+	Scene scene;
+	scene.renderables = makeSpheres(300);
+	for (int i = 0; i < 300; ++i) {
+		Eigen::Vector3f v0(position(random), position(random), position(random));
+		Eigen::Vector3f v1 = v0 + 0.3f * Eigen::Vector3f(position(random), position(random), position(random));
+		Eigen::Vector3f v2 = v0 + 0.3f * Eigen::Vector3f(position(random), position(random), position(random));
+		scene.renderables.push_back(std::make_shared<Triangle>(nullptr, v0, v1, v2, i % 2 == 0));
+	}
+	std::shared_ptr<Renderable> plane = std::make_shared<Plane>(nullptr, Eigen::Vector3f(0.f, 1.f, 0.f));
+	plane->modelToWorld(Eigen::Affine3f(Eigen::Translation3f(0.f, -6.f, 0.f)).matrix());
+	scene.renderables.push_back(plane);
+	scene.renderables.push_back(std::make_shared<LinearMeshBVH>(test.model, nullptr, params, test.transform));
+	scene.renderables.push_back(std::make_shared<Instance>(std::make_shared<LinearMeshBVH>(test.model, nullptr, params),
+		Eigen::Affine3f(Eigen::Translation3f(3.f, 2.f, -1.f)).matrix()));
+	scene.renderables.push_back(std::make_shared<SphereSet>(nullptr,
+		std::vector<Eigen::Vector3f>{ Eigen::Vector3f(1.f, 1.f, 1.f), Eigen::Vector3f(-2.f, 1.f, 3.f) }, 0.5f, params));
+
+	AABB bounds = AABB::empty();
+	for (const std::shared_ptr<Renderable>& renderable : scene.renderables) {
+		if (renderable != plane) bounds.expand(renderable->getAABB());
+	}
+	std::vector<Ray> rays = makeRays(bounds, 4000);
+	for (int width : { 2, 4, 8 }) {
+		params.branchingFactor = width;
+		PackedScene packed(scene.renderables, params);
+		std::string name = "PackedScene (" + std::to_string(width) + " wide)";
+		std::vector<RayResult> expected = trace(scene, rays);
+		checkSameHits(expected, packed, rays, name);
+		checkSameOcclusion(expected, packed, rays, name);
+
+		// Move some of the spheres and triangles, and recompile.
+		for (size_t i = 0; i < scene.renderables.size(); i += 7) {
+			if (scene.renderables[i] == plane) continue;
+			Eigen::Matrix4f transform = scene.renderables[i]->modelToWorld();
+			transform.block<3, 1>(0, 3) += Eigen::Vector3f(0.5f, -0.5f, 0.25f);
+			scene.renderables[i]->modelToWorld(transform);
+		}
+		packed.update();
+		checkSameHits(trace(scene, rays), packed, rays, name + " after update");
+	}
+
+	// Masks are checked for packed primitives too.
+	std::vector<std::shared_ptr<Renderable>> unshadowed = {
+		std::make_shared<Sphere>(nullptr, 1.f, VISIBLE_BITMASK),
+		std::make_shared<Triangle>(nullptr, Eigen::Vector3f(-2.f, -2.f, 0.f), Eigen::Vector3f(2.f, -2.f, 0.f), Eigen::Vector3f(0.f, 2.f, 0.f), false, VISIBLE_BITMASK),
+		std::make_shared<Plane>(nullptr, Eigen::Vector3f(0.f, 0.f, 1.f), VISIBLE_BITMASK),
+	};
+	PackedScene packed(unshadowed, BVHBuildParams());
+	Ray ray;
+	ray.origin = Eigen::Vector3f(0.f, 0.f, 5.f);
+	ray.direction = Eigen::Vector3f(0.f, 0.f, -1.f);
+	HitInfo info;
+	CHECK(packed.intersect(ray, 0.f, 100.f, info, VISIBLE_BITMASK) && std::abs(info.hitT - 4.f) < 1e-5f);
+	CHECK(!packed.intersect(ray, 0.f, 100.f, info, SHADOW_BITMASK));
+	CHECK(packed.occluded(ray, 0.f, 100.f, VISIBLE_BITMASK));
+	CHECK(!packed.occluded(ray, 0.f, 100.f, SHADOW_BITMASK));
+
+	// Nothing but planes (no BVH at all), and nothing.
+	PackedScene planes({ plane }, BVHBuildParams()), empty({}, BVHBuildParams());
+	ray.direction = Eigen::Vector3f(0.f, -1.f, 0.f);
+	CHECK(planes.intersect(ray, 0.f, 100.f, info, DEFAULT_BITMASK) && std::abs(info.hitT - 6.f) < 1e-5f);
+	CHECK(!empty.intersect(ray, 0.f, 100.f, info, DEFAULT_BITMASK) && !empty.occluded(ray, 0.f, 100.f, DEFAULT_BITMASK));
+}
+
+void testCompressedNodes(const MeshTest& test)
+{
+	// Quantised child bounds are rounded outwards, so they can only add work, never
+	// lose hits.
+	Scene scene;
+	scene.renderables = makeSpheres(500);
+	std::vector<Ray> rays = makeRays(scene.getAABB(), 4000);
+	std::vector<RayResult> expected = trace(scene, rays);
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(test.model, test.transform);
+	std::unique_ptr<BVHBuildNode> root = BVHBuilder().build(prims);
+
+	for (int width : { 4, 8 }) {
+		BVHBuildParams params;
+		params.branchingFactor = width;
+		params.compressNodes = true;
+		std::string name = " (" + std::to_string(width) + " wide, compressed)";
+		checkSameHits(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH" + name);
+		checkSameOcclusion(test.expected, LinearMeshBVH(test.model, nullptr, params, test.transform), test.rays, "LinearMeshBVH" + name);
+		checkSameHits(expected, LinearRenderableBVH(scene.renderables, params), rays, "LinearRenderableBVH" + name);
+
+		// Refitting requantises the bounds.
+		LinearMeshBVH moved(test.model, nullptr, params, Eigen::Matrix4f::Identity());
+		moved.modelToWorld(test.transform);
+		checkSameHits(test.expected, moved, test.rays, "LinearMeshBVH" + name + " moved after building");
+
+		BVHHierarchy compressed(*root, width, true), uncompressed(*root, width, false);
+		CHECK(compressed.compressed() && !uncompressed.compressed());
+		CHECK(compressed.nodeCount() == uncompressed.nodeCount());
+		CHECK(compressed.nodeBytes() < uncompressed.nodeBytes());
+		CHECK(encloses(compressed.getAABB(), uncompressed.getAABB()));
+	}
+	CHECK_THROWS(BVHHierarchy(*root, 2, true));
+}
+
+void testParallelBuild(const std::filesystem::path& directory)
+{
+	// Enough triangles for the builder to split the work within nodes, as well as build
+	// subtrees in parallel.
+	std::string filename = (directory / "grid.obj").string();
+	writeGridObj(filename, 200);
+	Model grid(filename.c_str());
+	CHECK(grid.nfaces() == 80000);
+	CHECK(grid.nfaces() >= BVHBuilder::PARALLEL_NODE_THRESHOLD);
+
+	BVHBuildParams params;
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(grid, Eigen::Matrix4f::Identity());
+	std::vector<BVHPrimitive> serialPrims = prims;
+#ifdef _OPENMP
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+#endif
+	std::unique_ptr<BVHBuildNode> serial = BVHBuilder(params).build(serialPrims);
+#ifdef _OPENMP
+	omp_set_num_threads(std::max(threads, 4));
+#endif
+	std::unique_ptr<BVHBuildNode> parallel = BVHBuilder(params).build(prims);
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	checkBuildTree(*parallel, prims, grid.nfaces(), false, "Parallel SAH build tree");
+	// Splits are chosen the same way whatever the number of threads.
+	CHECK(parallel->countNodes() == serial->countNodes());
+	float serialCost = LinearBVH(*serial).sahCost(1.f, 1.f);
+	CHECK_CLOSE(LinearBVH(*parallel).sahCost(1.f, 1.f), serialCost, 1e-4f * serialCost);
+
+	MeshTest test(grid, Eigen::Matrix4f::Identity(), 300);
+	checkSameHits(test.expected, LinearMeshBVH(grid, nullptr, params), test.rays, "LinearMeshBVH (80000 triangles)");
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path directory = makeTestDirectory("BVHTests");
+	Model model((sourceDirectory(argc, argv) / "models" / "spot.obj").string().c_str());
+	Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+	transform.block<3, 3>(0, 0) = 1.5f * Eigen::AngleAxisf(0.7f, Eigen::Vector3f(1.f, 2.f, 3.f).normalized()).toRotationMatrix();
+	transform.block<3, 1>(0, 3) = Eigen::Vector3f(0.5f, -1.f, 2.f);
+	MeshTest test(model, transform, 4000);
+
+	testSAH(test);
+	testLinearBVH(test, directory);
+	testLBVH(test);
+	testWideBVH(test);
+	testInstances(test);
+	testSBVH(test, directory);
+	testRefit(test, sourceDirectory(argc, argv));
+	testTraversalRange(test);
+	testOcclusion(test);
+	testDeferredAttributes(test);
+	testSphereSet();
+	testPackedScene(test);
+	testCompressedNodes(test);
+	testParallelBuild(directory);
+
+	std::filesystem::remove_all(directory);
+	return testResult();
+}
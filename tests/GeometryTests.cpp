@@ -0,0 +1,179 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "Entity.hpp"
+#include "Model.hpp"
+#include "Mesh.hpp"
+#include "Triangle.hpp"
+#include "Scene.hpp"
+#include "WorldTriangles.hpp"
+
+/// <summary>
+/// A random transform made of a rotation, a (possibly non-uniform) scale and a translation.
+/// </summary>
+Eigen::Matrix4f randomTransform(std::mt19937& random)
+{
+	std::uniform_real_distribution<float> uniform(-1.f, 1.f), scale(0.2f, 3.f);
+	Eigen::Vector3f axis = Eigen::Vector3f(uniform(random), uniform(random), uniform(random)).normalized();
+	Eigen::Affine3f transform = Eigen::Translation3f(5.f * uniform(random), 5.f * uniform(random), 5.f * uniform(random))
+		* Eigen::AngleAxisf(3.f * uniform(random), axis)
+		* Eigen::Scaling(scale(random), scale(random), scale(random));
+	return transform.matrix();
+}
+
+void testEntity()
+{
+	Entity entity;
+	CHECK(entity.isIdentity() && entity.isAffine());
+
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+	int wrong = 0;
+	for (int i = 0; i < 100; ++i) {
+		Eigen::Matrix4f m = randomTransform(random);
+		if (i % 10 == 9) m.row(3) << 0.01f * uniform(random), 0.01f * uniform(random), 0.f, 1.f; // Projective
+		entity.modelToWorld(m);
+		bool affine = i % 10 != 9;
+		if (entity.isIdentity() || entity.isAffine() != affine) ++wrong;
+		// The cached matrices match ones worked out directly.
+		if (!(entity.worldToModel() * m).isIdentity(1e-4f)) ++wrong;
+		if (!entity.normalMatrix().isApprox(m.block<3, 3>(0, 0).inverse().transpose(), 1e-4f)) ++wrong;
+
+		Eigen::Vector3f p(uniform(random), uniform(random), uniform(random)), d(uniform(random), uniform(random), uniform(random));
+		Eigen::Vector4f h = m * p.homogeneous();
+		if (!entity.positionToWorld(p).isApprox(h.head<3>() / h.w(), 1e-4f)) ++wrong;
+		if (!entity.positionToModel(entity.positionToWorld(p)).isApprox(p, 1e-3f)) ++wrong;
+		// Directions and normals only make sense for affine transforms.
+		if (!affine) continue;
+		if (!entity.directionToModel(entity.directionToWorld(d)).isApprox(d, 1e-3f)) ++wrong;
+		// Normals stay perpendicular to directions in the surface.
+		Eigen::Vector3f n = d.cross(p);
+		if (std::abs(entity.normalToWorld(n).normalized().dot(entity.directionToWorld(d).normalized())) > 1e-4f) ++wrong;
+
+		Ray ray;
+		ray.origin = entity.positionToWorld(p);
+		ray.direction = entity.directionToWorld(d);
+		Ray modelRay = entity.rayToModel(ray);
+		if (!modelRay.origin.isApprox(p, 1e-3f) || !modelRay.direction.isApprox(d, 1e-3f)) ++wrong;
+	}
+	CHECK(wrong == 0);
+
+	entity.modelToWorld(Eigen::Matrix4f::Identity());
+	CHECK(entity.isIdentity() && entity.isAffine());
+	CHECK(entity.worldToModel().isIdentity(0.f) && entity.normalMatrix().isIdentity(0.f));
+}
+
+/// <summary>
+/// Rays from random points around a box through random points inside it.
+/// </summary>
+std::vector<Ray> makeRays(const AABB& bounds, int count, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	Eigen::Vector3f size = bounds.max - bounds.min;
+	std::vector<Ray> rays(count);
+	for (Ray& ray : rays) {
+		Eigen::Vector3f from = bounds.min - size + 3.f * Eigen::Vector3f(uniform(random), uniform(random), uniform(random)).cwiseProduct(size);
+		Eigen::Vector3f to = bounds.min + Eigen::Vector3f(uniform(random), uniform(random), uniform(random)).cwiseProduct(size);
+		ray.origin = from;
+		ray.direction = (to - from).normalized();
+	}
+	return rays;
+}
+
+void testWorldTriangles(const Model& model)
+{
+	// Meshes bake their triangles into world space; Triangles transform theirs for every
+	// ray. Both do the same arithmetic, so they should find exactly the same hits.
+	std::mt19937 random(6);
+	Mesh mesh(nullptr, &model);
+	Scene triangles;
+	for (int f = 0; f < model.nfaces(); ++f) {
+		const VertexIndices* face = model.face(f);
+		triangles.renderables.push_back(std::make_shared<Triangle>(nullptr,
+			model.vert(face[0].vert), model.vert(face[1].vert), model.vert(face[2].vert), true));
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		// Setting the transform again rebakes the triangles.
+		Eigen::Matrix4f transform = randomTransform(random);
+		mesh.modelToWorld(transform);
+		for (const std::shared_ptr<Renderable>& triangle : triangles.renderables) triangle->modelToWorld(transform);
+
+		int wrong = 0;
+		for (const Ray& ray : makeRays(mesh.getAABB(), 2000, random)) {
+			HitInfo meshHit{}, triangleHit{};
+			bool hit = mesh.closestHit(ray, 0.f, std::numeric_limits<float>::max(), meshHit, DEFAULT_BITMASK);
+			if (hit != triangles.closestHit(ray, 0.f, std::numeric_limits<float>::max(), triangleHit, DEFAULT_BITMASK)) ++wrong;
+			else if (hit && (meshHit.hitT != triangleHit.hitT || meshHit.object != &mesh
+				|| triangleHit.object != triangles.renderables[meshHit.primitive].get())) ++wrong;
+		}
+		CHECK(wrong == 0);
+	}
+}
+
+void testTriangleKernel(const Model& model)
+{
+	// Ranges of triangles are tested several at a time (see WorldTriangles), which should
+	// give exactly the same results as testing them one at a time. The ranges start and
+	// end at different points within a packet.
+	std::cout << "Triangle packets: " << (CpuFeatures::get().avx ? "AVX, 8 wide" : "SSE or scalar") << std::endl;
+	std::mt19937 random(7);
+	Entity transform;
+	transform.modelToWorld(randomTransform(random));
+	std::vector<VertexIndices> triangles(model.face(0), model.face(0) + 3 * model.nfaces());
+	WorldTriangles world;
+	world.bake(model, triangles, transform);
+	CHECK(world.size() == model.nfaces());
+
+	std::uniform_int_distribution<int> start(0, model.nfaces() - 20);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	int wrong = 0, hits = 0;
+	for (int r = 0; r < 20000; ++r) {
+		int first = start(random), count = 1 + r % 19;
+		bool culling = r % 2 == 0;
+		// Aim at a triangle in the range, from a random direction, so most rays hit.
+		const VertexIndices* face = model.face(first + r % count);
+		Eigen::Vector3f target = transform.positionToWorld(
+			(model.vert(face[0].vert) + model.vert(face[1].vert) + model.vert(face[2].vert)) / 3.f);
+		Eigen::Vector3f offset = Eigen::Vector3f(uniform(random), uniform(random), uniform(random)) * 2.f - Eigen::Vector3f::Ones();
+		Ray ray;
+		ray.origin = target + 3.f * offset;
+		ray.direction = -offset.normalized();
+		float minT = r % 3 == 0 ? 2.9f * offset.norm() : 0.f, maxT = r % 5 == 0 ? 3.f * offset.norm() : 1e30f;
+
+		float closestT = maxT, closestU = 0.f, closestV = 0.f;
+		int closest = -1;
+		for (int tri = first; tri < first + count; ++tri) {
+			float t, u, v;
+			if (!world.intersect(tri, ray, culling, t, u, v) || t < minT || t > closestT) continue;
+			if (closest != -1 && t >= closestT) continue;
+			closest = tri;
+			closestT = t;
+			closestU = u;
+			closestV = v;
+		}
+
+		float t = maxT, u = 0.f, v = 0.f;
+		int tri = world.intersectRange(ray, first, count, culling, minT, t, u, v);
+		if (tri != closest) ++wrong;
+		else if (tri != -1 && (t != closestT || u != closestU || v != closestV)) ++wrong;
+		if (world.occludedRange(ray, first, count, culling, minT, maxT) != (closest != -1)) ++wrong;
+		if (closest != -1) ++hits;
+	}
+	std::cout << "Triangle ranges: " << hits << " of 20000 hit." << std::endl;
+	CHECK(wrong == 0);
+	CHECK(hits > 5000);
+}
+
+int main(int argc, char** argv)
+{
+	Model model((sourceDirectory(argc, argv) / "models" / "spot.obj").string().c_str());
+	testEntity();
+	testWorldTriangles(model);
+	testTriangleKernel(model);
+	return testResult();
+}
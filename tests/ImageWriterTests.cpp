@@ -0,0 +1,416 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <random>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "Framebuffer.hpp"
+#include "TGAWriter.hpp"
+#include "PNGWriter.hpp"
+#include "PFMWriter.hpp"
+#include "EXRWriter.hpp"
+
+std::vector<unsigned char> readFile(const std::string& filename)
+{
+	std::ifstream in(filename, std::ifstream::binary);
+	return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+uint32_t readLE32(const std::vector<unsigned char>& file, size_t offset)
+{
+	uint32_t value = 0;
+	for (int b = 3; b >= 0; --b) value = (value << 8) | file[offset + b];
+	return value;
+}
+
+uint64_t readLE64(const std::vector<unsigned char>& file, size_t offset)
+{
+	return readLE32(file, offset) | (uint64_t(readLE32(file, offset + 4)) << 32);
+}
+
+uint32_t readBE32(const std::vector<unsigned char>& file, size_t offset)
+{
+	uint32_t value = 0;
+	for (int b = 0; b < 4; ++b) value = (value << 8) | file[offset + b];
+	return value;
+}
+
+float readFloatLE(const std::vector<unsigned char>& file, size_t offset)
+{
+	uint32_t bits = readLE32(file, offset);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/// <summary>
+/// True if two floats have the same bits, so NaNs compare equal to themselves.
+/// </summary>
+bool sameFloat(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+/// <summary>
+/// The byte a value should be saved as in the 8-bit formats: clamped to [0, 1], scaled by
+/// 255 and truncated, with NaN giving 0.
+/// </summary>
+unsigned char quantise(float value)
+{
+	if (std::isnan(value) || value <= 0.f) return 0;
+	if (value >= 1.f) return 255;
+	return static_cast<unsigned char>(value * 255.f);
+}
+
+/// <summary>
+/// An image of random values, a little outside [0, 1] so that clamping is tested too,
+/// with some exact byte values and a few infinities and NaNs.
+/// </summary>
+Framebuffer makeImage(int width, int height, int seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> uniform(-0.2f, 1.2f);
+	std::uniform_int_distribution<int> byte(0, 255), kind(0, 99);
+	Framebuffer image(width, height);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			Eigen::Vector3f color;
+			for (int c = 0; c < 3; ++c) {
+				int k = kind(random);
+				if (k < 10) color[c] = byte(random) / 255.f;
+				else if (k == 10) color[c] = std::numeric_limits<float>::quiet_NaN();
+				else if (k == 11) color[c] = std::numeric_limits<float>::infinity();
+				else if (k == 12) color[c] = -std::numeric_limits<float>::infinity();
+				else color[c] = uniform(random);
+			}
+			image.set(x, y, color);
+		}
+	}
+	return image;
+}
+
+void testQuantise()
+{
+	// 12 pixels, so the first 32 values go through the SIMD path (where there is one) and
+	// the last 4 through the scalar one. Each special value is placed in both.
+	const float nan = std::numeric_limits<float>::quiet_NaN(), inf = std::numeric_limits<float>::infinity();
+	const float special[9] = { nan, -inf, inf, -1.f, 0.f, 1.f, 2.f, 0.5f, 254.f / 255.f };
+	const unsigned char expected[9] = { 0, 0, 255, 0, 0, 255, 255, 127, 254 };
+	for (int offset : { 0, 27 }) {
+		Framebuffer image(12, 1);
+		for (int x = 0; x < 12; ++x) image.set(x, 0, Eigen::Vector3f(0.25f, 0.25f, 0.25f));
+		for (int i = 0; i < 9; ++i) {
+			int value = offset + i, x = value / 3;
+			Eigen::Vector3f color = image.get(x, 0);
+			color[value % 3] = special[i];
+			image.set(x, 0, color);
+		}
+		unsigned char out[36];
+		image.quantiseRow(0, out);
+		for (int i = 0; i < 9; ++i) CHECK(out[offset + i] == expected[i]);
+		CHECK(out[offset == 0 ? 35 : 0] == 63);
+	}
+
+	// Every byte value converts back to itself.
+	Framebuffer bytes(86, 1);
+	for (int x = 0; x < 86; ++x) bytes.set(x, 0, Eigen::Vector3f(3 * x, 3 * x + 1, 3 * x + 2) / 255.f);
+	unsigned char out[258];
+	bytes.quantiseRow(0, out);
+	int wrong = 0;
+	for (int i = 0; i < 256; ++i) if (out[i] != i) ++wrong;
+	CHECK(wrong == 0);
+}
+
+/// <summary>
+/// CRC-32 as given in the PNG specification, worked out bit by bit.
+/// </summary>
+uint32_t referenceCrc32(const unsigned char* data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int k = 0; k < 8; ++k) crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+	}
+	return ~crc;
+}
+
+void testPNG(const Framebuffer& image, const std::filesystem::path& directory)
+{
+	std::string filename = (directory / "image.png").string();
+	PNGWriter().write(image, filename);
+	std::vector<unsigned char> file = readFile(filename);
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (!CHECK(file.size() > 8 && memcmp(file.data(), signature, 8) == 0)) return;
+
+	// Read the chunks, checking their CRCs, and join up the IDAT data.
+	std::vector<std::string> types;
+	std::vector<unsigned char> ihdr, zlib;
+	int badCrcs = 0, idats = 0;
+	size_t offset = 8;
+	while (offset + 12 <= file.size()) {
+		uint32_t length = readBE32(file, offset);
+		if (!CHECK(offset + 12 + length <= file.size())) return;
+		std::string type(file.begin() + offset + 4, file.begin() + offset + 8);
+		const unsigned char* data = &file[offset + 8];
+		if (readBE32(file, offset + 8 + length) != referenceCrc32(&file[offset + 4], 4 + length)) ++badCrcs;
+		if (type == "IHDR") ihdr.assign(data, data + length);
+		if (type == "IDAT") {
+			zlib.insert(zlib.end(), data, data + length);
+			++idats;
+		}
+		if (types.empty() || types.back() != type) types.push_back(type);
+		offset += 12 + length;
+	}
+	CHECK(offset == file.size() && badCrcs == 0);
+	CHECK((types == std::vector<std::string>{ "IHDR", "IDAT", "IEND" }));
+	// One IDAT chunk for each band of 64 rows.
+	CHECK(idats == (image.height() + 63) / 64);
+	if (!CHECK(ihdr.size() == 13)) return;
+	CHECK(readBE32(ihdr, 0) == uint32_t(image.width()) && readBE32(ihdr, 4) == uint32_t(image.height()));
+	CHECK(ihdr[8] == 8 && ihdr[9] == 2 && ihdr[10] == 0 && ihdr[11] == 0 && ihdr[12] == 0);
+
+	// The zlib stream holds stored deflate blocks, the last one marked final, then the
+	// Adler-32 of the data.
+	if (!CHECK(zlib.size() > 6 && zlib[0] == 0x78 && (zlib[0] * 256 + zlib[1]) % 31 == 0)) return;
+	std::vector<unsigned char> data;
+	bool final = false;
+	int blocks = 0, badBlocks = 0;
+	offset = 2;
+	while (!final && offset + 5 <= zlib.size()) {
+		final = zlib[offset] == 1;
+		if (zlib[offset] > 1) ++badBlocks;
+		uint32_t length = zlib[offset + 1] | (zlib[offset + 2] << 8), complement = zlib[offset + 3] | (zlib[offset + 4] << 8);
+		if (length != (~complement & 0xFFFF) || offset + 5 + length > zlib.size()) {
+			++badBlocks;
+			break;
+		}
+		data.insert(data.end(), zlib.begin() + offset + 5, zlib.begin() + offset + 5 + length);
+		offset += 5 + length;
+		++blocks;
+	}
+	CHECK(final && badBlocks == 0 && offset + 4 == zlib.size());
+	// Wide enough that a band doesn't fit in one block.
+	CHECK(blocks > idats);
+	uint32_t a = 1, b = 0;
+	for (unsigned char byte : data) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	CHECK(offset + 4 <= zlib.size() && readBE32(zlib, offset) == ((b << 16) | a));
+
+	// Each row is filter type 0 then RGB, from the top down.
+	size_t rowBytes = 1 + 3 * size_t(image.width());
+	if (!CHECK(data.size() == rowBytes * image.height())) return;
+	int wrong = 0;
+	for (int r = 0; r < image.height(); ++r) {
+		const unsigned char* row = &data[r * rowBytes];
+		if (row[0] != 0) ++wrong;
+		for (int x = 0; x < image.width(); ++x) {
+			Eigen::Vector3f color = image.get(x, image.height() - 1 - r);
+			for (int c = 0; c < 3; ++c) if (row[1 + 3 * x + c] != quantise(color[c])) ++wrong;
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+void testPFM(const Framebuffer& image, const std::filesystem::path& directory)
+{
+	std::string filename = (directory / "image.pfm").string();
+	PFMWriter().write(image, filename);
+	std::vector<unsigned char> file = readFile(filename);
+	std::string header = "PF\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n-1.0\n";
+	if (!CHECK(file.size() == header.size() + 12 * size_t(image.width()) * image.height())) return;
+	CHECK(std::string(file.begin(), file.begin() + header.size()) == header);
+
+	// Little-endian floats, unclamped, from the bottom up.
+	int wrong = 0;
+	size_t offset = header.size();
+	for (int y = 0; y < image.height(); ++y) {
+		for (int x = 0; x < image.width(); ++x) {
+			Eigen::Vector3f color = image.get(x, y);
+			for (int c = 0; c < 3; ++c, offset += 4) if (!sameFloat(readFloatLE(file, offset), color[c])) ++wrong;
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+void testEXR(const Framebuffer& image, const std::filesystem::path& directory)
+{
+	std::string filename = (directory / "image.exr").string();
+	EXRWriter().write(image, filename);
+	std::vector<unsigned char> file = readFile(filename);
+	if (!CHECK(file.size() > 8)) return;
+	CHECK(readLE32(file, 0) == 20000630 && readLE32(file, 4) == 2);
+
+	// Attributes are a name, type, size and value, until an empty name.
+	std::vector<std::string> names;
+	std::vector<unsigned char> channels, compression, dataWindow;
+	size_t offset = 8;
+	while (offset < file.size() && file[offset] != 0) {
+		std::string name(reinterpret_cast<const char*>(&file[offset]));
+		offset += name.size() + 1;
+		std::string type(reinterpret_cast<const char*>(&file[offset]));
+		offset += type.size() + 1;
+		uint32_t size = readLE32(file, offset);
+		offset += 4;
+		if (!CHECK(offset + size < file.size())) return;
+		std::vector<unsigned char> value(file.begin() + offset, file.begin() + offset + size);
+		if (name == "channels") channels = value;
+		if (name == "compression") compression = value;
+		if (name == "dataWindow") dataWindow = value;
+		names.push_back(name);
+		offset += size;
+	}
+	++offset;
+	for (const char* required : { "channels", "compression", "dataWindow", "displayWindow", "lineOrder",
+		"pixelAspectRatio", "screenWindowCenter", "screenWindowWidth" }) {
+		CHECK(std::find(names.begin(), names.end(), required) != names.end());
+	}
+	// B, G and R as 32-bit floats.
+	std::vector<unsigned char> expectedChannels;
+	for (char channel : { 'B', 'G', 'R' }) {
+		const unsigned char entry[18] = { (unsigned char)channel, 0, 2, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0 };
+		expectedChannels.insert(expectedChannels.end(), entry, entry + 18);
+	}
+	expectedChannels.push_back(0);
+	CHECK(channels == expectedChannels);
+	CHECK(compression == std::vector<unsigned char>{ 0 });
+	CHECK(dataWindow.size() == 16 && readLE32(dataWindow, 0) == 0 && readLE32(dataWindow, 4) == 0
+		&& readLE32(dataWindow, 8) == uint32_t(image.width() - 1) && readLE32(dataWindow, 12) == uint32_t(image.height() - 1));
+
+	// The offset table gives the block of each row, from the top. Each block holds the row
+	// number, the size of the data, then the row's B, G and R values.
+	size_t dataBytes = 12 * size_t(image.width());
+	if (!CHECK(offset + 8 * size_t(image.height()) <= file.size())) return;
+	int badOffsets = 0, wrong = 0;
+	uint64_t expectedOffset = offset + 8 * size_t(image.height());
+	for (int y = 0; y < image.height(); ++y) {
+		uint64_t block = readLE64(file, offset + 8 * size_t(y));
+		if (block != expectedOffset || block + 8 + dataBytes > file.size()) {
+			++badOffsets;
+			break;
+		}
+		expectedOffset += 8 + dataBytes;
+		if (readLE32(file, block) != uint32_t(y) || readLE32(file, block + 4) != dataBytes) ++wrong;
+		for (int x = 0; x < image.width(); ++x) {
+			Eigen::Vector3f color = image.get(x, image.height() - 1 - y);
+			for (int c = 0; c < 3; ++c) {
+				float stored = readFloatLE(file, block + 8 + 4 * (size_t(2 - c) * image.width() + x));
+				if (!sameFloat(stored, color[c])) ++wrong;
+			}
+		}
+	}
+	CHECK(badOffsets == 0 && wrong == 0);
+	CHECK(expectedOffset == file.size());
+}
+
+void testTGA(const Framebuffer& image, const std::filesystem::path& directory)
+{
+	std::string filename = (directory / "image.tga").string();
+	TGAWriter().write(image, filename);
+	std::vector<unsigned char> file = readFile(filename);
+	const char footer[] = "\0\0\0\0\0\0\0\0TRUEVISION-XFILE.";
+	size_t pixelBytes = 3 * size_t(image.width()) * image.height();
+	if (!CHECK(file.size() == 18 + pixelBytes + sizeof(footer))) return;
+	const unsigned char header[18] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		(unsigned char)image.width(), (unsigned char)(image.width() >> 8),
+		(unsigned char)image.height(), (unsigned char)(image.height() >> 8), 24, 0 };
+	CHECK(memcmp(file.data(), header, 18) == 0);
+	CHECK(memcmp(&file[18 + pixelBytes], footer, sizeof(footer)) == 0);
+
+	// BGR, from the bottom up.
+	int wrong = 0;
+	size_t offset = 18;
+	for (int y = 0; y < image.height(); ++y) {
+		for (int x = 0; x < image.width(); ++x, offset += 3) {
+			Eigen::Vector3f color = image.get(x, y);
+			for (int c = 0; c < 3; ++c) if (file[offset + 2 - c] != quantise(color[c])) ++wrong;
+		}
+	}
+	CHECK(wrong == 0);
+
+	Framebuffer tooWide(70000, 1);
+	CHECK_THROWS(TGAWriter().write(tooWide, (directory / "wide.tga").string()));
+}
+
+/// <summary>
+/// Writes an image in bands of the given number of rows, each copied into a framebuffer
+/// that only holds that many rows, in the order the writer needs them.
+/// </summary>
+void writeInBands(ImageWriter& writer, const Framebuffer& image, int bandRows, const std::string& filename)
+{
+	Framebuffer band(image.width(), image.height(), bandRows);
+	writer.open(filename, image.width(), image.height());
+	for (int done = 0; done < image.height(); done += bandRows) {
+		int rows = std::min(bandRows, image.height() - done);
+		int first = writer.topDown() ? image.height() - done - rows : done;
+		band.setRows(first, rows);
+		for (int y = first; y < first + rows; ++y) {
+			for (int x = 0; x < image.width(); ++x) band.set(x, y, image.get(x, y));
+		}
+		writer.writeRows(band);
+	}
+	writer.close();
+}
+
+void testBands(const Framebuffer& image, const std::filesystem::path& directory)
+{
+	// Streaming the image out in bands gives exactly the same file as writing it all at
+	// once, whether the bands are smaller or larger than the writers' own bands of 64 rows.
+	std::vector<std::pair<std::string, std::unique_ptr<ImageWriter>>> writers;
+	writers.emplace_back("tga", std::make_unique<TGAWriter>());
+	writers.emplace_back("png", std::make_unique<PNGWriter>());
+	writers.emplace_back("pfm", std::make_unique<PFMWriter>());
+	writers.emplace_back("exr", std::make_unique<EXRWriter>());
+	for (auto& [extension, writer] : writers) {
+		std::string whole = (directory / ("whole." + extension)).string();
+		writer->write(image, whole);
+		std::vector<unsigned char> expected = readFile(whole);
+		for (int bandRows : { 1, 7, 64, 100 }) {
+			std::string banded = (directory / ("banded" + std::to_string(bandRows) + "." + extension)).string();
+			writeInBands(*writer, image, bandRows, banded);
+			if (!CHECK(readFile(banded) == expected)) std::cerr << extension << " file written in bands of " << bandRows << " rows differs." << std::endl;
+		}
+
+		// Rows must come in order, all of them, and match the size of the image.
+		std::string bad = (directory / ("bad." + extension)).string();
+		int first = writer->topDown() ? image.height() - 10 : 0, wrongEnd = writer->topDown() ? 0 : image.height() - 10;
+		Framebuffer band(image.width(), image.height(), 10);
+		writer->open(bad, image.width(), image.height());
+		band.setRows(wrongEnd, 10);
+		CHECK_THROWS(writer->writeRows(band));
+		band.setRows(first, 10);
+		writer->writeRows(band);
+		CHECK_THROWS(writer->writeRows(band));
+		CHECK_THROWS(writer->close());
+		Framebuffer narrow(image.width() - 1, image.height(), 10);
+		narrow.setRows(writer->topDown() ? first - 10 : 10, 10);
+		CHECK_THROWS(writer->writeRows(narrow));
+	}
+}
+
+int main()
+{
+	std::filesystem::path directory = makeTestDirectory("ImageWriterTests");
+	testQuantise();
+	// Wide enough that a band of PNG rows needs more than one deflate block, and tall
+	// enough for several bands, the last one partly full.
+	Framebuffer image = makeImage(401, 150, 1);
+	testPNG(image, directory);
+	testPFM(image, directory);
+	testEXR(image, directory);
+	testTGA(image, directory);
+	testBands(image, directory);
+	std::filesystem::remove_all(directory);
+	return testResult();
+}
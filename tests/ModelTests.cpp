@@ -0,0 +1,333 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <random>
+#include <iterator>
+#include <cstring>
+#include <cstddef>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "Model.hpp"
+#include "BVHBuilder.hpp"
+#include "LinearMeshBVH.hpp"
+#include "ModelCache.hpp"
+
+/// <summary>
+/// Writes a file for a test to load, returning its name.
+/// </summary>
+std::string writeFile(const std::filesystem::path& directory, const std::string& name, const std::string& contents)
+{
+	std::string filename = (directory / name).string();
+	std::ofstream(filename, std::ofstream::binary) << contents;
+	return filename;
+}
+
+/// <summary>
+/// True if triangle f of the model has the given (zero based) vertex indices.
+/// </summary>
+bool faceIs(const Model& model, int f, int v0, int v1, int v2)
+{
+	const VertexIndices* face = model.face(f);
+	return face[0].vert == v0 && face[1].vert == v1 && face[2].vert == v2;
+}
+
+void testFlatIndexBuffer(const std::filesystem::path& directory)
+{
+	// Polygons are split into fans of triangles, all in one buffer.
+	Model model(writeFile(directory, "polygons.obj",
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv -1 0.5 0\n"
+		"f 1 2 3\n"
+		"f 1 2 3 4\n"
+		"f 1 2 3 4 5\n").c_str());
+	CHECK(model.nverts() == 5);
+	CHECK(model.nfaces() == 6);
+	CHECK(faceIs(model, 0, 0, 1, 2));
+	CHECK(faceIs(model, 1, 0, 1, 2) && faceIs(model, 2, 0, 2, 3));
+	CHECK(faceIs(model, 3, 0, 1, 2) && faceIs(model, 4, 0, 2, 3) && faceIs(model, 5, 0, 3, 4));
+	for (int f = 0; f < model.nfaces(); ++f) CHECK(model.face(f) == model.face(0) + 3 * f);
+
+	// Vertices are changed in place, without moving the storage the accessors point into.
+	const Eigen::Vector3f* first = &model.vert(0);
+	model.setVert(2, Eigen::Vector3f(2.f, 2.f, 2.f));
+	CHECK(&model.vert(0) == first && model.vert(2) == Eigen::Vector3f(2.f, 2.f, 2.f));
+}
+
+/// <summary>
+/// True if two models hold exactly the same mesh (not counting any stored BVH).
+/// </summary>
+bool sameMesh(const Model& a, const Model& b)
+{
+	if (a.nverts() != b.nverts() || a.nfaces() != b.nfaces() || a.hasNormals() != b.hasNormals()) return false;
+	for (int v = 0; v < a.nverts(); ++v) {
+		if (a.vert(v) != b.vert(v)) return false;
+	}
+	for (int f = 0; f < a.nfaces(); ++f) {
+		for (int c = 0; c < 3; ++c) {
+			const VertexIndices &ia = a.face(f)[c], &ib = b.face(f)[c];
+			if (ia.vert != ib.vert || ia.tex != ib.tex || ia.norm != ib.norm) return false;
+			if (a.texCoord(ia.tex) != b.texCoord(ib.tex)) return false;
+			if (a.hasNormals() && a.normal(ia.norm) != b.normal(ib.norm)) return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// True if corner c of triangle f has the given (zero based) vertex, texture coordinate
+/// and normal indices.
+/// </summary>
+bool cornerIs(const Model& model, int f, int c, int vert, int tex, int norm)
+{
+	const VertexIndices& index = model.face(f)[c];
+	return index.vert == vert && index.tex == tex && index.norm == norm;
+}
+
+void testObjParser(const std::filesystem::path& directory)
+{
+	const std::string data =
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\n"
+		"vt 0 0\nvt 1 0\nvt 0 1\n"
+		"vn 0 0 1\nvn 0 0 -1\n";
+
+	// Each form of face corner.
+	Model full(writeFile(directory, "full.obj", data + "f 1/1/1 2/2/1 3/3/2\n").c_str());
+	CHECK(full.nfaces() == 1 && full.hasNormals());
+	CHECK(cornerIs(full, 0, 0, 0, 0, 0) && cornerIs(full, 0, 1, 1, 1, 0) && cornerIs(full, 0, 2, 2, 2, 1));
+	CHECK(full.normal(1) == Eigen::Vector3f(0.f, 0.f, -1.f) && full.texCoord(2) == Eigen::Vector2f(0.f, 1.f));
+
+	// Without normals on some corners, the model has none. Corners without texture
+	// coordinates get an extra one of (0, 0).
+	Model texOnly(writeFile(directory, "tex.obj", data + "f 1/1 2/2 3/3\nf 2 4 3\n").c_str());
+	CHECK(texOnly.nfaces() == 2 && !texOnly.hasNormals());
+	CHECK(cornerIs(texOnly, 0, 1, 1, 1, -1) && texOnly.face(1)[0].tex == 3 && texOnly.texCoord(3) == Eigen::Vector2f::Zero());
+	Model normalOnly(writeFile(directory, "normal.obj", data + "f 1//2 2//2 3//1\n").c_str());
+	CHECK(normalOnly.hasNormals() && cornerIs(normalOnly, 0, 0, 0, 3, 1) && cornerIs(normalOnly, 0, 2, 2, 3, 0));
+
+	// Negative indices count back from the last element defined so far.
+	Model relative(writeFile(directory, "relative.obj", data + "f -4/-3/-2 -3/-2/-2 -2/-1/-1\nv 2 2 2\nf -1 -2 -3\n").c_str());
+	CHECK(cornerIs(relative, 0, 0, 0, 0, 0) && cornerIs(relative, 0, 2, 2, 2, 1));
+	CHECK(relative.face(1)[0].vert == 4 && relative.face(1)[1].vert == 3 && relative.face(1)[2].vert == 2);
+
+	// Whitespace, comments, CRLF line ends, signs and exponents, other keywords, a vt with
+	// only u, and no newline at the end.
+	Model messy(writeFile(directory, "messy.obj",
+		"# comment\r\n  o object\r\ng group\r\nusemtl material\r\ns off\r\n"
+		"v\t+1.5e1 -2  0.25\r\nv 0 1 0 1\r\n\r\nv 1 1 1\r\nvt 0.5\r\n"
+		"f\t1/1  2/1\t3/1\r\nl 1 2").c_str());
+	CHECK(messy.nverts() == 3 && messy.nfaces() == 1);
+	CHECK(messy.vert(0) == Eigen::Vector3f(15.f, -2.f, 0.25f) && messy.texCoord(0) == Eigen::Vector2f(0.5f, 0.f));
+
+	// Errors.
+	CHECK_THROWS(Model(writeFile(directory, "zero.obj", data + "f 0 1 2\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "range.obj", data + "f 1 2 5\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "before.obj", data + "f -5 1 2\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "badnormal.obj", data + "f 1//3 2//1 3//1\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "corners.obj", data + "f 1 2\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "float.obj", "v 1 x 2\n").c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "junk.obj", data + "f 1 2 3x\n").c_str()));
+	CHECK_THROWS(Model((directory / "missing.obj").string().c_str()));
+
+	// A file of several chunks (which are parsed in parallel), with negative indices
+	// reaching back into earlier chunks, matches the same mesh with positive indices.
+	std::string relativeObj, absoluteObj;
+	const int size = 400;
+	for (int z = 0; z <= size; ++z) {
+		for (int x = 0; x <= size; ++x) {
+			std::string v = "v " + std::to_string(x) + " " + std::to_string((x * z) % 7) + " " + std::to_string(z) + "\n";
+			relativeObj += v;
+			absoluteObj += v;
+		}
+		if (z == 0) continue;
+		for (int x = 0; x < size; ++x) {
+			// Corners of the quad between this row and the one before.
+			int v = z * (size + 1) + x + 1, defined = (z + 1) * (size + 1);
+			int corners[4] = { v - size - 1, v, v + 1, v - size };
+			relativeObj += "f";
+			absoluteObj += "f";
+			for (int corner : corners) {
+				relativeObj += " " + std::to_string(corner - defined - 1);
+				absoluteObj += " " + std::to_string(corner);
+			}
+			relativeObj += "\n";
+			absoluteObj += "\n";
+		}
+	}
+	CHECK(relativeObj.size() > 2 << 20);
+	Model chunkedRelative(writeFile(directory, "chunkedRelative.obj", relativeObj).c_str());
+	Model chunkedAbsolute(writeFile(directory, "chunkedAbsolute.obj", absoluteObj).c_str());
+	CHECK(chunkedAbsolute.nfaces() == 2 * size * size);
+	CHECK(sameMesh(chunkedRelative, chunkedAbsolute));
+}
+
+std::vector<char> readFile(const std::string& filename)
+{
+	std::ifstream in(filename, std::ifstream::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void testMeshFile(const std::filesystem::path& sourceDir, const std::filesystem::path& directory)
+{
+	Model obj((sourceDir / "models" / "spot.obj").string().c_str());
+	std::string plain = (directory / "plain.rtmesh").string();
+	obj.save(plain.c_str());
+	Model loaded(plain.c_str());
+	CHECK(sameMesh(obj, loaded));
+	CHECK(!loaded.hasBVH());
+
+	// With a BVH, built in model space.
+	std::vector<BVHPrimitive> prims = makeMeshBuildPrimitives(obj, Eigen::Matrix4f::Identity());
+	std::unique_ptr<BVHBuildNode> root = BVHBuilder().build(prims);
+	std::vector<MeshFileBVHNode> nodes;
+	std::vector<int32_t> primitives;
+	flattenBuildTree(*root, prims, nodes, primitives);
+	std::string withBVH = (directory / "bvh.rtmesh").string();
+	obj.save(withBVH.c_str(), nodes, primitives);
+	Model stored(withBVH.c_str());
+	CHECK(sameMesh(obj, stored));
+	CHECK(stored.hasBVH() && stored.nbvhNodes() == (int)nodes.size() && stored.nbvhPrimitives() == (int)primitives.size());
+	CHECK(memcmp(stored.bvhNodes(), nodes.data(), nodes.size() * sizeof(MeshFileBVHNode)) == 0);
+	CHECK(memcmp(stored.bvhPrimitives(), primitives.data(), primitives.size() * sizeof(int32_t)) == 0);
+	// Saving a mapped model again gives the same file.
+	std::string again = (directory / "again.rtmesh").string();
+	stored.save(again.c_str(), nodes, primitives);
+	CHECK(readFile(again) == readFile(withBVH));
+
+	// The stored tree is used for a mesh placed anywhere, with its bounds refitted. It should
+	// find exactly the same hits as a tree built for the transform.
+	Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+	transform.block<3, 3>(0, 0) = 2.f * Eigen::AngleAxisf(1.f, Eigen::Vector3f::UnitY()).toRotationMatrix();
+	std::vector<BVHPrimitive> storedPrims;
+	CHECK(loadModelBuildTree(stored, transform, storedPrims)->countNodes() == root->countNodes());
+	LinearMeshBVH fromFile(stored, nullptr, BVHBuildParams(), transform), built(obj, nullptr, BVHBuildParams(), transform);
+	std::mt19937 random(9);
+	std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+	int wrong = 0;
+	for (int f = 0; f < obj.nfaces(); ++f) {
+		const VertexIndices* face = obj.face(f);
+		Eigen::Vector3f target = fromFile.positionToWorld((obj.vert(face[0].vert) + obj.vert(face[1].vert) + obj.vert(face[2].vert)) / 3.f);
+		Ray ray;
+		ray.direction = Eigen::Vector3f(uniform(random), uniform(random), uniform(random)).normalized();
+		ray.origin = target - 5.f * ray.direction;
+		HitInfo a, b;
+		bool hitA = fromFile.closestHit(ray, 0.f, 100.f, a, DEFAULT_BITMASK), hitB = built.closestHit(ray, 0.f, 100.f, b, DEFAULT_BITMASK);
+		if (hitA != hitB || (hitA && a.hitT != b.hitT)) ++wrong;
+	}
+	CHECK(wrong == 0);
+
+	// Damaged files are rejected.
+	std::vector<char> bytes = readFile(withBVH);
+	CHECK_THROWS(Model(writeFile(directory, "truncated.rtmesh", std::string(bytes.data(), bytes.size() / 2)).c_str()));
+	CHECK_THROWS(Model(writeFile(directory, "header.rtmesh", std::string(bytes.data(), 20)).c_str()));
+	std::vector<char> version = bytes;
+	version[offsetof(MeshFileHeader, version)] ^= 0x7F;
+	CHECK_THROWS(Model(writeFile(directory, "version.rtmesh", std::string(version.data(), version.size())).c_str()));
+	// Indices outside the vertices, texture coordinates or normals, as a stale or
+	// hand-edited file might have.
+	MeshFileHeader header;
+	memcpy(&header, bytes.data(), sizeof(header));
+	CHECK(obj.hasNormals());
+	const int badValues[3] = { obj.nverts(), -1, 1 << 30 };
+	for (int component = 0; component < 3; ++component) {
+		std::vector<char> badIndices = bytes;
+		size_t offset = header.indices.offset + sizeof(VertexIndices) * (obj.nfaces() / 2) + sizeof(int) * component;
+		memcpy(&badIndices[offset], &badValues[component], sizeof(int));
+		std::string name = "index" + std::to_string(component) + ".rtmesh";
+		CHECK_THROWS(Model(writeFile(directory, name, std::string(badIndices.data(), badIndices.size())).c_str()));
+	}
+	std::vector<int32_t> badPrimitives = primitives;
+	badPrimitives[0] = obj.nfaces();
+	std::string badBVH = (directory / "badbvh.rtmesh").string();
+	obj.save(badBVH.c_str(), nodes, badPrimitives);
+	Model bad(badBVH.c_str());
+	CHECK_THROWS(loadModelBuildTree(bad, transform, storedPrims));
+}
+
+/// <summary>
+/// Number of files in a directory (0 if it doesn't exist).
+/// </summary>
+int countFiles(const std::filesystem::path& directory)
+{
+	if (!std::filesystem::exists(directory)) return 0;
+	return (int)std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator());
+}
+
+void testModelCache(const std::filesystem::path& sourceDir, const std::filesystem::path& directory)
+{
+	// Work on a copy of the model, so its contents can be changed.
+	std::filesystem::path source = directory / "cached.obj";
+	std::filesystem::copy_file(sourceDir / "models" / "spot.obj", source);
+	std::filesystem::path cacheDir = directory / "cache";
+	ModelCache cache(cacheDir.string());
+	CHECK(countFiles(cacheDir) == 0);
+
+	BVHBuildParams params;
+	std::unique_ptr<Model> first = cache.load(source.string(), params);
+	CHECK(countFiles(cacheDir) == 1 && first->hasBVH());
+	CHECK(sameMesh(*first, Model(source.string().c_str())));
+	std::filesystem::path cached = std::filesystem::directory_iterator(cacheDir)->path();
+	std::filesystem::file_time_type written = std::filesystem::last_write_time(cached);
+
+	// The same parameters find the cached file rather than writing it again. So do ones
+	// that only change how the tree is laid out when it's loaded.
+	BVHBuildParams layout = params;
+	layout.branchingFactor = 4;
+	layout.compressNodes = true;
+	layout.refitRebuildThreshold = 3.f;
+	CHECK(ModelCache::buildParamsKey(layout) == ModelCache::buildParamsKey(params));
+	CHECK(cache.load(source.string(), params)->hasBVH());
+	CHECK(cache.load(source.string(), layout)->hasBVH());
+	CHECK(countFiles(cacheDir) == 1 && std::filesystem::last_write_time(cached) == written);
+
+	// Anything that changes the stored tree gets its own file.
+	int expected = 1;
+	BVHBuildParams leaves = params, method = params, bins = params;
+	leaves.maxLeafSize = 2;
+	method.method = BVHBuildMethod::LBVH;
+	bins.sahBinCount = 32;
+	for (const BVHBuildParams& changed : { leaves, method, bins }) {
+		CHECK(ModelCache::buildParamsKey(changed) != ModelCache::buildParamsKey(params));
+		CHECK(cache.load(source.string(), changed)->hasBVH());
+		CHECK(countFiles(cacheDir) == ++expected);
+	}
+	Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+	transform(0, 3) = 1.f;
+	CHECK(cache.load(source.string(), params, transform)->hasBVH());
+	CHECK(countFiles(cacheDir) == ++expected);
+	CHECK(cache.load(source.string(), params, transform)->hasBVH());
+	CHECK(countFiles(cacheDir) == expected);
+
+	// A damaged cache file is rebuilt rather than used. (The model mapping it is released
+	// first, as it would see the changes.)
+	first.reset();
+	std::vector<char> bytes = readFile(cached.string());
+	MeshFileHeader header;
+	memcpy(&header, bytes.data(), sizeof(header));
+	const int badVert = -1;
+	memcpy(&bytes[header.indices.offset], &badVert, sizeof(int));
+	writeFile(cacheDir, cached.filename().string(), std::string(bytes.data(), bytes.size()));
+	CHECK_THROWS(Model(cached.string().c_str()));
+	std::unique_ptr<Model> rebuilt = cache.load(source.string(), params);
+	CHECK(rebuilt->hasBVH() && sameMesh(*rebuilt, Model(source.string().c_str())));
+	CHECK(countFiles(cacheDir) == expected && Model(cached.string().c_str()).hasBVH());
+	written = std::filesystem::last_write_time(cached);
+
+	// So does changing the source file, even though its name is the same.
+	std::ofstream(source, std::ofstream::app) << "# changed\n";
+	CHECK(cache.load(source.string(), params)->hasBVH());
+	CHECK(countFiles(cacheDir) == ++expected);
+	CHECK(std::filesystem::last_write_time(cached) == written);
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path directory = makeTestDirectory("ModelTests");
+	testFlatIndexBuffer(directory);
+	testObjParser(directory);
+	testMeshFile(sourceDirectory(argc, argv), directory);
+	testModelCache(sourceDirectory(argc, argv), directory);
+	std::filesystem::remove_all(directory);
+	return testResult();
+}
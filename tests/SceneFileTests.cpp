@@ -0,0 +1,238 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "SceneFile.hpp"
+
+/// <summary>
+/// Writes a scene file for a test to load, returning its name.
+/// </summary>
+std::string writeScene(const std::filesystem::path& directory, const std::string& name, const nlohmann::json& scene)
+{
+	std::string filename = (directory / name).string();
+	std::ofstream(filename) << scene.dump(4);
+	return filename;
+}
+
+int countFiles(const std::filesystem::path& directory)
+{
+	if (!std::filesystem::exists(directory)) return 0;
+	return (int)std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator());
+}
+
+/// <summary>
+/// A ray from far along -z, heading along +z through the centre of an object's bounds.
+/// </summary>
+Ray rayAt(const Renderable& renderable)
+{
+	AABB bounds = renderable.getAABB();
+	Ray ray;
+	ray.origin = 0.5f * (bounds.min + bounds.max) - Eigen::Vector3f(0.f, 0.f, 50.f);
+	ray.direction = Eigen::Vector3f(0.f, 0.f, 1.f);
+	return ray;
+}
+
+bool hit(const Renderable& renderable, const Ray& ray, HitInfo& info, IntersectMask mask = DEFAULT_BITMASK)
+{
+	return renderable.intersect(ray, 0.f, std::numeric_limits<float>::max(), info, mask);
+}
+
+nlohmann::json meshObject(const std::string& shader, float x, const nlohmann::json& extra = nlohmann::json::object())
+{
+	nlohmann::json object = { { "type", "mesh" }, { "model", "spot" }, { "shader", shader },
+		{ "transform", { { { "translate", { x, 0.f, 0.f } } }, { { "rotateY", 0.5f } } } } };
+	object.update(extra);
+	return object;
+}
+
+void testScene(const std::filesystem::path& sourceDir, const std::filesystem::path& directory)
+{
+	std::filesystem::copy_file(sourceDir / "models" / "spot.obj", directory / "spot.obj");
+	TGAImage texture(4, 4, TGAImage::RGB);
+	CHECK(texture.write_tga_file((directory / "texture.tga").string().c_str()));
+
+	nlohmann::json file = {
+		{ "bvh", { { "maxLeafSize", 4 } } },
+		{ "ambientLight", { 0.1f, 0.2f, 0.3f } },
+		{ "textures", { { "texture", { { "filename", "texture.tga" } } }, { "unused", { { "filename", "missing.tga" } } } } },
+		{ "models", { { "spot", { { "filename", "spot.obj" }, { "cache", true } } }, { "unused", { { "filename", "missing.obj" } } } } },
+		{ "shaders", {
+			{ "red", { { "type", "lambertian" }, { "albedo", { 1.f, 0.f, 0.f } } } },
+			{ "plastic", { { "type", "phong" }, { "albedo", { 0.f, 0.f, 1.f } }, { "specular", { 1.f, 1.f, 1.f } }, { "shininess", 50.f } } },
+			{ "textured", { { "type", "texturedLambertian" }, { "texture", "texture" }, { "shadowTest", false } } },
+			{ "mirror", { { "type", "mirror" } } } } },
+		{ "objects", {
+			{ { "type", "sphere" }, { "shader", "red" }, { "radius", 1.f },
+				{ "transform", { { { "scale", 2.f } }, { { "translate", { 0.f, 10.f, 0.f } } } } } },
+			{ { "type", "sphere" }, { "shader", "red" }, { "radius", 1.f }, { "mask", "visible" },
+				{ "transform", { 1, 0, 0, 0, 0, 1, 0, 30, 0, 0, 1, 0, 0, 0, 0, 1 } } },
+			{ { "type", "triangle" }, { "shader", "mirror" }, { "vertices", { { 0, -20, 0 }, { 1, -20, 0 }, { 0, -19, 0 } } } },
+			{ { "type", "sphereSet" }, { "shader", "plastic" }, { "centres", { { 0, -30, 0 }, { 3, -30, 0 } } }, { "radii", { 1, 2 } } },
+			// Three instances of one mesh, and one with a different shader.
+			meshObject("textured", -20.f, { { "instanced", true } }),
+			meshObject("textured", -10.f, { { "instanced", true } }),
+			meshObject("textured", 0.f, { { "instanced", true } }),
+			meshObject("plastic", 10.f, { { "instanced", true } }),
+			// The same mesh, not instanced, in the same place as the first instance.
+			meshObject("textured", -20.f),
+			// BVH settings that change the stored tree need their own cached model, while
+			// ones applied when the mesh is built use the same one.
+			meshObject("red", 20.f, { { "bvh", { { "maxLeafSize", 2 } } } }),
+			meshObject("red", 30.f, { { "bvh", { { "branchingFactor", 4 } } } }),
+			{ { "type", "group" }, { "accel", "bvhNode" }, { "bvh", { { "method", "lbvh" } } },
+				{ "transform", { { { "translate", { 0.f, 40.f, 0.f } } } } }, { "objects", {
+				{ { "type", "sphere" }, { "shader", "red" }, { "radius", 1.f } },
+				meshObject("red", 5.f) } } } } },
+		{ "lights", {
+			{ { "type", "point" }, { "position", { 0.f, 10.f, 0.f } }, { "intensity", { 1.f, 1.f, 1.f } } },
+			{ { "type", "directional" }, { "direction", { 0.f, -1.f, 0.f } }, { "intensity", { 0.5f, 0.5f, 0.5f } } } } } };
+
+	BVHBuildParams params;
+	params.sahBinCount = 8;
+	std::filesystem::path cacheDir = directory / "cache";
+	ModelCache modelCache(cacheDir.string());
+	TextureCache textureCache;
+	SceneFile sceneFile(writeScene(directory, "scene.json", file), params, modelCache, textureCache);
+	const std::vector<std::shared_ptr<Renderable>>& objects = sceneFile.scene().renderables;
+
+	// The file's "bvh" overrides the parameters given, leaving the rest.
+	CHECK(sceneFile.bvhParams().maxLeafSize == 4 && sceneFile.bvhParams().sahBinCount == 8);
+	CHECK(objects.size() == 12 && sceneFile.lights().size() == 2);
+	CHECK(sceneFile.ambientLight() == Eigen::Vector3f(0.1f, 0.2f, 0.3f));
+
+	// Transforms, given as steps (applied to the object in reverse order) or as a matrix.
+	// Spheres keep their radius, so the first is moved 20 up but not scaled.
+	HitInfo info;
+	Ray ray;
+	ray.origin = Eigen::Vector3f(0.f, 20.f, -10.f);
+	ray.direction = Eigen::Vector3f(0.f, 0.f, 1.f);
+	CHECK(hit(*objects[0], ray, info) && std::abs(info.hitT - 9.f) < 1e-4f);
+	ray.origin.y() = 30.f;
+	CHECK(hit(*objects[1], ray, info) && std::abs(info.hitT - 9.f) < 1e-4f);
+	CHECK(!objects[1]->occluded(ray, 0.f, 100.f, SHADOW_BITMASK) && objects[0]->occluded(rayAt(*objects[0]), 0.f, 100.f, SHADOW_BITMASK));
+	CHECK(hit(*objects[2], rayAt(*objects[2]), info) && hit(*objects[3], rayAt(*objects[3]), info));
+
+	// Instances of the same mesh and shader share one copy of it, and hit the same places
+	// as a mesh that isn't instanced.
+	std::shared_ptr<Instance> instances[4];
+	for (int i = 0; i < 4; ++i) instances[i] = std::dynamic_pointer_cast<Instance>(objects[4 + i]);
+	if (CHECK(instances[0] && instances[1] && instances[2] && instances[3])) {
+		CHECK(instances[0]->object() == instances[1]->object() && instances[0]->object() == instances[2]->object());
+		CHECK(instances[0]->object() != instances[3]->object());
+	}
+	CHECK(!std::dynamic_pointer_cast<Instance>(objects[8]));
+	HitInfo instanceHit, meshHit;
+	ray = rayAt(*objects[8]);
+	if (CHECK(hit(*objects[4], ray, instanceHit) && hit(*objects[8], ray, meshHit))) {
+		CHECK(std::abs(instanceHit.hitT - meshHit.hitT) < 1e-4f);
+		CHECK(instanceHit.normal.isApprox(meshHit.normal, 1e-3f) && instanceHit.texCoords.isApprox(meshHit.texCoords, 1e-3f));
+	}
+	for (int i = 4; i < 11; ++i) CHECK(hit(*objects[i], rayAt(*objects[i]), info));
+	// Groups place the objects in them with their own transform.
+	ray.origin = Eigen::Vector3f(0.f, 40.f, -10.f);
+	CHECK(hit(*objects[11], ray, info) && std::abs(info.hitT - 9.f) < 1e-4f);
+
+	// The cached model was stored for three sets of BVH parameters: the scene's, the ones
+	// with smaller leaves, and the group's LBVH. The unused model and texture weren't loaded.
+	CHECK(countFiles(cacheDir) == 3);
+
+	// Loading the scene again finds all of them in the cache.
+	SceneFile again(writeScene(directory, "scene.json", file), params, modelCache, textureCache);
+	CHECK(again.scene().renderables.size() == 12 && countFiles(cacheDir) == 3);
+}
+
+/// <summary>
+/// True if loading a scene file made by changing part of a small valid one throws a
+/// std::runtime_error.
+/// </summary>
+bool sceneThrows(const std::filesystem::path& directory, const nlohmann::json& patch)
+{
+	nlohmann::json file = {
+		{ "models", { { "spot", { { "filename", "spot.obj" } } } } },
+		{ "textures", { { "texture", { { "filename", "texture.tga" } } } } },
+		{ "shaders", { { "red", { { "type", "lambertian" }, { "albedo", { 1.f, 0.f, 0.f } } } } } },
+		{ "objects", { { { "type", "sphere" }, { "shader", "red" }, { "radius", 1.f } } } } };
+	file.update(patch);
+	ModelCache modelCache((directory / "cache").string());
+	TextureCache textureCache;
+	try {
+		SceneFile scene(writeScene(directory, "bad.json", file), BVHBuildParams(), modelCache, textureCache);
+	}
+	catch (const std::runtime_error& e) {
+		std::cout << "Expected error: " << e.what() << std::endl;
+		return true;
+	}
+	catch (...) {
+	}
+	return false;
+}
+
+void testErrors(const std::filesystem::path& directory)
+{
+	// The base file used by sceneThrows loads.
+	CHECK(!sceneThrows(directory, nlohmann::json::object()));
+
+	nlohmann::json red = { { "type", "lambertian" }, { "albedo", { 1.f, 0.f, 0.f } } };
+	nlohmann::json sphere = { { "type", "sphere" }, { "shader", "red" }, { "radius", 1.f } };
+	auto objects = [&](const nlohmann::json& object) {
+		return nlohmann::json{ { "objects", { object } } };
+	};
+	auto with = [](nlohmann::json object, const nlohmann::json& patch) {
+		object.update(patch);
+		return object;
+	};
+	CHECK(sceneThrows(directory, objects(with(sphere, { { "shader", "blue" } }))));
+	CHECK(sceneThrows(directory, objects(with(sphere, { { "type", "cube" } }))));
+	CHECK(sceneThrows(directory, objects(with(sphere, { { "mask", "invisible" } }))));
+	CHECK(sceneThrows(directory, objects(with(sphere, { { "transform", { { { "shear", 1.f } } } } }))));
+	CHECK(sceneThrows(directory, objects(with(sphere, { { "transform", { 1, 0, 0, 1 } } }))));
+	CHECK(sceneThrows(directory, objects({ { "type", "mesh" }, { "model", "cow" }, { "shader", "red" } })));
+	CHECK(sceneThrows(directory, objects({ { "type", "mesh" }, { "model", "spot" }, { "shader", "red" }, { "accel", "octree" } })));
+	CHECK(sceneThrows(directory, objects({ { "type", "group" }, { "accel", "octree" }, { "objects", { sphere } } })));
+	CHECK(sceneThrows(directory, objects({ { "type", "sphereSet" }, { "shader", "red" }, { "centres", { { 0, 0, 0 } } },
+		{ "radii", { 1, 2 } } })));
+	CHECK(sceneThrows(directory, objects({ { "type", "sphereSet" }, { "shader", "red" }, { "centres", { { 0, 0, 0 } } },
+		{ "radius", 1 }, { "transform", { { { "scale", 2.f } } } } })));
+	CHECK(sceneThrows(directory, { { "shaders", { { "red", { { "type", "glass" } } } } } }));
+	CHECK(sceneThrows(directory, { { "shaders", { { "red", red }, { "textured", { { "type", "texturedLambertian" }, { "texture", "wood" } } } } } }));
+	CHECK(sceneThrows(directory, { { "shaders", { { "red", red }, { "textured", { { "type", "texturedLambertian" }, { "texture", "texture" } } } } },
+		{ "textures", { { "texture", { { "filename", "texture.tga" }, { "format", "half" } } } } } }));
+	CHECK(sceneThrows(directory, { { "lights", { { { "type", "area" }, { "intensity", { 1.f, 1.f, 1.f } } } } } }));
+	CHECK(sceneThrows(directory, { { "bvh", { { "method", "kdtree" } } } }));
+	// Files that can't be loaded.
+	CHECK(sceneThrows(directory, { { "models", { { "spot", { { "filename", "missing.obj" } } } } },
+		{ "objects", { { { "type", "mesh" }, { "model", "spot" }, { "shader", "red" } } } } }));
+	CHECK(sceneThrows(directory, { { "shaders", { { "red", red }, { "textured", { { "type", "texturedLambertian" }, { "texture", "texture" } } } } },
+		{ "textures", { { "texture", { { "filename", "missing.tga" } } } } } }));
+
+	ModelCache modelCache((directory / "cache").string());
+	TextureCache textureCache;
+	CHECK_THROWS(SceneFile((directory / "missing.json").string(), BVHBuildParams(), modelCache, textureCache));
+}
+
+void testConfigScene(const std::filesystem::path& sourceDir, const std::filesystem::path& directory)
+{
+	// The scene main renders by default.
+	ModelCache modelCache((directory / "configCache").string());
+	TextureCache textureCache;
+	SceneFile scene((sourceDir / "config" / "scene.json").string(), BVHBuildParams(), modelCache, textureCache);
+	CHECK(scene.scene().renderables.size() == 5 && scene.lights().size() == 2);
+	CHECK(scene.ambientLight() == Eigen::Vector3f(0.1f, 0.1f, 0.1f));
+	CHECK(std::dynamic_pointer_cast<SphereSet>(scene.scene().renderables[4]) != nullptr);
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path directory = makeTestDirectory("SceneFileTests");
+	testScene(sourceDirectory(argc, argv), directory);
+	testErrors(directory);
+	testConfigScene(sourceDirectory(argc, argv), directory);
+	std::filesystem::remove_all(directory);
+	return testResult();
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+
+/// <summary>
+/// Checks used by the test programs (see the tests in CMakeLists.txt, run with ctest).
+/// Each test is a program that runs its checks from main() and returns testResult(),
+/// which is non-zero if any of them failed. A failed check prints where it is and carries
+/// on, so one run reports every failure.
+/// </summary>
+inline int& testFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+inline bool checkResult(bool passed, const std::string& expression, const char* file, int line)
+{
+	if (!passed) {
+		std::cerr << file << "(" << line << "): check failed: " << expression << std::endl;
+		++testFailures();
+	}
+	return passed;
+}
+
+#define CHECK(expression) checkResult(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
+
+#define CHECK_CLOSE(a, b, tolerance) checkResult(std::abs((a) - (b)) <= (tolerance), \
+	std::string(#a " == " #b " (") + std::to_string(a) + " vs " + std::to_string(b) + ")", __FILE__, __LINE__)
+
+#define CHECK_THROWS(statement) do { \
+		bool thrown = false; \
+		try { statement; } \
+		catch (const std::exception&) { thrown = true; } \
+		checkResult(thrown, #statement " throws", __FILE__, __LINE__); \
+	} while (0)
+
+/// <summary>
+/// Prints a summary and gives the value for main() to return.
+/// </summary>
+inline int testResult()
+{
+	if (testFailures() == 0) std::cout << "All checks passed." << std::endl;
+	else std::cerr << testFailures() << " check(s) failed." << std::endl;
+	return testFailures() == 0 ? 0 : 1;
+}
+
+/// <summary>
+/// The root of the source tree, where the models and config files are. CMake passes it
+/// to each test as its first argument.
+/// </summary>
+inline std::filesystem::path sourceDirectory(int argc, char** argv)
+{
+	return argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::path("..");
+}
+
+/// <summary>
+/// An empty directory for a test to write files to, in the system's temporary directory.
+/// </summary>
+inline std::filesystem::path makeTestDirectory(const std::string& name)
+{
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / ("ray-tracing-lab-tests-" + name);
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+	return directory;
+}
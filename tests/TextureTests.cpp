@@ -0,0 +1,206 @@
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <Eigen/Dense>
+#include "TestUtil.hpp"
+#include "Texture.hpp"
+#include "TextureCache.hpp"
+
+/// <summary>
+/// An RGBA image of random texels.
+/// </summary>
+TGAImage makeImage(int width, int height, int seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<int> byte(0, 255);
+	TGAImage image(width, height, TGAImage::RGBA);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			image.set(x, y, TGAColor(byte(random), byte(random), byte(random), byte(random)));
+		}
+	}
+	return image;
+}
+
+Eigen::Vector4f color(const TGAImage& image, int x, int y)
+{
+	TGAColor c = image.get(x, y);
+	return Eigen::Vector4f(c.r, c.g, c.b, c.a) / 255.f;
+}
+
+/// <summary>
+/// Texture coordinates of the centre of texel (x, y) of an image of the given size, where
+/// row 0 is the top of the image.
+/// </summary>
+Eigen::Vector2f texelCentre(int x, int y, int width, int height)
+{
+	return Eigen::Vector2f((x + 0.5f) / width, 1.f - (y + 0.5f) / height);
+}
+
+void testMipLevels()
+{
+	// Each level halves the size, rounding down, until the texture is one texel.
+	CHECK(Texture(makeImage(1, 1, 1)).levels() == 1);
+	CHECK(Texture(makeImage(8, 8, 1)).levels() == 4);
+	CHECK(Texture(makeImage(5, 3, 1)).levels() == 3);
+	CHECK(Texture(makeImage(16, 1, 1)).levels() == 5);
+	CHECK(Texture(makeImage(3, 64, 1)).levels() == 7);
+	Texture odd(makeImage(37, 21, 1), Texture::Format::UNorm8);
+	CHECK(odd.width() == 37 && odd.height() == 21 && odd.levels() == 6);
+	CHECK_THROWS(Texture{ TGAImage() });
+
+	// Texel centres of level 0 give the image's texels, and each level after averages
+	// 2x2 blocks of the one before.
+	TGAImage image = makeImage(8, 4, 2);
+	Texture texture(image);
+	std::vector<Eigen::Vector4f> level(32);
+	int width = 8, height = 4, wrong = 0;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			level[y * width + x] = color(image, x, y);
+			if (!texture.sample(texelCentre(x, y, width, height)).isApprox(level[y * width + x], 1e-5f)) ++wrong;
+		}
+	}
+	for (int l = 1; l < texture.levels(); ++l) {
+		int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+		std::vector<Eigen::Vector4f> next(nextWidth * nextHeight);
+		for (int y = 0; y < nextHeight; ++y) {
+			for (int x = 0; x < nextWidth; ++x) {
+				// A side that is already one texel across is used twice.
+				int x1 = std::min(2 * x + 1, width - 1), y1 = std::min(2 * y + 1, height - 1);
+				next[y * nextWidth + x] = 0.25f * (level[2 * y * width + 2 * x] + level[2 * y * width + x1]
+					+ level[y1 * width + 2 * x] + level[y1 * width + x1]);
+				if (!texture.sample(texelCentre(x, y, nextWidth, nextHeight), float(l)).isApprox(next[y * nextWidth + x], 1e-5f)) ++wrong;
+			}
+		}
+		level.swap(next);
+		width = nextWidth;
+		height = nextHeight;
+	}
+	CHECK(wrong == 0 && width == 1 && height == 1);
+
+	// An odd sized level leaves out its last row and column.
+	TGAImage three(3, 3, TGAImage::RGB);
+	for (int y = 0; y < 3; ++y) {
+		for (int x = 0; x < 3; ++x) three.set(x, y, TGAColor(x < 2 && y < 2 ? 100 : 255, 0, 0, 255));
+	}
+	Texture threeTexture(three);
+	CHECK(threeTexture.levels() == 2);
+	CHECK_CLOSE(threeTexture.sample(Eigen::Vector2f(0.5f, 0.5f), 1.f).x(), 100.f / 255.f, 1e-6f);
+}
+
+void testSampling()
+{
+	TGAImage image = makeImage(16, 8, 3);
+	Texture texture(image), bytes(image, Texture::Format::UNorm8);
+	CHECK(texture.format() == Texture::Format::Float && bytes.format() == Texture::Format::UNorm8);
+
+	// Halfway between two texels is their average.
+	Eigen::Vector2f between((3.f + 1.f) / 16.f, 1.f - 2.5f / 8.f);
+	CHECK(texture.sample(between).isApprox(0.5f * (color(image, 3, 2) + color(image, 4, 2)), 1e-5f));
+
+	// Outside the image, and in the half texel around its edge, lookups clamp to the
+	// edge texels.
+	CHECK(texture.sample(Eigen::Vector2f(-1.f, 2.f)).isApprox(color(image, 0, 0), 1e-6f));
+	CHECK(texture.sample(Eigen::Vector2f(0.01f, 0.99f)).isApprox(color(image, 0, 0), 1e-6f));
+	CHECK(texture.sample(Eigen::Vector2f(5.f, -3.f)).isApprox(color(image, 15, 7), 1e-6f));
+	CHECK(texture.sample(Eigen::Vector2f(1.f, 1.f - 4.5f / 8.f)).isApprox(color(image, 15, 4), 1e-6f));
+
+	// Blending between levels, and lod clamped to the levels there are.
+	Eigen::Vector2f uv(0.3f, 0.6f);
+	CHECK(texture.sample(uv, 0.25f).isApprox(0.75f * texture.sample(uv, 0.f) + 0.25f * texture.sample(uv, 1.f), 1e-5f));
+	CHECK(texture.sample(uv, -2.f) == texture.sample(uv, 0.f));
+	CHECK(texture.sample(uv, 100.f) == texture.sample(uv, float(texture.levels() - 1)));
+	CHECK(texture.sample(uv, 100.f) == texture.sample(Eigen::Vector2f(0.9f, 0.1f), 100.f));
+
+	// Bytes round each level once, so they stay within half a step of the floats, and
+	// give the image's own values at level 0.
+	std::mt19937 random(4);
+	std::uniform_real_distribution<float> uniform(-0.2f, 1.2f), lod(0.f, 5.f);
+	int wrong = 0;
+	for (int i = 0; i < 1000; ++i) {
+		Eigen::Vector2f texCoords(uniform(random), uniform(random));
+		float l = i % 2 == 0 ? 0.f : lod(random);
+		if ((bytes.sample(texCoords, l) - texture.sample(texCoords, l)).cwiseAbs().maxCoeff() > 0.5f / 255.f + 1e-6f) ++wrong;
+	}
+	for (int y = 0; y < 8; ++y) {
+		for (int x = 0; x < 16; ++x) {
+			if (!bytes.sample(texelCentre(x, y, 16, 8)).isApprox(color(image, x, y), 1e-6f)) ++wrong;
+		}
+	}
+	CHECK(wrong == 0);
+
+	// Greyscale images fill red, green and blue; images without alpha are opaque.
+	TGAImage grey(2, 2, TGAImage::GRAYSCALE), rgb(2, 2, TGAImage::RGB);
+	grey.set(0, 0, TGAColor(51, 1));
+	rgb.set(0, 0, TGAColor(10, 20, 30, 0));
+	CHECK(Texture(grey).sample(Eigen::Vector2f(0.f, 1.f)).isApprox(Eigen::Vector4f(0.2f, 0.2f, 0.2f, 1.f), 1e-6f));
+	CHECK(Texture(rgb).sample(Eigen::Vector2f(0.f, 1.f)).isApprox(Eigen::Vector4f(10.f, 20.f, 30.f, 255.f) / 255.f, 1e-6f));
+}
+
+void testLevelOfDetail()
+{
+	// The level where the footprint covers about one texel, clamped to the levels there are.
+	Texture square(makeImage(256, 256, 5)), wide(makeImage(64, 16, 5));
+	CHECK(square.levels() == 9 && wide.levels() == 7);
+	CHECK_CLOSE(square.levelOfDetail(1.f / 256.f), 0.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(1.f / 64.f), 2.f, 1e-5f);
+	CHECK_CLOSE(square.levelOfDetail(1.f / 90.5f), 1.5f, 1e-3f);
+	CHECK_CLOSE(square.levelOfDetail(1.f), 8.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(100.f), 8.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(1e-6f), 0.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(0.f), 0.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(-1.f), 0.f, 1e-6f);
+	CHECK_CLOSE(square.levelOfDetail(std::numeric_limits<float>::quiet_NaN()), 0.f, 1e-6f);
+	// Non-square textures use the geometric mean of their sides (32 here).
+	CHECK_CLOSE(wide.levelOfDetail(1.f / 8.f), 2.f, 1e-5f);
+	CHECK_CLOSE(wide.levelOfDetail(1.f), 5.f, 1e-5f);
+}
+
+void testTextureCache(const std::filesystem::path& directory)
+{
+	std::string filename = (directory / "texture.tga").string();
+	TGAImage image = makeImage(12, 10, 6);
+	CHECK(image.write_tga_file(filename.c_str()));
+
+	// One texture for each file and format, shared by everything that asks for it, even
+	// from several threads at once.
+	TextureCache cache;
+	const Texture* texture = cache.get(filename);
+	CHECK(texture && texture->format() == Texture::Format::UNorm8 && texture->width() == 12 && texture->height() == 10);
+	CHECK(cache.get(filename, Texture::Format::UNorm8) == texture);
+	const Texture* floats = cache.get(filename, Texture::Format::Float);
+	CHECK(floats != texture && floats->format() == Texture::Format::Float);
+	CHECK(floats->sample(texelCentre(2, 3, 12, 10)).isApprox(color(image, 2, 3), 1e-6f));
+
+	std::string other = (directory / "other.tga").string();
+	CHECK(makeImage(4, 4, 7).write_tga_file(other.c_str()));
+	const Texture* shared[16];
+	#pragma omp parallel for
+	for (int i = 0; i < 16; ++i) shared[i] = cache.get(other);
+	int different = 0;
+	for (const Texture* t : shared) if (t != shared[0]) ++different;
+	CHECK(different == 0 && shared[0] != texture && shared[0]->width() == 4);
+
+	// Files that can't be read throw, every time they're asked for.
+	std::string missing = (directory / "missing.tga").string();
+	CHECK_THROWS(cache.get(missing));
+	CHECK_THROWS(cache.get(missing));
+}
+
+int main()
+{
+	std::filesystem::path directory = makeTestDirectory("TextureTests");
+	testMipLevels();
+	testSampling();
+	testLevelOfDetail();
+	testTextureCache(directory);
+	std::filesystem::remove_all(directory);
+	return testResult();
+}